@@ -0,0 +1,1071 @@
+//=============================================================================
+// Copyright (c) 2016 Lumak
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//=============================================================================
+
+//=============================================================================
+// Headless benchmark of the ocean simulation. No engine, window or GPU is
+// created; cOcean runs directly and the vertex packing writes to system memory
+// in the same layout as the Ocean component's vertex buffer.
+//
+// -verify compares each variant against the direct DFT, cOcean::evaluateWaves(),
+// on small grids of a calm sea and a choppy one that folds over, and exits non-zero
+// if any field exceeds the variant's tolerance or a normal points down.
+//
+// -hugepages allocates each ocean's simulation memory with huge pages where the OS allows.
+//
+// The hulls variant times -hulls OceanHull boxes against a fixed surface on one thread,
+// and -verify checks a box at a known draft on flat water for |F| = rho g V and no torque.
+//
+// -writestate writes an OceanState and a hash of the ocean's vertices at a few times.
+// -checkstate, run in another process or on another machine, regenerates the ocean
+// from that state and exits non-zero unless every hash matches bit for bit.
+//
+// usage: 59_OceanBench [-n 64,128,...] [-threads 1,2,...] [-variants fft,...]
+//                      [-frames num] [-maxsec sec] [-out file.json] [-verify] [-hugepages]
+//                      [-writestate file] [-checkstate file] [-seed num] [-hulls num]
+//=============================================================================
+
+#include <Urho3D/Urho3D.h>
+#include <Urho3D/Core/Context.h>
+#include <Urho3D/Core/ProcessUtils.h>
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/Container/Sort.h>
+#include <Urho3D/Container/Str.h>
+#include <Urho3D/IO/VectorBuffer.h>
+#include <Urho3D/Scene/Node.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include "Ocean.h"
+#include "OceanHull.h"
+
+#include <Urho3D/DebugNew.h>
+
+//=============================================================================
+//=============================================================================
+#define SIM_TIME_STEP       (1.0f / 30.0f)
+#define WARMUP_FRAMES       2
+#define MIN_FRAMES          3
+#define BAKE_FRAMES_PER_SEC 2.0f
+#define VERIFY_MAX_N        64
+#define SLICE_BUDGET_USEC   1000
+#define STATE_CHECK_FRAMES  8
+#define BENCH_HULLS         300
+#define HULL_DIVISIONS      4           // per box edge, 192 triangles
+#define HULL_DRAFT          0.75f
+#define GRAVITY             9.81f
+
+enum StageType
+{
+    Stage_Spectrum,
+    Stage_FFTRows,
+    Stage_FFTColumns,
+    Stage_Vertices,
+    Stage_Decode,
+    Stage_Pack,
+    Stage_Slice,
+    Stage_Hulls,
+    Stage_Max
+};
+
+static const char *stageNames[Stage_Max] =
+{
+    "spectrum", "fft_rows", "fft_columns", "vertices", "decode", "pack", "slice", "hulls"
+};
+
+// per frame stage timings in usec, negative if the stage isn't part of the variant
+struct FrameTimes
+{
+    float usec[Stage_Max];
+};
+
+class BenchWorker;
+
+// -verify runs every variant on each, the choppy sea folds over (jacobian < 0) from N=32 up
+struct BenchSea
+{
+    const char *name;
+    float      A;
+    Vector2    wind;
+    float      length;
+};
+
+static const BenchSea seas[] =
+{
+    { "calm",   4e-6f, Vector2(1.0f, 12.0f), 800.0f },
+    { "choppy", 4e-5f, Vector2(1.0f, 12.0f), 400.0f },
+};
+static const unsigned numSeas = sizeof(seas) / sizeof(seas[0]);
+
+// the hulls variant's boxes
+static const Vector3 hullSize( 4.0f, 2.0f, 8.0f );
+
+struct BenchVariant
+{
+    const char *name;
+    int        maxN;                    // larger grids are skipped, i.e. when the setup cost is prohibitive
+    bool       (*setupFn)(BenchWorker &worker);
+    void       (*frameFn)(BenchWorker &worker, float t, FrameTimes &times);
+    float      tolerance;               // -verify, max error relative to the DFT field's magnitude, or the hull's force error
+    float      normalTolerance;         // -verify, max normal error, or the hull's torque error
+    bool       hulls;                   // floats hulls on the ocean rather than simulating it
+};
+
+//=============================================================================
+// what the hulls variant floats on, the worker's ocean evaluated once with the heights over the
+// undisplaced grid. Flat water at 0 without an ocean
+//=============================================================================
+class BenchSurface : public WaterSurface
+{
+public:
+    BenchSurface()
+        : ocean_(NULL)
+    {
+    }
+
+    virtual void GetWaterHeights(const float *x, const float *z, float *heights, unsigned count) const
+    {
+        if ( !ocean_ )
+        {
+            for ( unsigned i = 0; i < count; ++i )
+                heights[i] = 0.0f;
+
+            return;
+        }
+
+        int N = ocean_->getN();
+        int Nplus1 = N + 1;
+        float invCell = N / ocean_->getLength();
+
+        for ( unsigned i = 0; i < count; ++i )
+        {
+            float u = x[i] * invCell + N / 2.0f;
+            float v = z[i] * invCell + N / 2.0f;
+            float fu = floorf( u );
+            float fv = floorf( v );
+            int n = (int)fu % N;
+            int m = (int)fv % N;
+            n += n < 0 ? N : 0;
+            m += m < 0 ? N : 0;
+            fu = u - fu;
+            fv = v - fv;
+
+            const vertex_ocean *corner = &ocean_->vertices[ m * Nplus1 + n ];
+            heights[i] = Lerp( Lerp( corner[0].y, corner[1].y, fu ), Lerp( corner[Nplus1].y, corner[Nplus1 + 1].y, fu ), fv );
+        }
+    }
+
+public:
+    const cOcean *ocean_;
+};
+
+//=============================================================================
+//=============================================================================
+class BenchWorker
+{
+public:
+    BenchWorker(const BenchVariant &variant, const BenchSea &sea, int N, unsigned maxFrames, unsigned maxMSec, bool hugePages, unsigned numHulls)
+        : variant_(variant), compact_(false), maxFrames_(maxFrames), maxMSec_(maxMSec), numHulls_(numHulls)
+    {
+        ocean_ = new cOcean(N, sea.A, sea.wind, sea.length, false, hugePages);
+
+        // position, normal and uv, same as Ocean::MakeMesh()
+        vertexSize_ = sizeof(Vector3) * 2 + sizeof(Vector2);
+        vertexData_.Resize( (N + 1) * (N + 1) * vertexSize_ );
+    }
+
+    ~BenchWorker()
+    {
+        delete ocean_;
+    }
+
+    bool Setup()
+    {
+        return variant_.setupFn ? variant_.setupFn( *this ) : true;
+    }
+
+    // HelperThread callback
+    void Run()
+    {
+        Timer elapsed;
+
+        for ( unsigned i = 0; i < WARMUP_FRAMES + maxFrames_; ++i )
+        {
+            FrameTimes times;
+            for ( int s = 0; s < Stage_Max; ++s )
+                times.usec[s] = -1.0f;
+
+            variant_.frameFn( *this, (float)i * SIM_TIME_STEP, times );
+
+            if ( i < WARMUP_FRAMES )
+            {
+                elapsed.Reset();
+                continue;
+            }
+
+            frameTimes_.Push( times );
+
+            if ( frameTimes_.Size() >= MIN_FRAMES && elapsed.GetMSec(false) > maxMSec_ )
+                break;
+        }
+    }
+
+    void Pack()
+    {
+        if ( compact_ )
+            ocean_->packVerticesCompact( reinterpret_cast<vertex_ocean_compact*>( &vertexData_[0] ) );
+        else
+            ocean_->packVertices( &vertexData_[0], vertexSize_ );
+    }
+
+public:
+    const BenchVariant       &variant_;
+    cOcean                   *ocean_;
+    OceanFrameCache          frameCache_;
+    PODVector<unsigned char> vertexData_;
+    unsigned                 vertexSize_;
+    bool                     compact_;              // pack the Ocean component's dynamic stream instead
+    unsigned                 maxFrames_;
+    unsigned                 maxMSec_;
+    PODVector<FrameTimes>    frameTimes_;
+
+    // the hulls variant's, each on its own node outside any scene
+    unsigned                 numHulls_;
+    BenchSurface             surface_;
+    SharedPtr<Context>       context_;
+    Vector<SharedPtr<Node> > hullNodes_;
+    PODVector<OceanHull*>    hulls_;
+};
+
+//=============================================================================
+// variants
+//=============================================================================
+static void FrameFFT(BenchWorker &worker, float t, FrameTimes &times)
+{
+    HiresTimer timer;
+    cOcean *ocean = worker.ocean_;
+
+    ocean->evaluateSpectrum( t );
+    times.usec[Stage_Spectrum] = (float)timer.GetUSec(true);
+
+    ocean->fftRows();
+    times.usec[Stage_FFTRows] = (float)timer.GetUSec(true);
+
+    ocean->fftColumns();
+    times.usec[Stage_FFTColumns] = (float)timer.GetUSec(true);
+
+    ocean->updateVertices();
+    times.usec[Stage_Vertices] = (float)timer.GetUSec(true);
+
+    worker.Pack();
+    times.usec[Stage_Pack] = (float)timer.GetUSec(true);
+}
+
+// the step spread over budgeted slices, as the simulation does when time slicing. The slice stage is
+// the longest slice, the one that sets the frame's hitch
+static void FrameSliced(BenchWorker &worker, float t, FrameTimes &times)
+{
+    HiresTimer timer;
+    cOcean *ocean = worker.ocean_;
+    float maxSlice = 0.0f;
+
+    ocean->beginStep( t );
+
+    while ( !ocean->isStepDone() )
+    {
+        HiresTimer sliceTimer;
+
+        while ( !ocean->advanceStep( 1 ) && sliceTimer.GetUSec(false) < SLICE_BUDGET_USEC )
+            ;
+
+        maxSlice = Max( maxSlice, (float)sliceTimer.GetUSec(false) );
+    }
+
+    times.usec[Stage_Slice] = maxSlice;
+    timer.Reset();
+
+    worker.Pack();
+    times.usec[Stage_Pack] = (float)timer.GetUSec(true);
+}
+
+static bool SetupFDNormals(BenchWorker &worker)
+{
+    worker.ocean_->setFiniteDifferenceNormals( true );
+    return true;
+}
+
+static bool SetupCompact(BenchWorker &worker)
+{
+    worker.compact_ = true;
+    return true;
+}
+
+static bool SetupPlayback(BenchWorker &worker)
+{
+    return worker.frameCache_.Bake( worker.ocean_, BAKE_FRAMES_PER_SEC, 0 );
+}
+
+static void FramePlayback(BenchWorker &worker, float t, FrameTimes &times)
+{
+    HiresTimer timer;
+
+    worker.frameCache_.Playback( worker.ocean_, t );
+    times.usec[Stage_Decode] = (float)timer.GetUSec(true);
+
+    worker.Pack();
+    times.usec[Stage_Pack] = (float)timer.GetUSec(true);
+}
+
+// a closed box centered on the origin, each face a grid of divisions x divisions quads wound out
+static void MakeBox(const Vector3 &size, int divisions, PODVector<Vector3> &vertices, PODVector<unsigned> &indices)
+{
+    // each face's normal and the axes across it, u x v = normal
+    static const Vector3 faces[6][3] =
+    {
+        { Vector3::RIGHT,   Vector3::UP,      Vector3::FORWARD },
+        { Vector3::LEFT,    Vector3::FORWARD, Vector3::UP      },
+        { Vector3::UP,      Vector3::FORWARD, Vector3::RIGHT   },
+        { Vector3::DOWN,    Vector3::RIGHT,   Vector3::FORWARD },
+        { Vector3::FORWARD, Vector3::RIGHT,   Vector3::UP      },
+        { Vector3::BACK,    Vector3::UP,      Vector3::RIGHT   },
+    };
+
+    Vector3 half = size * 0.5f;
+
+    for ( int f = 0; f < 6; ++f )
+    {
+        unsigned base = vertices.Size();
+
+        for ( int j = 0; j <= divisions; ++j )
+        {
+            for ( int i = 0; i <= divisions; ++i )
+            {
+                float s = 2.0f * i / divisions - 1.0f;
+                float t = 2.0f * j / divisions - 1.0f;
+                vertices.Push( ( faces[f][0] + faces[f][1] * s + faces[f][2] * t ) * half );
+            }
+        }
+
+        for ( int j = 0; j < divisions; ++j )
+        {
+            for ( int i = 0; i < divisions; ++i )
+            {
+                unsigned a = base + j * ( divisions + 1 ) + i;
+                unsigned c = a + divisions + 1;
+
+                indices.Push( a );
+                indices.Push( a + 1 );
+                indices.Push( c + 1 );
+                indices.Push( a );
+                indices.Push( c + 1 );
+                indices.Push( c );
+            }
+        }
+    }
+}
+
+static bool SetupHulls(BenchWorker &worker)
+{
+    // the surface is fixed, the frames time the hulls alone
+    worker.ocean_->evaluateWavesFFT( 0.0f );
+    worker.surface_.ocean_ = worker.ocean_;
+
+    worker.context_ = new Context();
+    OceanHull::RegisterObject( worker.context_ );
+
+    PODVector<Vector3> vertices;
+    PODVector<unsigned> indices;
+    MakeBox( hullSize, HULL_DIVISIONS, vertices, indices );
+
+    // spread over the patch, turned and riding at half their height so the waterline crosses them
+    unsigned side = (unsigned)CeilToInt( sqrtf( (float)worker.numHulls_ ) );
+    float length = worker.ocean_->getLength();
+
+    for ( unsigned i = 0; i < worker.numHulls_; ++i )
+    {
+        SharedPtr<Node> node( new Node( worker.context_ ) );
+        node->SetPosition( Vector3( ( i % side + 0.5f ) / side - 0.5f, 0.0f, ( i / side + 0.5f ) / side - 0.5f ) * length );
+        node->SetRotation( Quaternion( 0.0f, i * 37.0f, 0.0f ) );
+
+        OceanHull *hull = node->CreateComponent<OceanHull>();
+
+        if ( !hull->SetHull( vertices, indices ) )
+            return false;
+
+        worker.hullNodes_.Push( node );
+        worker.hulls_.Push( hull );
+    }
+
+    return true;
+}
+
+static void FrameHulls(BenchWorker &worker, float /*t*/, FrameTimes &times)
+{
+    HiresTimer timer;
+
+    for ( unsigned i = 0; i < worker.hulls_.Size(); ++i )
+        worker.hulls_[i]->Update( &worker.surface_ );
+
+    times.usec[Stage_Hulls] = (float)timer.GetUSec(false);
+}
+
+static const BenchVariant variants[] =
+{
+    { "fft",           M_MAX_INT, NULL,           FrameFFT,      1e-3f, 1e-3f, false },
+    { "fft_fdnormals", M_MAX_INT, SetupFDNormals, FrameFFT,      1e-3f, 0.65f, false },  // height differences miss the slope near Nyquist, 0.44 calm and 0.61 choppy at N=64
+    { "fft_compact",   M_MAX_INT, SetupCompact,   FrameFFT,      5e-3f, 2e-2f, false },  // 16-bit fixed point, 8-bit octahedral normals
+    { "fft_sliced",    M_MAX_INT, NULL,           FrameSliced,   1e-3f, 1e-3f, false },  // 1 ms slices
+    { "playback",      128,       SetupPlayback,  FramePlayback, 1e-1f, 2e-1f, false },  // lerps between frames baked at 2 fps, normals 0.05 calm and 0.19 choppy at N=64
+    { "hulls",         M_MAX_INT, SetupHulls,     FrameHulls,    1e-4f, 1e-4f, true  },  // force and torque relative to rho g V
+};
+static const unsigned numVariants = sizeof(variants) / sizeof(variants[0]);
+
+static const BenchVariant* FindVariant(const String &name)
+{
+    for ( unsigned i = 0; i < numVariants; ++i )
+    {
+        if ( name == variants[i].name )
+            return &variants[i];
+    }
+
+    return NULL;
+}
+
+//=============================================================================
+//=============================================================================
+struct StageStats
+{
+    float minUSec;
+    float medianUSec;
+    float p99USec;
+};
+
+static bool GetStageStats(const Vector<BenchWorker*> &workers, int stage, StageStats &stats)
+{
+    PODVector<float> samples;
+
+    for ( unsigned i = 0; i < workers.Size(); ++i )
+    {
+        const PODVector<FrameTimes> &frameTimes = workers[i]->frameTimes_;
+
+        for ( unsigned j = 0; j < frameTimes.Size(); ++j )
+        {
+            if ( frameTimes[j].usec[stage] >= 0.0f )
+                samples.Push( frameTimes[j].usec[stage] );
+        }
+    }
+
+    if ( samples.Empty() )
+        return false;
+
+    Sort( samples.Begin(), samples.End() );
+
+    // nearest rank
+    unsigned p99 = (unsigned)CeilToInt( 0.99f * samples.Size() ) - 1;
+
+    stats.minUSec    = samples[0];
+    stats.medianUSec = samples[ samples.Size() / 2 ];
+    stats.p99USec    = samples[ Min( p99, samples.Size() - 1 ) ];
+
+    return true;
+}
+
+//=============================================================================
+// verify
+//=============================================================================
+enum FieldType
+{
+    Field_Height,
+    Field_Displacement,
+    Field_Normal,
+    Field_Jacobian,
+    Field_Max
+};
+
+static const char *fieldNames[Field_Max] =
+{
+    "height", "displacement", "normal", "jacobian"
+};
+
+struct FieldError
+{
+    float  maxErr;
+    double sumSqErr;
+    float  maxRef;      // largest magnitude in the DFT field, errors are reported relative to it
+    unsigned count;
+
+    void Add(float err, float ref)
+    {
+        maxErr = Max( maxErr, err );
+        maxRef = Max( maxRef, ref );
+        sumSqErr += (double)err * err;
+        ++count;
+    }
+
+    float GetRMS() const      { return count ? (float)sqrt( sumSqErr / count ) : 0.0f; }
+    float GetRelative() const { return maxRef > M_EPSILON ? maxErr / maxRef : maxErr; }
+};
+
+// folded counts the DFT's vertices with a negative jacobian, flipped the variant's normals that don't point up
+struct FoldCounts
+{
+    unsigned folded;
+    unsigned flipped;
+};
+
+static void CompareVertices(const BenchWorker &worker, const cOcean *oracle, FieldError errors[Field_Max], FoldCounts &folds)
+{
+    const cOcean *ocean = worker.ocean_;
+    int Nplus1 = ocean->getN() + 1;
+    const vertex_ocean_compact *compact = reinterpret_cast<const vertex_ocean_compact*>( &worker.vertexData_[0] );
+
+    for ( int i = 0; i < Nplus1 * Nplus1; ++i )
+    {
+        const vertex_ocean &v = ocean->vertices[i];
+        const vertex_ocean &o = oracle->vertices[i];
+
+        Vector2 disp( v.x - v.ox, v.z - v.oz );
+        Vector2 dispRef( o.x - o.ox, o.z - o.oz );
+        Vector3 normal( v.nx, v.ny, v.nz );
+        Vector3 normalRef( o.nx, o.ny, o.nz );
+        float height = v.y;
+        float jacobian = v.j;
+
+        // what the shaders see
+        if ( worker.compact_ )
+        {
+            Vector3 decoded;
+            cOcean::decodeCompact( compact[i], ocean->getLength() * OCEAN_COMPACT_RANGE, decoded, normal, jacobian );
+            disp = Vector2( decoded.x_, decoded.z_ );
+            height = decoded.y_;
+        }
+
+        errors[Field_Height].Add( Abs( height - o.y ), Abs( o.y ) );
+        errors[Field_Displacement].Add( (disp - dispRef).Length(), dispRef.Length() );
+        errors[Field_Normal].Add( (normal - normalRef).Length(), normalRef.Length() );
+        errors[Field_Jacobian].Add( Abs( jacobian - o.j ), Abs( o.j ) );
+
+        folds.folded += o.j < 0.0f;
+        folds.flipped += normal.y_ <= 0.0f;
+    }
+}
+
+// a box at a known draft on flat water displaces what's under, |F| = rho g V straight up, with no torque
+// about its center. It's off the origin and turned, so the node's transform is part of it
+static bool VerifyHulls(const BenchVariant &variant, bool firstResult, FILE *out)
+{
+    fprintf( stderr, "verify %s\n", variant.name );
+
+    SharedPtr<Context> context( new Context() );
+    OceanHull::RegisterObject( context );
+
+    SharedPtr<Node> node( new Node( context ) );
+    node->SetPosition( Vector3( 37.0f, hullSize.y_ * 0.5f - HULL_DRAFT, -12.0f ) );
+    node->SetRotation( Quaternion( 0.0f, 30.0f, 0.0f ) );
+
+    OceanHull *hull = node->CreateComponent<OceanHull>();
+    PODVector<Vector3> vertices;
+    PODVector<unsigned> indices;
+    MakeBox( hullSize, HULL_DIVISIONS, vertices, indices );
+
+    bool setupOk = hull->SetHull( vertices, indices );
+    BenchSurface flat;
+
+    hull->Update( &flat );
+
+    float volume = hullSize.x_ * hullSize.z_ * HULL_DRAFT;
+    float buoyancy = hull->GetWaterDensity() * GRAVITY * volume;
+    const Vector3 &force = hull->GetForce();
+    const Vector3 &torque = hull->GetTorque();
+
+    // the torque relative to the most the buoyancy could exert on the box
+    float forceErr = ( force - Vector3( 0.0f, buoyancy, 0.0f ) ).Length() / buoyancy;
+    float torqueErr = torque.Length() / ( buoyancy * hullSize.Length() * 0.5f );
+    bool passed = setupOk && forceErr <= variant.tolerance && torqueErr <= variant.normalTolerance;
+
+    fprintf( out, "%s\n    {\n      \"variant\": \"%s\",\n      \"passed\": %s,\n      \"tolerance\": %g,\n      \"torqueTolerance\": %g,\n"
+                  "      \"triangles\": %u,\n      \"draft\": %g,\n      \"buoyancy\": %g,\n"
+                  "      \"force\": [ %g, %g, %g ],\n      \"torque\": [ %g, %g, %g ],\n      \"forceErr\": %g,\n      \"torqueErr\": %g\n    }",
+             firstResult ? "" : ",", variant.name, passed ? "true" : "false", variant.tolerance, variant.normalTolerance,
+             hull->GetNumTriangles(), HULL_DRAFT, buoyancy, force.x_, force.y_, force.z_, torque.x_, torque.y_, torque.z_, forceErr, torqueErr );
+    fflush( out );
+
+    if ( !passed )
+        fprintf( stderr, "FAILED %s\n", variant.name );
+
+    return passed;
+}
+
+static bool RunVerify(const PODVector<int> &sizes, const Vector<String> &variantNames, FILE *out)
+{
+    // includes times between the playback variant's baked frames
+    static const float verifyTimes[] = { 0.0f, 1.7f, 13.3f, 77.9f };
+    static const unsigned numTimes = sizeof(verifyTimes) / sizeof(verifyTimes[0]);
+
+    bool allPassed = true;
+    bool firstResult = true;
+
+    fprintf( out, "{\n  \"benchmark\": \"59_OceanBench\",\n  \"mode\": \"verify\",\n  \"results\": [" );
+
+    for ( unsigned v = 0; v < variantNames.Size(); ++v )
+    {
+        const BenchVariant *variant = FindVariant( variantNames[v] );
+
+        // not a simulation, nothing to compare with the DFT
+        if ( variant->hulls )
+        {
+            allPassed = VerifyHulls( *variant, firstResult, out ) && allPassed;
+            firstResult = false;
+            continue;
+        }
+
+        for ( unsigned n = 0; n < sizes.Size(); ++n )
+        {
+            int N = sizes[n];
+
+            if ( !IsPowerOfTwo( N ) || N > variant->maxN || N > VERIFY_MAX_N )
+            {
+                fprintf( stderr, "skipping %s N=%d\n", variant->name, N );
+                continue;
+            }
+
+            for ( unsigned sea = 0; sea < numSeas; ++sea )
+            {
+                fprintf( stderr, "verify %s N=%d %s\n", variant->name, N, seas[sea].name );
+
+                // same seed, so both start from the same spectrum
+                BenchWorker worker( *variant, seas[sea], N, 0, 0, false, 0 );
+                cOcean oracle( N, seas[sea].A, seas[sea].wind, seas[sea].length, false );
+
+                FieldError errors[Field_Max];
+                memset( errors, 0, sizeof(errors) );
+                FoldCounts folds = { 0, 0 };
+
+                bool setupOk = worker.Setup();
+                long long variantUSec = 0;
+                long long dftUSec = 0;
+
+                for ( unsigned i = 0; i < numTimes && setupOk; ++i )
+                {
+                    FrameTimes times;
+                    HiresTimer timer;
+
+                    variant->frameFn( worker, verifyTimes[i], times );
+                    variantUSec += timer.GetUSec(true);
+
+                    oracle.evaluateWaves( verifyTimes[i] );
+                    dftUSec += timer.GetUSec(true);
+
+                    CompareVertices( worker, &oracle, errors, folds );
+                }
+
+                bool passed = setupOk && folds.flipped == 0;
+
+                for ( int f = 0; f < Field_Max; ++f )
+                    passed = passed && errors[f].GetRelative() <= ( f == Field_Normal ? variant->normalTolerance : variant->tolerance );
+
+                allPassed = allPassed && passed;
+
+                fprintf( out, "%s\n    {\n      \"variant\": \"%s\",\n      \"N\": %d,\n      \"sea\": \"%s\",\n      \"passed\": %s,\n"
+                              "      \"tolerance\": %g,\n      \"normalTolerance\": %g,\n      \"dftSpeedup\": %.1f,\n"
+                              "      \"foldedVertices\": %u,\n      \"flippedNormals\": %u,\n      \"fields\": {",
+                         firstResult ? "" : ",", variant->name, N, seas[sea].name, passed ? "true" : "false", variant->tolerance,
+                         variant->normalTolerance, variantUSec > 0 ? (float)dftUSec / variantUSec : 0.0f, folds.folded, folds.flipped );
+                firstResult = false;
+
+                for ( int f = 0; f < Field_Max; ++f )
+                {
+                    fprintf( out, "%s\n        \"%s\": { \"maxErr\": %g, \"rmsErr\": %g, \"relErr\": %g }",
+                             f == 0 ? "" : ",", fieldNames[f], errors[f].maxErr, errors[f].GetRMS(), errors[f].GetRelative() );
+                }
+
+                fprintf( out, "\n      }\n    }" );
+                fflush( out );
+
+                if ( !passed )
+                    fprintf( stderr, "FAILED %s N=%d %s\n", variant->name, N, seas[sea].name );
+            }
+        }
+    }
+
+    fprintf( out, "\n  ],\n  \"passed\": %s\n}\n", allPassed ? "true" : "false" );
+
+    return allPassed;
+}
+
+//=============================================================================
+// state replication
+//=============================================================================
+// FNV-1a over every vertex, spectrum included
+static unsigned HashVertices(const cOcean &ocean)
+{
+    int Nplus1 = ocean.getN() + 1;
+    const unsigned char *bytes = reinterpret_cast<const unsigned char*>( ocean.vertices );
+    unsigned size = Nplus1 * Nplus1 * sizeof(vertex_ocean);
+    unsigned hash = 2166136261U;
+
+    for ( unsigned i = 0; i < size; ++i )
+        hash = ( hash ^ bytes[i] ) * 16777619U;
+
+    return hash;
+}
+
+static float StateCheckTime(const OceanState &state, unsigned frame)
+{
+    // spread out to wrap the repeat time a few times over
+    return state.time + frame * frame * 37.3f;
+}
+
+static bool RunWriteState(const String &fileName, int N, unsigned seed, FILE *out)
+{
+    OceanState state;
+    state.seed   = seed;
+    state.N      = N;
+    state.A      = 4e-6f;
+    state.wind   = Vector2(1.0f, 12.0f);
+    state.length = 800.0f;
+    state.time   = 12.5f;
+
+    cOcean ocean( state.N, state.A, state.wind, state.length, false, false, state.seed );
+    VectorBuffer buffer;
+
+    state.Write( buffer );
+    buffer.WriteUInt( STATE_CHECK_FRAMES );
+
+    for ( unsigned i = 0; i < STATE_CHECK_FRAMES; ++i )
+    {
+        ocean.evaluateWavesFFT( StateCheckTime( state, i ) );
+        buffer.WriteUInt( HashVertices( ocean ) );
+    }
+
+    FILE *file = fopen( fileName.CString(), "wb" );
+
+    if ( !file || fwrite( buffer.GetData(), 1, buffer.GetSize(), file ) != buffer.GetSize() )
+    {
+        fprintf( stderr, "unable to write %s\n", fileName.CString() );
+
+        if ( file )
+            fclose( file );
+
+        return false;
+    }
+
+    fclose( file );
+
+    fprintf( out, "{\n  \"benchmark\": \"59_OceanBench\",\n  \"mode\": \"writestate\",\n  \"N\": %d,\n  \"seed\": %u,\n  \"stateBytes\": %u\n}\n",
+             N, seed, buffer.GetSize() - STATE_CHECK_FRAMES * 4 - 4 );
+
+    return true;
+}
+
+static bool RunCheckState(const String &fileName, FILE *out)
+{
+    FILE *file = fopen( fileName.CString(), "rb" );
+    VectorBuffer buffer;
+    unsigned char chunk[4096];
+    size_t read;
+
+    while ( file && (read = fread( chunk, 1, sizeof(chunk), file )) > 0 )
+        buffer.Write( chunk, (unsigned)read );
+
+    if ( file )
+        fclose( file );
+
+    buffer.Seek( 0 );
+
+    OceanState state;
+
+    if ( !state.Read( buffer ) || state.N > 1024 )
+    {
+        fprintf( stderr, "unable to read a state from %s\n", fileName.CString() );
+        return false;
+    }
+
+    unsigned numFrames = buffer.ReadUInt();
+    cOcean ocean( state.N, state.A, state.wind, state.length, false, false, state.seed );
+    unsigned matched = 0;
+
+    fprintf( out, "{\n  \"benchmark\": \"59_OceanBench\",\n  \"mode\": \"checkstate\",\n  \"N\": %d,\n  \"seed\": %u,\n  \"frames\": [",
+             state.N, state.seed );
+
+    for ( unsigned i = 0; i < numFrames && !buffer.IsEof(); ++i )
+    {
+        float t = StateCheckTime( state, i );
+        unsigned expected = buffer.ReadUInt();
+
+        ocean.evaluateWavesFFT( t );
+        unsigned hash = HashVertices( ocean );
+
+        matched += hash == expected;
+
+        fprintf( out, "%s\n    { \"time\": %g, \"expected\": \"%08x\", \"hash\": \"%08x\" }", i == 0 ? "" : ",", t, expected, hash );
+    }
+
+    bool passed = numFrames > 0 && matched == numFrames;
+
+    fprintf( out, "\n  ],\n  \"passed\": %s\n}\n", passed ? "true" : "false" );
+
+    return passed;
+}
+
+//=============================================================================
+//=============================================================================
+static PODVector<int> ParseIntList(const char *arg)
+{
+    PODVector<int> list;
+    Vector<String> tokens = String(arg).Split(',');
+
+    for ( unsigned i = 0; i < tokens.Size(); ++i )
+        list.Push( ToInt(tokens[i]) );
+
+    return list;
+}
+
+static void PrintUsage()
+{
+    fprintf( stderr, "usage: 59_OceanBench [-n 64,128,...] [-threads 1,2,...] [-variants fft,...]\n"
+                     "                     [-frames num] [-maxsec sec] [-out file.json] [-verify] [-hugepages]\n"
+                     "                     [-writestate file] [-checkstate file] [-seed num] [-hulls num]\n"
+                     "variants:" );
+
+    for ( unsigned v = 0; v < numVariants; ++v )
+        fprintf( stderr, " %s", variants[v].name );
+
+    fprintf( stderr, "\n" );
+}
+
+//=============================================================================
+//=============================================================================
+int main(int argc, char **argv)
+{
+    PODVector<int> sizes;
+    PODVector<int> threadCounts;
+    Vector<String> variantNames;
+    unsigned maxFrames = 30;
+    unsigned maxMSec = 10000;
+    String outFile;
+    bool verify = false;
+    bool hugePages = false;
+    String writeStateFile;
+    String checkStateFile;
+    unsigned seed = OCEAN_DEFAULT_SEED;
+    unsigned numHulls = BENCH_HULLS;
+
+    for ( int i = 1; i < argc; ++i )
+    {
+        String arg(argv[i]);
+        bool hasValue = i + 1 < argc;
+
+        if ( arg == "-n" && hasValue )
+            sizes = ParseIntList( argv[++i] );
+        else if ( arg == "-threads" && hasValue )
+            threadCounts = ParseIntList( argv[++i] );
+        else if ( arg == "-variants" && hasValue )
+            variantNames = String(argv[++i]).Split(',');
+        else if ( arg == "-frames" && hasValue )
+            maxFrames = ToUInt( argv[++i] );
+        else if ( arg == "-maxsec" && hasValue )
+            maxMSec = ToUInt( argv[++i] ) * 1000;
+        else if ( arg == "-out" && hasValue )
+            outFile = argv[++i];
+        else if ( arg == "-verify" )
+            verify = true;
+        else if ( arg == "-hugepages" )
+            hugePages = true;
+        else if ( arg == "-writestate" && hasValue )
+            writeStateFile = argv[++i];
+        else if ( arg == "-checkstate" && hasValue )
+            checkStateFile = argv[++i];
+        else if ( arg == "-seed" && hasValue )
+            seed = ToUInt( argv[++i] );
+        else if ( arg == "-hulls" && hasValue )
+            numHulls = ToUInt( argv[++i] );
+        else
+        {
+            PrintUsage();
+            return 1;
+        }
+    }
+
+    if ( sizes.Empty() )
+    {
+        for ( int N = verify ? 16 : 64; N <= (verify ? VERIFY_MAX_N : 1024); N *= 2 )
+            sizes.Push( N );
+    }
+
+    if ( threadCounts.Empty() )
+    {
+        threadCounts.Push( 1 );
+
+        if ( GetNumPhysicalCPUs() > 1 )
+            threadCounts.Push( GetNumPhysicalCPUs() );
+    }
+
+    if ( variantNames.Empty() )
+    {
+        for ( unsigned v = 0; v < numVariants; ++v )
+            variantNames.Push( variants[v].name );
+    }
+
+    for ( unsigned v = 0; v < variantNames.Size(); ++v )
+    {
+        if ( !FindVariant( variantNames[v] ) )
+        {
+            fprintf( stderr, "unknown variant %s\n", variantNames[v].CString() );
+            PrintUsage();
+            return 1;
+        }
+    }
+
+    FILE *out = outFile.Empty() ? stdout : fopen( outFile.CString(), "w" );
+
+    if ( !out )
+    {
+        fprintf( stderr, "unable to open %s\n", outFile.CString() );
+        return 1;
+    }
+
+    if ( !writeStateFile.Empty() || !checkStateFile.Empty() )
+    {
+        bool passed = checkStateFile.Empty() ? RunWriteState( writeStateFile, sizes[0], seed, out ) : RunCheckState( checkStateFile, out );
+
+        if ( out != stdout )
+            fclose( out );
+
+        return passed ? 0 : 1;
+    }
+
+    if ( verify )
+    {
+        bool passed = RunVerify( sizes, variantNames, out );
+
+        if ( out != stdout )
+            fclose( out );
+
+        return passed ? 0 : 1;
+    }
+
+    fprintf( out, "{\n  \"benchmark\": \"59_OceanBench\",\n  \"cpus\": %u,\n  \"timeStep\": %f,\n  \"results\": [",
+             GetNumPhysicalCPUs(), SIM_TIME_STEP );
+
+    bool firstResult = true;
+
+    for ( unsigned v = 0; v < variantNames.Size(); ++v )
+    {
+        const BenchVariant *variant = FindVariant( variantNames[v] );
+
+        for ( unsigned n = 0; n < sizes.Size(); ++n )
+        {
+            int N = sizes[n];
+
+            if ( !IsPowerOfTwo( N ) || N > variant->maxN )
+            {
+                fprintf( stderr, "skipping %s N=%d\n", variant->name, N );
+                continue;
+            }
+
+            for ( unsigned c = 0; c < threadCounts.Size(); ++c )
+            {
+                unsigned numThreads = Max( threadCounts[c], 1 );
+                Vector<BenchWorker*> workers;
+                bool setupOk = true;
+
+                // the hulls share their scratch, they're updated on the main thread
+                if ( variant->hulls && numThreads > 1 )
+                {
+                    fprintf( stderr, "skipping %s threads=%u\n", variant->name, numThreads );
+                    continue;
+                }
+
+                fprintf( stderr, "%s N=%d threads=%u\n", variant->name, N, numThreads );
+
+                // each thread simulates its own ocean
+                for ( unsigned i = 0; i < numThreads; ++i )
+                {
+                    workers.Push( new BenchWorker( *variant, seas[0], N, maxFrames, maxMSec, hugePages, numHulls ) );
+                    setupOk = setupOk && workers.Back()->Setup();
+                }
+
+                HiresTimer wallTimer;
+
+                if ( setupOk )
+                {
+                    Vector<HelperThread<BenchWorker>*> threads;
+
+                    for ( unsigned i = 0; i < numThreads; ++i )
+                    {
+                        threads.Push( new HelperThread<BenchWorker>( workers[i], &BenchWorker::Run, false ) );
+                        threads.Back()->Start();
+                    }
+
+                    // joins
+                    for ( unsigned i = 0; i < threads.Size(); ++i )
+                        delete threads[i];
+                }
+
+                float wallMSec = (float)wallTimer.GetUSec(false) / 1000.0f;
+                unsigned totalFrames = 0;
+
+                for ( unsigned i = 0; i < workers.Size(); ++i )
+                    totalFrames += workers[i]->frameTimes_.Size();
+
+                // per ocean, the variant's own data such as the frame cache isn't included
+                fprintf( out, "%s\n    {\n      \"variant\": \"%s\",\n      \"N\": %d,\n      \"threads\": %u,\n"
+                              "      \"frames\": %u,\n      \"wallMs\": %.3f,\n      \"framesPerSec\": %.2f,\n"
+                              "      \"simulationBytes\": %u,\n      \"hugePages\": %s,\n      \"hulls\": %u,\n      \"stages\": {",
+                         firstResult ? "" : ",", variant->name, N, numThreads, totalFrames, wallMSec,
+                         wallMSec > 0.0f ? totalFrames * 1000.0f / wallMSec : 0.0f,
+                         workers[0]->ocean_->getFootprint(), workers[0]->ocean_->usesHugePages() ? "true" : "false",
+                         workers[0]->hulls_.Size() );
+                firstResult = false;
+
+                bool firstStage = true;
+
+                for ( int s = 0; s < Stage_Max; ++s )
+                {
+                    StageStats stats;
+
+                    if ( !GetStageStats( workers, s, stats ) )
+                        continue;
+
+                    fprintf( out, "%s\n        \"%s\": { \"minUs\": %.1f, \"medianUs\": %.1f, \"p99Us\": %.1f }",
+                             firstStage ? "" : ",", stageNames[s], stats.minUSec, stats.medianUSec, stats.p99USec );
+                    firstStage = false;
+                }
+
+                fprintf( out, "\n      }\n    }" );
+                fflush( out );
+
+                for ( unsigned i = 0; i < workers.Size(); ++i )
+                    delete workers[i];
+            }
+        }
+    }
+
+    fprintf( out, "\n  ]\n}\n" );
+
+    if ( out != stdout )
+        fclose( out );
+
+    return 0;
+}
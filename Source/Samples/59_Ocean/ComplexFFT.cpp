@@ -2,10 +2,13 @@
 //=============================================================================
 
 #include <Urho3D/Urho3D.h>
+#include <Urho3D/Container/HashMap.h>
+#include <Urho3D/Core/Mutex.h>
 #include <Urho3D/Math/MathDefs.h>
 #include <Urho3D/Math/Vector4.h>
 
 #include "ComplexFFT.h"
+#include "OceanMath.h"
 
 #include <SDL/SDL_log.h>
 #include <Urho3D/DebugNew.h>
@@ -54,38 +57,50 @@ void complex::reset() {
 }
 
 
-cFFT::cFFT(unsigned int N) : N(N), reversed(0), T(0), pi2(2 * M_PI) {
-	c[0] = c[1] = 0;
+//=============================================================================
+//=============================================================================
+// plans by size, freed at exit
+static struct cFFTPlanRegistry {
+	HashMap<unsigned int, cFFTPlan*> plans;
+	Mutex lock;
+
+	~cFFTPlanRegistry() {
+		for (HashMap<unsigned int, cFFTPlan*>::Iterator itr = plans.Begin(); itr != plans.End(); ++itr) delete itr->second_;
+	}
+} registry;
+
+cFFTPlan::cFFTPlan(unsigned int N) : N(N), log_2_N(0), reversed(0), T(0) {
+	while ((1u << log_2_N) < N) log_2_N++;
 
-	log_2_N = log(N)/log(2);
+	arena.Allocate(OceanArena::Align(N * sizeof(unsigned int)) + OceanArena::Align(log_2_N * sizeof(complex*)) +
+	               OceanArena::Align((N - 1) * sizeof(complex)), false);
 
-	reversed = new unsigned int[N];		// prep bit reversals
+	reversed = arena.Alloc<unsigned int>(N);		// prep bit reversals
 	for (int i = 0; i < N; i++) reversed[i] = reverse(i);
 
 	int pow2 = 1;
-	T = new complex*[log_2_N];		// prep T
+	T = arena.Alloc<complex*>(log_2_N);		// prep T, the stages share one table
+	complex *twiddles = arena.Alloc<complex>(N - 1);
 	for (int i = 0; i < log_2_N; i++) {
-		T[i] = new complex[pow2];
+		T[i] = twiddles;
 		for (int j = 0; j < pow2; j++) T[i][j] = t(j, pow2 * 2);
+		twiddles += pow2;
 		pow2 *= 2;
 	}
-
-	c[0] = new complex[N];
-	c[1] = new complex[N];
-	which = 0;
 }
 
-cFFT::~cFFT() {
-	if (c[0]) delete [] c[0];
-	if (c[1]) delete [] c[1];
-	if (T) {
-		for (int i = 0; i < log_2_N; i++) if (T[i]) delete [] T[i];
-		delete [] T;
-	}
-	if (reversed) delete [] reversed;
+const cFFTPlan* cFFTPlan::acquire(unsigned int N) {
+	MutexLock lock(registry.lock);
+
+	HashMap<unsigned int, cFFTPlan*>::Iterator itr = registry.plans.Find(N);
+	if (itr != registry.plans.End()) return itr->second_;
+
+	cFFTPlan *plan = new cFFTPlan(N);
+	registry.plans[N] = plan;
+	return plan;
 }
 
-unsigned int cFFT::reverse(unsigned int i) {
+unsigned int cFFTPlan::reverse(unsigned int i) const {
 	unsigned int res = 0;
 	for (int j = 0; j < log_2_N; j++) {
 		res = (res << 1) + (i & 1);
@@ -94,11 +109,32 @@ unsigned int cFFT::reverse(unsigned int i) {
 	return res;
 }
 
-complex cFFT::t(unsigned int x, unsigned int N) {
-	return complex(cos(pi2 * x / N), sin(pi2 * x / N));
+complex cFFTPlan::t(unsigned int x, unsigned int N) {
+	float s, c;
+	detSinCos((double)x / N, s, c);
+	return complex(c, s);
+}
+
+//=============================================================================
+//=============================================================================
+cFFT::cFFT(unsigned int N, OceanArena &arena) : plan(cFFTPlan::acquire(N)), N(N), which(0) {
+	c[0] = arena.Alloc<complex>(N);
+	c[1] = arena.Alloc<complex>(N);
+}
+
+cFFT::~cFFT() {
+	// the arena owns the buffers, the registry the plan
+}
+
+unsigned int cFFT::arenaSize(unsigned int N) {
+	return 2 * OceanArena::Align(N * sizeof(complex));
 }
 
 void cFFT::fft(complex* input, complex* output, int stride, int offset) {
+	const unsigned int *reversed = plan->reversed;
+	complex * const *T = plan->T;
+	unsigned int log_2_N = plan->log_2_N;
+
 	for (int i = 0; i < N; i++) c[which][i] = input[reversed[i] * stride + offset];
 
 	int loops       = N>>1;
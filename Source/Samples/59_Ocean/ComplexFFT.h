@@ -7,6 +7,8 @@
 //#include <Urho3D/Container/Vector.h>
 #include <Urho3D/Container/ArrayPtr.h>
 
+#include "OceanArena.h"
+
 using namespace Urho3D;
 
 //=============================================================================
@@ -29,20 +31,32 @@ class complex {
     static void reset();
 };
 
+// immutable tables for an N point transform, one per size for the whole process
+class cFFTPlan {
+  private:
+	OceanArena arena;
+	cFFTPlan(unsigned int N);
+  public:
+	unsigned int N, log_2_N;
+	unsigned int *reversed;		// bit reversals
+	complex **T;				// twiddles per stage, the stages share one table
+
+	static const cFFTPlan* acquire(unsigned int N);		// thread safe, plans live until exit
+	unsigned int getFootprint() const { return arena.GetSize(); }
+	unsigned int reverse(unsigned int i) const;
+	static complex t(unsigned int x, unsigned int N);
+};
+
 class cFFT {
   private:
+	const cFFTPlan *plan;
 	unsigned int N, which;
-	unsigned int log_2_N;
-	float pi2;
-	unsigned int *reversed;
-	complex **T;
 	complex *c[2];
   protected:
   public:
-	cFFT(unsigned int N);
+	cFFT(unsigned int N, OceanArena &arena);	// work buffers come from the arena, the tables are the shared plan's
 	~cFFT();
-	unsigned int reverse(unsigned int i);
-	complex t(unsigned int x, unsigned int N);
+	static unsigned int arenaSize(unsigned int N);
+	const cFFTPlan* getPlan() const { return plan; }
 	void fft(complex* input, complex* output, int stride, int offset);
 };
-
@@ -44,10 +44,26 @@ public:
         WaitExit();
     }
 
-    void Start()
+    // returns false if the thread couldn't be started, e.g. on a build without threading
+    bool Start()
     {
-        Run();
+        // marked as running before the thread starts, so an early WaitExit() still waits for it
+        SetFnExit(false);
+
+        if (!Run())
+        {
+            SetFnExit(true);
+            return false;
+        }
+
         SetPriority(priority_);
+        return true;
+    }
+
+    // asks the thread to exit after the current callback, without waiting for it
+    void RequestExit()
+    {
+        SetLooping(false);
     }
 
     virtual void ThreadFunction()
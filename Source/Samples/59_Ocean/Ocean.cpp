@@ -24,17 +24,26 @@
 #include <Urho3D/Urho3D.h>
 #include <Urho3D/Core/Context.h>
 #include <Urho3D/Core/CoreEvents.h>
+#include <Urho3D/Core/Profiler.h>
 #include <Urho3D/Core/Timer.h>
+#include <Urho3D/Graphics/Camera.h>
 #include <Urho3D/Graphics/Graphics.h>
 #include <Urho3D/Graphics/Texture2D.h>
 #include <Urho3D/Graphics/Material.h>
 #include <Urho3D/Graphics/Model.h>
 #include <Urho3D/Graphics/StaticModel.h>
+#include <Urho3D/Graphics/Terrain.h>
 #include <Urho3D/Graphics/Geometry.h>
 #include <Urho3D/Graphics/VertexBuffer.h>
 #include <Urho3D/Graphics/IndexBuffer.h>
+#include <Urho3D/Graphics/Renderer.h>
+#include <Urho3D/Graphics/Viewport.h>
 #include <Urho3D/Math/BoundingBox.h>
+#include <Urho3D/IO/Deserializer.h>
+#include <Urho3D/IO/File.h>
+#include <Urho3D/IO/Serializer.h>
 #include <Urho3D/IO/FileSystem.h>
+#include <Urho3D/Resource/Image.h>
 #include <Urho3D/Scene/Scene.h>
 #include <Urho3D/Graphics/DebugRenderer.h>
 #include <SDL/SDL_log.h>
@@ -45,32 +54,41 @@
 #endif
 
 #include "Ocean.h"
+#include "OceanHull.h"
 #include "ComplexFFT.h"
+#include "OceanMath.h"
 
 #include <Urho3D/DebugNew.h>
 
 //=============================================================================
 //=============================================================================
 #define GRAVITY            9.81f
-#define FRAME_RATE_MS      33
+#define DEFAULT_GRID_SIZE           64
+#define DEFAULT_AMPLITUDE           4e-6f
+#define DEFAULT_WIND                Vector2(1.0f, 12.0f)
+#define DEFAULT_PATCH_LENGTH        800.0f
+#define MIN_GRID_SIZE               16
+#define MAX_GRID_SIZE               128
+#define DEFAULT_OFFSCREEN_RATE      4.0f
+#define DEFAULT_FULL_RATE_DISTANCE  500.0f
+#define DEFAULT_SHORE_DEPTH         8.0f
+#define APPROACH_MARGIN             0.25f       // of the bounding box's size, the box grown by it tests as about to come into view
 
 //=============================================================================
 //=============================================================================
-float uniformRandomVariable() 
+// gaussian pair for a grid coordinate, the same for a seed regardless of the order it's asked for in
+complex gaussianRandomVariable(unsigned seed, int n_prime, int m_prime) 
 {
-	return (float)rand()/RAND_MAX;
-}
-
-complex gaussianRandomVariable() 
-{
-	float x1, x2, w;
+	unsigned stream = hashUInt(seed ^ hashUInt(((unsigned)m_prime << 16) ^ ((unsigned)n_prime & 0xffff)));
+	double x1, x2, w;
+	unsigned i = 0;
 	do {
-	    x1 = 2.f * uniformRandomVariable() - 1.f;
-	    x2 = 2.f * uniformRandomVariable() - 1.f;
+	    x1 = 2.0 * hashUniform(stream, i++) - 1.0;
+	    x2 = 2.0 * hashUniform(stream, i++) - 1.0;
 	    w = x1 * x1 + x2 * x2;
-	} while ( w >= 1.f );
-	w = sqrt((-2.f * log(w)) / w);
-	return complex(x1 * w, x2 * w);
+	} while ( w >= 1.0 || w == 0.0 );
+	w = sqrt((-2.0 * detLog(w)) / w);
+	return complex((float)(x1 * w), (float)(x2 * w));
 }
 
 //=============================================================================
@@ -78,164 +96,780 @@ complex gaussianRandomVariable()
 void Ocean::RegisterObject(Context *context)
 {
     context->RegisterFactory<Ocean>();
+
+    URHO3D_ACCESSOR_ATTRIBUTE("Grid Size", GetGridSize, SetGridSize, int, DEFAULT_GRID_SIZE, AM_DEFAULT);
+    URHO3D_ACCESSOR_ATTRIBUTE("Amplitude", GetAmplitude, SetAmplitude, float, DEFAULT_AMPLITUDE, AM_DEFAULT);
+    URHO3D_ACCESSOR_ATTRIBUTE("Wind", GetWind, SetWind, Vector2, DEFAULT_WIND, AM_DEFAULT);
+    URHO3D_ACCESSOR_ATTRIBUTE("Patch Length", GetPatchLength, SetPatchLength, float, DEFAULT_PATCH_LENGTH, AM_DEFAULT);
+    URHO3D_ACCESSOR_ATTRIBUTE("Seed", GetSeed, SetSeed, unsigned, OCEAN_DEFAULT_SEED, AM_DEFAULT);
+    URHO3D_ACCESSOR_ATTRIBUTE("Detail Scale", GetDetailScale, SetDetailScale, int, 0, AM_DEFAULT);
 }
 
 Ocean::Ocean(Context *context)
     : Component(context)
-    , pCOcean(NULL)
-    , threadProcess_(NULL)
-    , elapsedFrameTimer_(NULL)
+    , gridSize_(DEFAULT_GRID_SIZE)
+    , amplitude_(DEFAULT_AMPLITUDE)
+    , wind_(DEFAULT_WIND)
+    , patchLength_(DEFAULT_PATCH_LENGTH)
+    , seed_(OCEAN_DEFAULT_SEED)
+    , N(0)
+    , Nplus1(0)
+    , surfaceValid_(false)
+    , parametersDirty_(false)
+    , stateTimePending_(false)
+    , detailScale_(0)
+    , detailVersion_(M_MAX_UNSIGNED)
+    , shoreDepth_(DEFAULT_SHORE_DEPTH)
+    , visibility_(Visibility_InView)
+    , inFrustum_(true)
+    , approaching_(true)
+    , offscreenSimRate_(DEFAULT_OFFSCREEN_RATE)
+    , fullRateDistance_(DEFAULT_FULL_RATE_DISTANCE)
 {
 }
 
 Ocean::~Ocean()
 {
-    if ( threadProcess_ )
+    if ( simulation_ )
     {
-        delete threadProcess_;
-        threadProcess_ = NULL;
+        simulation_->RemoveClient( this );
+        simulation_ = NULL;
     }
 
-    if ( pCOcean )
+    if ( pendingSimulation_ )
     {
-        delete pCOcean;
-        pCOcean = NULL;
+        pendingSimulation_->RemoveClient( this );
+        pendingSimulation_ = NULL;
     }
 }
 
 void Ocean::InitOcean() 
 {
-    N = 64;
+    //InitOcean(64, 0.0005f, Vector2(32.0f, 32.0f),   64);
+    //InitOcean(64,  0.004f,  Vector2( 3.0f,  0.6f),  800); // works ok
+    //InitOcean(64,   4e-5f,  Vector2( 6.0f,  0.02f), 800); // works ok
+    //InitOcean(64,   4e-6f,  Vector2( 6.0f,  6.0f),  800); // works ok
+    //InitOcean(64,   4e-6f,  Vector2( 8.0f,  8.0f),  800); // works ok
+    //InitOcean(64,   4e-6f,  Vector2(1.0f, 12.0f),   800); // works ok
+
+    // attributes, the defaults are the last of the above
+    InitOcean(gridSize_, amplitude_, wind_, patchLength_);
+}
+
+void Ocean::InitOcean(int size, float A, const Vector2 &wind, float length)
+{
+    SetGridSize( size );
+    SetAmplitude( A );
+    SetWind( wind );
+    SetPatchLength( length );
+
+    N = gridSize_;
     Nplus1 = N+1;
     
-    MakeMesh(Nplus1, m_mesh);
-    
-    //pCOcean = new cOcean(64, 0.0005f, Vector2(32.0f, 32.0f),   64, false);
-    //pCOcean = new cOcean(N,  0.004f,  Vector2( 3.0f,  0.6f),  800, false); // works ok
-    //pCOcean = new cOcean(N,   4e-5f,  Vector2( 6.0f,  0.02f), 800, false); // works ok
-    //pCOcean = new cOcean(N,   4e-6f,  Vector2( 6.0f,  6.0f),  800, false); // works ok
-    //pCOcean = new cOcean(N,   4e-6f,  Vector2( 8.0f,  8.0f),  800, false); // works ok
-    pCOcean = new cOcean(N,   4e-6f,  Vector2(1.0f, 12.0f),   800, false); // works ok
+    MakeMesh(Nplus1, patchLength_, m_mesh);
+    ripples_.Init(N, patchLength_);
+
+    if ( simulation_ )
+        simulation_->RemoveClient( this );
+
+    simulation_ = OceanSimulation::Acquire( context_, N, amplitude_, wind_, patchLength_, seed_ );
+    simulation_->SetDetailScale( detailScale_ );
+    detailVersion_ = M_MAX_UNSIGNED;
+    UpdateShoreMask();
+    pendingSimulation_ = NULL;
+    parametersDirty_ = false;
+    ApplyStateTime();
+
+    // after the camera has moved for the frame
+    SubscribeToEvent(E_POSTUPDATE, URHO3D_HANDLER(Ocean, HandlePostUpdate));
+}
 
-    // start thread
-    elapsedFrameTimer_ = new Time(context_);
-    threadProcess_ = new HelperThread<Ocean>(this, &Ocean::BackgroundProcess);
-    threadProcess_->Start();
+void Ocean::SetGridSize(int size)
+{
+    // a power of 2 for the FFT, and (N+1)^2 vertices have to fit 16-bit indices
+    size = Clamp( (int)NextPowerOfTwo( (unsigned)Max( size, 1 ) ), MIN_GRID_SIZE, MAX_GRID_SIZE );
 
-    SubscribeToEvent(E_UPDATE, URHO3D_HANDLER(Ocean, HandleUpdate));
+    if ( size != gridSize_ )
+    {
+        gridSize_ = size;
+        parametersDirty_ = true;
+    }
 }
 
-void Ocean::SetProcessPending(bool bset)
+void Ocean::SetAmplitude(float A)
 {
-    MutexLock lock(mutexPendingLock_);
-    processPending_ = bset;
+    if ( A != amplitude_ )
+    {
+        amplitude_ = A;
+        parametersDirty_ = true;
+    }
 }
 
-bool Ocean::IsProcessPending()
+void Ocean::SetWind(const Vector2 &wind)
 {
-    MutexLock lock(mutexPendingLock_);
-    return processPending_;
+    if ( wind != wind_ )
+    {
+        wind_ = wind;
+        parametersDirty_ = true;
+    }
 }
 
-void Ocean::BackgroundProcess()
+void Ocean::SetWeather(float A, const Vector2 &wind, float seconds)
 {
-    // fixed at 30 fps
-    if ( processTimer_.GetMSec(false) < FRAME_RATE_MS )
+    if ( seconds <= 0.0f || !simulation_ || parametersDirty_ || pendingSimulation_ )
+    {
+        SetAmplitude( A );
+        SetWind( wind );
         return;
+    }
+
+    amplitude_ = A;
+    wind_ = wind;
+    simulation_->SetWeather( A, wind, seconds );
+}
+
+bool Ocean::IsWeatherBlending() const
+{
+    return simulation_ && simulation_->IsWeatherBlending();
+}
+
+void Ocean::SetPatchLength(float length)
+{
+    length = Max( length, 1.0f );
 
-    if ( IsProcessPending() )
+    if ( length != patchLength_ )
     {
-        EvaluateWavesFFT();
+        patchLength_ = length;
+        parametersDirty_ = true;
+    }
+}
 
-        SetProcessPending(false);
+void Ocean::SetSeed(unsigned seed)
+{
+    if ( seed != seed_ )
+    {
+        seed_ = seed;
+        parametersDirty_ = true;
     }
 }
 
-void Ocean::HandleUpdate(StringHash eventType, VariantMap& eventData)
+bool Ocean::GetState(OceanState &state)
+{
+    state = OceanState();
+    state.seed   = seed_;
+    state.N      = gridSize_;
+    state.A      = amplitude_;
+    state.wind   = wind_;
+    state.length = patchLength_;
+    state.time   = simulation_ ? simulation_->GetElapsedTime() : 0.0f;
+
+    if ( !simulation_ )
+        return true;
+
+    return simulation_->GetWeatherBlend( state.blending, state.fromA, state.fromWind, state.blendStart, state.blendSeconds );
+}
+
+void Ocean::SetState(const OceanState &state)
+{
+    // a blend's simulation is the one it started from, the blend is applied to it with the time
+    SetGridSize( state.N );
+    SetAmplitude( state.blending ? state.fromA : state.A );
+    SetWind( state.blending ? state.fromWind : state.wind );
+    SetPatchLength( state.length );
+    SetSeed( state.seed );
+
+    // the time goes to the simulation with these parameters, which may still be on its way
+    pendingState_ = state;
+    stateTimer_.Reset();
+    stateTimePending_ = true;
+    ApplyStateTime();
+}
+
+void Ocean::ApplyStateTime()
 {
-    if ( !IsProcessPending() )
+    if ( !stateTimePending_ || !simulation_ || parametersDirty_ || pendingSimulation_ )
+        return;
+
+    simulation_->SetTime( pendingState_.time + stateTimer_.GetMSec(false) / 1000.0f );
+    stateTimePending_ = false;
+
+    // at the host's start, so each step blends by the same amount as the host's did
+    if ( pendingState_.blending )
     {
-        UpdateVertexBuffer();
+        amplitude_ = pendingState_.A;
+        wind_ = pendingState_.wind;
+        simulation_->SetWeather( pendingState_.A, pendingState_.wind, pendingState_.blendSeconds, pendingState_.blendStart );
+    }
+}
+
+void Ocean::UpdateReconfigure()
+{
+    // shared with another component, or its worker has exited - either way releasing it won't block
+    if ( retiredSimulation_ && (retiredSimulation_->Refs() > 1 || retiredSimulation_->Shutdown()) )
+        retiredSimulation_ = NULL;
+
+    // changes made while a simulation is being prepared are picked up after it's swapped in
+    if ( parametersDirty_ && !pendingSimulation_ && !retiredSimulation_ )
+    {
+        parametersDirty_ = false;
+        pendingSimulation_ = OceanSimulation::Acquire( context_, gridSize_, amplitude_, wind_, patchLength_, seed_ );
+
+        if ( pendingSimulation_ == simulation_ )
+            pendingSimulation_ = NULL;
+        else
+            pendingSimulation_->SetDetailScale( detailScale_ );
+    }
+
+    // nothing to hide the swap from when it's not drawn
+    if ( pendingSimulation_ && (pendingSimulation_->IsReady() || visibility_ != Visibility_InView) )
+        SwapSimulation();
+
+    // another component sharing the simulation may have changed its weather
+    if ( !parametersDirty_ && !pendingSimulation_ )
+    {
+        amplitude_ = simulation_->GetAmplitude();
+        wind_ = simulation_->GetWind();
+    }
+
+    ApplyStateTime();
+}
+
+void Ocean::SwapSimulation()
+{
+    // the mesh is sized by the grid, and its static stream holds the grid's positions
+    bool remesh = pendingSimulation_->GetGridSize() != N || pendingSimulation_->GetPatchLength() != simulation_->GetPatchLength();
+
+    simulation_->RemoveClient( this );
+    retiredSimulation_ = simulation_;
+    simulation_ = pendingSimulation_;
+    pendingSimulation_ = NULL;
+    detailVersion_ = M_MAX_UNSIGNED;
+
+    if ( remesh )
+    {
+        N = simulation_->GetGridSize();
+        Nplus1 = N+1;
+
+        m_BoundingBox.Clear();
+        MakeMesh(Nplus1, simulation_->GetPatchLength(), m_mesh);
+        ripples_.Init(N, simulation_->GetPatchLength());
+        UpdateShoreMask();
+
+        Drawable *drawable = drawable_;
+
+        if ( drawable && drawable->IsInstanceOf<StaticModel>() )
+            static_cast<StaticModel*>( drawable )->SetModel( m_pModelOcean );
+    }
+}
+
+void Ocean::SetDetailScale(int scale)
+{
+    detailScale_ = Max( scale, 0 );
+
+    if ( simulation_ )
+        simulation_->SetDetailScale( detailScale_ );
+
+    if ( pendingSimulation_ )
+        pendingSimulation_->SetDetailScale( detailScale_ );
+}
+
+void Ocean::SetDrawable(Drawable *drawable)
+{
+    drawable_ = drawable;
+}
+
+void Ocean::SetOffscreenSimRate(float hz)
+{
+    offscreenSimRate_ = Max( hz, 0.1f );
+}
+
+void Ocean::SetFullRateDistance(float distance)
+{
+    fullRateDistance_ = distance;
+}
+
+void Ocean::GetWaterHeights(const float *x, const float *z, float *heights, unsigned count) const
+{
+    // into the mesh's space, as AddDisturbance(). The ocean's level, so the world height doesn't move x, z
+    const Matrix3x4 &transform = node_->GetWorldTransform();
+    Matrix3x4 inverse = transform.Inverse();
+    float level = transform.m13_;
+
+    if ( !surfaceValid_ )
+    {
+        for ( unsigned i = 0; i < count; ++i )
+            heights[ i ] = level;
+
+        return;
+    }
+
+    // the mesh's positions went through UpdateVertexBuffer()'s scale and position, undone per sample
+    Vector3 scale = node_->GetScale();
+    Vector3 position = node_->GetPosition();
+    Vector3 invScale( 1.0f / scale.x_, 1.0f / scale.y_, 1.0f / scale.z_ );
+    float cell = simulation_->GetPatchLength() / N;
+    float invCell = 1.0f / cell;
+
+    for ( unsigned i = 0; i < count; ++i )
+    {
+        Vector3 local = inverse * Vector3( x[ i ], level, z[ i ] );
+
+        // the water over a point was displaced there from about one displacement back
+        float u = local.x_ * invCell + N / 2.0f;
+        float v = local.z_ * invCell + N / 2.0f;
+        Vector3 displacement = SampleDisplacement( u, v, position, invScale, cell );
+
+        displacement = SampleDisplacement( u - displacement.x_ * invCell, v - displacement.z_ * invCell, position, invScale, cell );
+        heights[ i ] = ( transform * Vector3( local.x_, displacement.y_, local.z_ ) ).y_;
+    }
+}
+
+float Ocean::GetWaterHeight(const Vector3 &worldPosition) const
+{
+    float height;
+    GetWaterHeights( &worldPosition.x_, &worldPosition.z_, &height, 1 );
+
+    return height;
+}
+
+void Ocean::GetWaterJacobians(const float *x, const float *z, float *jacobians, unsigned count) const
+{
+    if ( !surfaceValid_ )
+    {
+        for ( unsigned i = 0; i < count; ++i )
+            jacobians[ i ] = 1.0f;
+
+        return;
+    }
+
+    // at the point the water was displaced from, as GetWaterHeights()
+    const Matrix3x4 &transform = node_->GetWorldTransform();
+    Matrix3x4 inverse = transform.Inverse();
+    float level = transform.m13_;
+    Vector3 scale = node_->GetScale();
+    Vector3 position = node_->GetPosition();
+    Vector3 invScale( 1.0f / scale.x_, 1.0f / scale.y_, 1.0f / scale.z_ );
+    float cell = simulation_->GetPatchLength() / N;
+    float invCell = 1.0f / cell;
+
+    for ( unsigned i = 0; i < count; ++i )
+    {
+        Vector3 local = inverse * Vector3( x[ i ], level, z[ i ] );
+        float u = local.x_ * invCell + N / 2.0f;
+        float v = local.z_ * invCell + N / 2.0f;
+        Vector3 displacement = SampleDisplacement( u, v, position, invScale, cell );
+
+        jacobians[ i ] = SampleJacobian( u - displacement.x_ * invCell, v - displacement.z_ * invCell );
+    }
+}
+
+float Ocean::GetWaterJacobian(const Vector3 &worldPosition) const
+{
+    float jacobian;
+    GetWaterJacobians( &worldPosition.x_, &worldPosition.z_, &jacobian, 1 );
+
+    return jacobian;
+}
+
+Vector3 Ocean::SampleDisplacement(float u, float v, const Vector3 &position, const Vector3 &invScale, float cell) const
+{
+    // bilinear over the grid in the mesh's space, the last row and column repeat the first
+    float fu = floorf( u );
+    float fv = floorf( v );
+    int n = (int)fu % N;
+    int m = (int)fv % N;
+    n += n < 0 ? N : 0;
+    m += m < 0 ? N : 0;
+    fu = u - fu;
+    fv = v - fv;
+
+    Vector3 displacement[4];
+
+    for ( int j = 0; j < 2; ++j )
+    {
+        for ( int i = 0; i < 2; ++i )
+        {
+            Vector3 rest( ( n + i - N / 2.0f ) * cell, 0.0f, ( m + j - N / 2.0f ) * cell );
+            displacement[ j * 2 + i ] = ( m_mesh.vertices[ ( m + j ) * Nplus1 + n + i ] - position ) * invScale - rest;
+        }
+    }
+
+    return displacement[0].Lerp( displacement[1], fu ).Lerp( displacement[2].Lerp( displacement[3], fu ), fv );
+}
+
+float Ocean::SampleJacobian(float u, float v) const
+{
+    // bilinear over the grid, as SampleDisplacement()
+    float fu = floorf( u );
+    float fv = floorf( v );
+    int n = (int)fu % N;
+    int m = (int)fv % N;
+    n += n < 0 ? N : 0;
+    m += m < 0 ? N : 0;
+    fu = u - fu;
+    fv = v - fv;
+
+    const float *corner = &m_mesh.jacobians[ m * Nplus1 + n ];
+
+    return Lerp( Lerp( corner[0], corner[1], fu ), Lerp( corner[Nplus1], corner[Nplus1 + 1], fu ), fv );
+}
 
-        SetProcessPending(true);
+void Ocean::AddHull(OceanHull *hull)
+{
+    if ( !hulls_.Contains( WeakPtr<OceanHull>( hull ) ) )
+        hulls_.Push( WeakPtr<OceanHull>( hull ) );
+}
+
+void Ocean::RemoveHull(OceanHull *hull)
+{
+    hulls_.Remove( WeakPtr<OceanHull>( hull ) );
+}
+
+void Ocean::UpdateHulls()
+{
+    if ( hulls_.Empty() )
+        return;
+
+    URHO3D_PROFILE(UpdateOceanHulls);
+    HiresTimer timer;
+
+    for ( unsigned i = 0; i < hulls_.Size(); )
+    {
+        OceanHull *hull = hulls_[ i ];
+
+        if ( !hull )
+        {
+            hulls_.Erase( i );
+            continue;
+        }
+
+        if ( hull->IsEnabledEffective() )
+            hull->Update( this );
+
+        ++i;
     }
+
+    simulation_->GetProfiler().Record( OceanProfiler::Stage_Hulls, timer.GetUSec(false) );
 }
 
-void Ocean::EvaluateWavesFFT() 
+void Ocean::AddDisturbance(const Vector3 &worldPosition, float radius, float strength)
 {
-    // process FFT
-    float t = elapsedFrameTimer_->GetElapsedTime();// * 2.0f; // increase the wave change rate
-    pCOcean->evaluateWavesFFT( t );
+    // into the mesh's space
+    Vector3 local = node_->GetWorldTransform().Inverse() * worldPosition;
+    Vector3 scale = node_->GetWorldScale();
 
-    // reset process timer
-    processTimer_.Reset();
+    ripples_.AddDisturbance( local.x_, local.z_, radius / scale.x_, strength / scale.y_ );
+}
+
+Ocean::VisibilityType Ocean::UpdateVisibility(float &distance, bool &approaching)
+{
+    distance = 0.0f;
+    approaching = true;
+    Drawable *drawable = drawable_;
+
+    if ( !drawable )
+        return Visibility_InView;
+
+    approaching = false;
+
+    if ( !drawable->IsEnabledEffective() )
+        return Visibility_Hidden;
+
+    // IsInView() is from last frame, so the cameras are also tested as they are now - otherwise the
+    // first frame back in view would show the ocean as it was when it left
+    Renderer *renderer = GetSubsystem<Renderer>();
+    const BoundingBox &box = drawable->GetWorldBoundingBox();
+    Vector3 margin = box.Size() * APPROACH_MARGIN;
+    BoundingBox approachBox( box.min_ - margin, box.max_ + margin );
+    bool inFrustum = false;
+    distance = M_INFINITY;
+
+    for ( unsigned i = 0; renderer && i < renderer->GetNumViewports(); ++i )
+    {
+        Viewport *viewport = renderer->GetViewport( i );
+        Camera *camera = viewport ? viewport->GetCamera() : NULL;
+
+        if ( !camera || viewport->GetScene() != GetScene() || !(camera->GetViewMask() & drawable->GetViewMask()) )
+            continue;
+
+        if ( camera->GetFrustum().IsInsideFast( box ) != OUTSIDE )
+            inFrustum = true;
+
+        if ( camera->GetFrustum().IsInsideFast( approachBox ) != OUTSIDE )
+            approaching = true;
+
+        Vector3 camPos = camera->GetNode()->GetWorldPosition();
+        Vector3 closest( Clamp( camPos.x_, box.min_.x_, box.max_.x_ ),
+                         Clamp( camPos.y_, box.min_.y_, box.max_.y_ ),
+                         Clamp( camPos.z_, box.min_.z_, box.max_.z_ ) );
+
+        distance = Min( distance, (camPos - closest).Length() );
+    }
+
+    if ( distance == M_INFINITY )
+        distance = 0.0f;
+
+    bool entering = inFrustum && !inFrustum_;
+    inFrustum_ = inFrustum;
+
+    VisibilityType visibility = drawable->IsInView() || entering ? Visibility_InView : Visibility_OutOfView;
+    approaching = approaching || visibility == Visibility_InView;
+
+    return visibility;
+}
+
+bool Ocean::UpdateSchedule()
+{
+    float distance, minRate, maxRate, rateCap;
+    bool approaching;
+    VisibilityType visibility = UpdateVisibility( distance, approaching );
+
+    // brought up to the current time and rate while it's about to come into view, so the frames are
+    // current by the time it's seen
+    bool resync = approaching && !approaching_;
+
+    visibility_ = visibility;
+    approaching_ = approaching;
+    simulation_->GetSimRateRange( minRate, maxRate );
+
+    // hulls keep a hidden ocean running at the offscreen rate
+    if ( visibility == Visibility_Hidden )
+        rateCap = hulls_.Empty() ? 0.0f : offscreenSimRate_;
+    else if ( visibility == Visibility_OutOfView && !approaching )
+        rateCap = offscreenSimRate_;
+    else if ( distance > fullRateDistance_ )
+        rateCap = Max( maxRate * fullRateDistance_ / distance, minRate );
+    else
+        rateCap = maxRate;
+
+    simulation_->SetClientRateCap( this, rateCap );
+
+    if ( pendingSimulation_ )
+        pendingSimulation_->SetClientRateCap( this, rateCap );
+
+    return resync;
+}
+
+void Ocean::HandlePostUpdate(StringHash eventType, VariantMap& eventData)
+{
+    URHO3D_PROFILE(UpdateOcean);
+
+    UpdateReconfigure();
+
+    // nothing waits for the resync, the latest frame is shown until one at the current time replaces it
+    if ( UpdateSchedule() )
+        simulation_->RequestResync();
+
+    ripples_.Update();
+
+    // the surface is written while it's drawn or floats hulls
+    if ( visibility_ == Visibility_InView || !hulls_.Empty() )
+        UpdateVertexBuffer();
+
+    UpdateHulls();
 }
 
 void Ocean::UpdateVertexBuffer()
 {
+    URHO3D_PROFILE(UpdateOceanVertexBuffer);
+    HiresTimer timer;
+
     Geometry *pGeometry = m_pModelOcean->GetGeometry(0, 0);
     VertexBuffer *pVbuffer = pGeometry->GetVertexBuffer(0);
 
-    unsigned uElementMask = pVbuffer->GetElementMask();
-    unsigned vertexSize = pVbuffer->GetVertexSize();
-    const unsigned char *pVertexData = (const unsigned char*)pVbuffer->Lock(0, pVbuffer->GetVertexCount());
+    vertex_ocean_compact *pVertexData = (vertex_ocean_compact*)pVbuffer->Lock(0, pVbuffer->GetVertexCount());
 
     BoundingBox bbox;
+    bool updated = false;
 
     // get verts, normals, uv, etc.
     if ( pVertexData )
     {
         unsigned numVertices = pVbuffer->GetVertexCount();
 
-        for ( unsigned i = 0; i < numVertices; ++i )
-        {
-            unsigned char *pDataAlign = (unsigned char *)(pVertexData + i * vertexSize);
+        // the dynamic stream, see MakeMesh()
+        assert( pVbuffer->GetVertexSize() == sizeof(vertex_ocean_compact) );
 
-            if ( uElementMask & MASK_POSITION )
-            {
-                Vector3 &vPos = *reinterpret_cast<Vector3*>( pDataAlign );
-                pDataAlign += sizeof( Vector3 );
+        updated = simulation_->WriteVertices( simulation_->GetDisplayTime(), pVertexData, &m_mesh.vertices[0], &m_mesh.jacobians[0], &shoreMask_ );
+
+        if ( updated )
+            ripples_.Composite( pVertexData, &m_mesh.vertices[0], simulation_->GetPatchLength() * OCEAN_COMPACT_RANGE, &shoreMask_ );
 
-                Vector3 wave = Vector3( pCOcean->vertices[ i ].x, pCOcean->vertices[ i ].y, pCOcean->vertices[ i ].z );
-                vPos = wave;
+        if ( updated )
+        {
+            // adj pos and scale
+            Vector3 scale = node_->GetScale();
+            Vector3 position = node_->GetPosition();
 
-                // adj pos and scale
-                wave = wave * node_->GetScale();
-                wave += node_->GetPosition();
+            for ( unsigned i = 0; i < numVertices; ++i )
+            {
+                Vector3 wave = m_mesh.vertices[ i ] * scale + position;
                 m_mesh.vertices[ i ] = wave;
 
                 bbox.Merge( wave );
             }
 
-            if ( uElementMask & MASK_NORMAL )
-            {
-                Vector3 &vNorm = *reinterpret_cast<Vector3*>( pDataAlign );
-                pDataAlign += sizeof( Vector3 );
-
-                // normal list
-                vNorm = Vector3( pCOcean->vertices[ i ].nx, pCOcean->vertices[ i ].ny, pCOcean->vertices[ i ].nz );
-            }
+            surfaceValid_ = true;
         }
 
         //unlock
         pVbuffer->Unlock();
     }
 
-    if ( (bbox.Size() - m_BoundingBox.Size()).Length() > 5.0f )
+    if ( updated && (bbox.Size() - m_BoundingBox.Size()).Length() > 5.0f )
     {
         m_BoundingBox.Merge( bbox );
         m_pModelOcean->SetBoundingBox( m_BoundingBox );
     }
+
+    // lock, interpolate, composite and copy, as one sample
+    if ( updated )
+        simulation_->GetProfiler().Record( OceanProfiler::Stage_VertexBuffer, timer.GetUSec(false) );
+
+    if ( detailScale_ > 0 )
+        UpdateDetailMap();
 }
 
-void Ocean::MakeMesh(int size, Mesh &mesh) 
+void Ocean::UpdateDetailMap()
+{
+    URHO3D_PROFILE(UpdateOceanDetailMap);
+
+    if ( !detailImage_ )
+        detailImage_ = new Image( context_ );
+
+    if ( !simulation_->GetDetailMap( detailImage_, detailVersion_ ) )
+        return;
+
+    int size = detailImage_->GetWidth();
+
+    if ( !detailTexture_ || detailTexture_->GetWidth() != size )
+    {
+        detailTexture_ = new Texture2D( context_ );
+        detailTexture_->SetNumLevels( 0 );
+        detailTexture_->SetSize( size, size, Graphics::GetRGBAFormat(), TEXTURE_DYNAMIC );
+
+        // the map tiles with the patch, texel centers are half a texel off the vertices
+        Drawable *drawable = drawable_;
+        StaticModel *model = drawable && drawable->IsInstanceOf<StaticModel>() ? static_cast<StaticModel*>( drawable ) : NULL;
+        Material *material = model ? model->GetMaterial( 0 ) : NULL;
+
+        if ( material )
+        {
+            // the cached material is shared with every other drawable using it, the map is this ocean's own
+            if ( material != detailMaterial_ )
+            {
+                detailMaterial_ = material->Clone();
+                model->SetMaterial( detailMaterial_ );
+            }
+
+            detailMaterial_->SetTexture( TU_NORMAL, detailTexture_ );
+            detailMaterial_->SetShaderParameter( "DetailOffset", 0.5f / size );
+        }
+    }
+
+    // the mips from the image rather than the full upload of SetData(Image*), which resizes the texture
+    detailTexture_->SetData( 0, 0, 0, size, size, detailImage_->GetData() );
+
+    SharedPtr<Image> level( detailImage_ );
+
+    for ( unsigned i = 1; i < detailTexture_->GetLevels(); ++i )
+    {
+        level = level->GetNextLevel();
+        detailTexture_->SetData( i, 0, 0, level->GetWidth(), level->GetHeight(), level->GetData() );
+    }
+}
+
+void Ocean::SetShoreTerrain(Terrain *terrain, float shallowDepth)
+{
+    shoreTerrain_ = terrain;
+    shoreDepth_ = shallowDepth;
+
+    if ( m_pModelOcean )
+        UpdateShoreMask();
+}
+
+void Ocean::UpdateShoreMask()
+{
+    URHO3D_PROFILE(UpdateOceanShoreMask);
+
+    Terrain *terrain = shoreTerrain_;
+    shoreMask_.Clear();
+
+    // depth at the undisplaced grid, where the static stream puts the vertices
+    if ( terrain && node_ )
+    {
+        const Matrix3x4 &transform = node_->GetWorldTransform();
+        float spacing = simulation_->GetPatchLength() / N;
+        PODVector<float> depths( Nplus1 * Nplus1 );
+
+        for ( int m = 0; m < Nplus1; ++m )
+        {
+            for ( int n = 0; n < Nplus1; ++n )
+            {
+                Vector3 world = transform * Vector3( (n - N / 2.0f) * spacing, 0.0f, (m - N / 2.0f) * spacing );
+                depths[ m * Nplus1 + n ] = world.y_ - terrain->GetHeight( world );
+            }
+        }
+
+        shoreMask_.Init( N, depths, shoreDepth_ );
+    }
+
+    Geometry *pGeometry = m_pModelOcean->GetGeometry(0, 0);
+
+    // the attenuation also goes to the static stream's y, the shaders damp the detail map with it
+    VertexBuffer *pStaticBuffer = pGeometry ? pGeometry->GetVertexBuffer(1) : NULL;
+    unsigned char *pStaticData = pStaticBuffer ? (unsigned char*)pStaticBuffer->Lock( 0, pStaticBuffer->GetVertexCount() ) : NULL;
+
+    if ( pStaticData )
+    {
+        const float *attenuation = shoreMask_.IsValid() ? shoreMask_.GetAttenuation() : NULL;
+
+        for ( unsigned i = 0; i < pStaticBuffer->GetVertexCount(); ++i, pStaticData += pStaticBuffer->GetVertexSize() )
+            reinterpret_cast<Vector4*>( pStaticData )->y_ = attenuation ? attenuation[ i ] : 1.0f;
+
+        pStaticBuffer->Unlock();
+    }
+
+    // triangles with only dry corners are flat under the terrain, the rest are drawn
+    IndexBuffer *pIbuffer = pGeometry ? pGeometry->GetIndexBuffer() : NULL;
+    unsigned short *pUShortData = pIbuffer ? (unsigned short *)pIbuffer->Lock( 0, pIbuffer->GetIndexCount() ) : NULL;
+
+    if ( pUShortData )
+    {
+        bool masked = shoreMask_.IsValid();
+        unsigned numIndeces = 0;
+
+        for ( unsigned i = 0; i < m_mesh.indices.Size(); i += 3 )
+        {
+            const int *tri = &m_mesh.indices[ i ];
+
+            if ( masked && shoreMask_.IsDry( tri[0] ) && shoreMask_.IsDry( tri[1] ) && shoreMask_.IsDry( tri[2] ) )
+                continue;
+
+            pUShortData[ numIndeces++ ] = (unsigned short)tri[0];
+            pUShortData[ numIndeces++ ] = (unsigned short)tri[1];
+            pUShortData[ numIndeces++ ] = (unsigned short)tri[2];
+        }
+
+        pIbuffer->Unlock();
+        pGeometry->SetDrawRange( TRIANGLE_LIST, 0, numIndeces );
+
+        if ( masked )
+            SDL_Log( "ocean N=%d shore mask: %u vertices damped, %u dry, %u of %u triangles drawn\n",
+                     N, shoreMask_.GetNumDamped(), shoreMask_.GetNumDry(), numIndeces / 3, m_mesh.indices.Size() / 3 );
+    }
+}
+
+void Ocean::MakeMesh(int size, float length, Mesh &mesh) 
 {
     mesh.vertices.Resize( size*size );
+    mesh.jacobians.Resize( size*size );
     mesh.texcoords.Resize( size*size );
     mesh.normals.Resize( size*size );
     int sizen_1 = size - 1;
     mesh.indices.Resize( 6*sizen_1*sizen_1 );
     BoundingBox bbox;
+    surfaceValid_ = false;
     
     for(int x = 0; x < size; x++)
     {
@@ -247,6 +881,7 @@ void Ocean::MakeMesh(int size, Mesh &mesh)
             
             mesh.texcoords[x+y*size] = uv;
             mesh.vertices[x+y*size] = pos;
+            mesh.jacobians[x+y*size] = 1.0f;
             mesh.normals[x+y*size] = norm;
 
             m_BoundingBox.Merge( pos );
@@ -270,49 +905,58 @@ void Ocean::MakeMesh(int size, Mesh &mesh)
         }
     }
 
-    // new vertex buffer
+    // vertex buffers - the dynamic stream is rewritten every frame in the compact format, 12 bytes a
+    // vertex: horizontal displacement (TANGENT), height plus octahedral normal (COLOR) and the jacobian
+    // with 2 spare bytes (TEXCOORD1) as UBYTE4_NORM.
+    // The static stream holds the undisplaced grid with the shore attenuation in y and the dequantize
+    // range in w (POSITION), and the uv
     SharedPtr<VertexBuffer> vtxbuffer( new VertexBuffer( context_ ) );
+    SharedPtr<VertexBuffer> staticbuffer( new VertexBuffer( context_ ) );
     unsigned numVertices = mesh.vertices.Size();
-    unsigned uElementMask = MASK_POSITION | MASK_NORMAL | MASK_TEXCOORD1;
+    PODVector<VertexElement> dynamicElements;
+    PODVector<VertexElement> staticElements;
+
+    dynamicElements.Push( VertexElement( TYPE_UBYTE4_NORM, SEM_TANGENT ) );
+    dynamicElements.Push( VertexElement( TYPE_UBYTE4_NORM, SEM_COLOR ) );
+    dynamicElements.Push( VertexElement( TYPE_UBYTE4_NORM, SEM_TEXCOORD, 1 ) );
+    staticElements.Push( VertexElement( TYPE_VECTOR4, SEM_POSITION ) );
+    staticElements.Push( VertexElement( TYPE_VECTOR2, SEM_TEXCOORD ) );
 
     vtxbuffer->SetShadowed( true );
-    vtxbuffer->SetSize( numVertices, uElementMask );
-    unsigned vertexSize = vtxbuffer->GetVertexSize();
-    unsigned char *pVertexData = (unsigned char*)vtxbuffer->Lock(0, vtxbuffer->GetVertexCount());
+    vtxbuffer->SetSize( numVertices, dynamicElements, true );
+    vertex_ocean_compact *pDynamicData = (vertex_ocean_compact*)vtxbuffer->Lock(0, vtxbuffer->GetVertexCount());
+    float range = length * OCEAN_COMPACT_RANGE;
 
-    if ( pVertexData )
+    if ( pDynamicData )
     {
+        // flat until the first frame
         for ( unsigned i = 0; i < numVertices; ++i )
-        {
-            unsigned char *pDataAlign = (unsigned char *)(pVertexData + i * vertexSize);
-
-            if ( uElementMask & MASK_POSITION )
-            {
-                Vector3 &vPos = *reinterpret_cast<Vector3*>( pDataAlign );
-                pDataAlign += sizeof( Vector3 );
-
-                vPos = mesh.vertices[ i ];
-            }
-
-            if ( uElementMask & MASK_NORMAL )
-            {
-                Vector3 &vNorm = *reinterpret_cast<Vector3*>( pDataAlign );
-                pDataAlign += sizeof( Vector3 );
+            cOcean::encodeCompact( Vector3::ZERO, mesh.normals[ i ], 1.0f, range, pDynamicData[ i ] );
 
-                vNorm = mesh.normals[ i ];
-            }
+        //unlock
+        vtxbuffer->Unlock();
+    }
 
-            if ( uElementMask & MASK_TEXCOORD1 )
-            {
-                Vector2 &vUV = *reinterpret_cast<Vector2*>( pDataAlign );
-                pDataAlign += sizeof( Vector2 );
+    staticbuffer->SetShadowed( true );
+    staticbuffer->SetSize( numVertices, staticElements );
+    unsigned char *pStaticData = (unsigned char*)staticbuffer->Lock(0, staticbuffer->GetVertexCount());
 
-                vUV = mesh.texcoords[ i ];
-            }
+    if ( pStaticData )
+    {
+        for ( unsigned i = 0; i < numVertices; ++i )
+        {
+            Vector4 &vGrid = *reinterpret_cast<Vector4*>( pStaticData );
+            Vector2 &vUV = *reinterpret_cast<Vector2*>( pStaticData + sizeof( Vector4 ) );
+            pStaticData += staticbuffer->GetVertexSize();
+
+            // same as cOcean's ox, oz
+            vGrid = Vector4( ((int)(i % size) - sizen_1 / 2.0f) * length / sizen_1, 1.0f,
+                             ((int)(i / size) - sizen_1 / 2.0f) * length / sizen_1, range );
+            vUV = mesh.texcoords[ i ];
         }
 
         //unlock
-        vtxbuffer->Unlock();
+        staticbuffer->Unlock();
     }
 
     // new index buffer
@@ -345,6 +989,9 @@ void Ocean::MakeMesh(int size, Mesh &mesh)
     morphRangeStarts.Push( 0 );
     morphRangeCounts.Push( 0 );
     vtxBuffers.Push( vtxbuffer );
+    morphRangeStarts.Push( 0 );
+    morphRangeCounts.Push( 0 );
+    vtxBuffers.Push( staticbuffer );
 
     // idx buffer
     Vector<SharedPtr<IndexBuffer> > idxBuffers;
@@ -356,8 +1003,9 @@ void Ocean::MakeMesh(int size, Mesh &mesh)
 
     SharedPtr<Geometry> pGeometry;
     pGeometry = new Geometry(context_);
-    pGeometry->SetNumVertexBuffers( 1 );
+    pGeometry->SetNumVertexBuffers( 2 );
     pGeometry->SetVertexBuffer( 0, vtxbuffer );
+    pGeometry->SetVertexBuffer( 1, staticbuffer );
     pGeometry->SetIndexBuffer( idxbuffer );
     pGeometry->SetDrawRange(TRIANGLE_LIST, 0, numIndeces);
 
@@ -392,18 +1040,93 @@ void Ocean::DbgRender()
 
 //=============================================================================
 //=============================================================================
-cOcean::cOcean(const int N, const float A, const Vector2 w, const float length, const bool _geometry) :
-	g(GRAVITY), geometry(_geometry), N(N), Nplus1(N+1), A(A), w(w), length(length),
-	vertices(0), indices(0), h_tilde(0), h_tilde_slopex(0), h_tilde_slopez(0), h_tilde_dx(0), h_tilde_dz(0), fft(0)
-{
-	h_tilde        = new complex[N*N];
-	h_tilde_slopex = new complex[N*N];
-	h_tilde_slopez = new complex[N*N];
-	h_tilde_dx     = new complex[N*N];
-	h_tilde_dz     = new complex[N*N];
-	fft            = new cFFT(N);
-	vertices       = new vertex_ocean[Nplus1*Nplus1];
-	indices        = new unsigned int[Nplus1*Nplus1*10];
+OceanState::OceanState()
+    : seed(OCEAN_DEFAULT_SEED)
+    , N(0)
+    , A(0.0f)
+    , length(0.0f)
+    , time(0.0f)
+    , blending(false)
+    , fromA(0.0f)
+    , blendStart(0.0f)
+    , blendSeconds(0.0f)
+{
+}
+
+bool OceanState::Write(Serializer &dest) const
+{
+    dest.WriteFileID( "OST2" );
+    dest.WriteUInt( seed );
+    dest.WriteInt( N );
+    dest.WriteFloat( A );
+    dest.WriteVector2( wind );
+    dest.WriteFloat( length );
+    dest.WriteFloat( time );
+
+    if ( !dest.WriteBool( blending ) )
+        return false;
+
+    if ( !blending )
+        return true;
+
+    dest.WriteFloat( fromA );
+    dest.WriteVector2( fromWind );
+    dest.WriteFloat( blendStart );
+
+    return dest.WriteFloat( blendSeconds );
+}
+
+bool OceanState::Read(Deserializer &source)
+{
+    // OST1 is from before weather blends were part of the state
+    String id = source.ReadFileID();
+
+    if ( id != "OST1" && id != "OST2" )
+        return false;
+
+    *this  = OceanState();
+    seed   = source.ReadUInt();
+    N      = source.ReadInt();
+    A      = source.ReadFloat();
+    wind   = source.ReadVector2();
+    length = source.ReadFloat();
+
+    // a short read of the last field means the state was truncated
+    if ( source.Read( &time, sizeof(time) ) != sizeof(time) || N <= 0 || !IsPowerOfTwo( N ) || length <= 0.0f )
+        return false;
+
+    if ( id == "OST1" )
+        return true;
+
+    if ( source.Read( &blending, sizeof(blending) ) != sizeof(blending) )
+        return false;
+
+    if ( !blending )
+        return true;
+
+    fromA      = source.ReadFloat();
+    fromWind   = source.ReadVector2();
+    blendStart = source.ReadFloat();
+
+    return source.Read( &blendSeconds, sizeof(blendSeconds) ) == sizeof(blendSeconds) && blendSeconds > 0.0f;
+}
+
+//=============================================================================
+//=============================================================================
+cOcean::cOcean(const int N, const float A, const Vector2 w, const float length, const bool _geometry, const bool hugePages, const unsigned seed) :
+	g(GRAVITY), geometry(_geometry), N(N), Nplus1(N+1), A(A), w(w), length(length), seed(seed),
+	vertices(0), indices(0), h_tilde(0), fft_height(0), fft_slope(0), fft_disp(0), fft_jacobian(0), fd_normals(false),
+	step_stage(step_done), step_unit(0), step_t(0.0f), arena(arenaSize(N), hugePages), fft(N, arena),
+	h0_from(0), h0_to(0), blend_A(A), blend_w(w)
+{
+	// in arenaSize() order, after the fft's tables
+	h_tilde        = arena.Alloc<complex>(N*N);
+	fft_height     = arena.Alloc<complex>(N*N);
+	fft_slope      = arena.Alloc<complex>(N*N);
+	fft_disp       = arena.Alloc<complex>(N*N);
+	fft_jacobian   = arena.Alloc<complex>(N*N);
+	vertices       = arena.Alloc<vertex_ocean>(Nplus1*Nplus1);
+	indices        = arena.Alloc<unsigned int>(Nplus1*Nplus1*10);
 
 	int index;
 
@@ -427,6 +1150,8 @@ cOcean::cOcean(const int N, const float A, const Vector2 w, const float length,
 			vertices[index].nx = 0.0f;
 			vertices[index].ny = 1.0f;
 			vertices[index].nz = 0.0f;
+
+			vertices[index].j  = 1.0f;
 		}
 	}
 
@@ -465,28 +1190,86 @@ cOcean::cOcean(const int N, const float A, const Vector2 w, const float length,
 }
 
 cOcean::~cOcean() {
-	if (h_tilde)		delete [] h_tilde;
-	if (h_tilde_slopex)	delete [] h_tilde_slopex;
-	if (h_tilde_slopez)	delete [] h_tilde_slopez;
-	if (h_tilde_dx)		delete [] h_tilde_dx;
-	if (h_tilde_dz)		delete [] h_tilde_dz;
-	if (fft)		    delete fft;
-	if (vertices)		delete [] vertices;
-	if (indices)		delete [] indices;
+	// the arena frees everything at once
+}
+
+unsigned int cOcean::arenaSize(int N) {
+	int Nplus1 = N + 1;
+
+	return cFFT::arenaSize(N) + 5 * OceanArena::Align(N * N * sizeof(complex)) +
+	       OceanArena::Align(Nplus1 * Nplus1 * sizeof(vertex_ocean)) + OceanArena::Align(Nplus1 * Nplus1 * 10 * sizeof(unsigned int));
 }
 
 void cOcean::release() {
 }
 
+void cOcean::setVertex(int n_prime, int m_prime, float h, float dx, float dz, const Vector3 &n, float j) {
+	int index1 = m_prime * Nplus1 + n_prime;
+
+	vertices[index1].y  = h;
+	vertices[index1].x  = vertices[index1].ox + dx;
+	vertices[index1].z  = vertices[index1].oz + dz;
+	vertices[index1].nx = n.x_;
+	vertices[index1].ny = n.y_;
+	vertices[index1].nz = n.z_;
+	vertices[index1].j  = j;
+
+	// for tiling
+	if (n_prime == 0 && m_prime == 0) setVertex(N, N, h, dx, dz, n, j);
+	if (n_prime == 0) setVertex(N, m_prime, h, dx, dz, n, j);
+	if (m_prime == 0) setVertex(n_prime, N, h, dx, dz, n, j);
+}
+
+// jacobian of the displaced grid x + lambda * D(x), from J = (dDx/dx, dDz/dz, dDx/dz)
+static float jacobian(const Vector3 &J, float lambda) {
+	return (1.0f + lambda * J.x_) * (1.0f + lambda * J.y_) - lambda * lambda * J.z_ * J.z_;
+}
+
+// multipliers that turn h~(k) into the spectrum of each real field, in fft_height..fft_jacobian order
+void cOcean::fieldFactors(int n_prime, int m_prime, complex *factors) {
+	float kx = M_PI * (2.0f * n_prime - N) / length;
+	float kz = M_PI * (2.0f * m_prime - N) / length;
+	float len = sqrt(kx * kx + kz * kz);
+	float inv_len = len < 0.000001f ? 0.0f : 1.0f / len;
+
+	factors[0] = complex(1.0f, 0.0f);					// height
+	factors[1] = complex(kx * kz * inv_len, 0.0f);		// dDx/dz
+	factors[2] = complex(0.0f, kx);						// slope x
+	factors[3] = complex(0.0f, kz);						// slope z
+	factors[4] = complex(0.0f, -kx * inv_len);			// displacement x
+	factors[5] = complex(0.0f, -kz * inv_len);			// displacement z
+	factors[6] = complex(kx * kx * inv_len, 0.0f);		// dDx/dx
+	factors[7] = complex(kz * kz * inv_len, 0.0f);		// dDz/dz
+}
+
 float cOcean::dispersion(int n_prime, int m_prime) {
-	float w_0 = 2.0f * M_PI / 200.0f;
+	float w_0 = 2.0f * M_PI / OCEAN_REPEAT_TIME;
 	float kx = M_PI * (2.0f * n_prime - N) / length;
 	float kz = M_PI * (2.0f * m_prime - N) / length;
 	return floor(sqrt(g * sqrt(kx * kx + kz * kz)) / w_0) * w_0;
 }
 
+double cOcean::phase(float t, int n_prime, int m_prime) {
+	return phaseTurns(M_PI * (2.0f * n_prime - N) / length, M_PI * (2.0f * m_prime - N) / length, t);
+}
+
+double cOcean::dispersionSteps(float kx, float kz) {
+	float w_0 = 2.0f * M_PI / OCEAN_REPEAT_TIME;
+	return floor(sqrt(GRAVITY * sqrt(kx * kx + kz * kz)) / w_0);
+}
+
+double cOcean::phaseTurns(float kx, float kz, float t) {
+	double steps = dispersionSteps(kx, kz);
+
+	// a whole number of turns per repeat time, so t can be wrapped first
+	return steps * (fmod((double)t, (double)OCEAN_REPEAT_TIME) / OCEAN_REPEAT_TIME);
+}
+
 float cOcean::phillips(int n_prime, int m_prime) {
-	Vector2 k(M_PI * (2.0f * n_prime - N) / length, M_PI * (2 * m_prime - N) / length);
+	return phillipsSpectrum(Vector2(M_PI * (2.0f * n_prime - N) / length, M_PI * (2 * m_prime - N) / length), A, w);
+}
+
+float cOcean::phillipsSpectrum(const Vector2 &k, float A, const Vector2 &w) {
 	float k_length  = k.Length();
 
 	if (k_length < 0.000001f) return 0.0f;
@@ -499,18 +1282,23 @@ float cOcean::phillips(int n_prime, int m_prime) {
 	float k_dot_w2  = k3_dot_w2 * k3_dot_w2;
 
 	float w_length  = w.Length();
-	float L         = w_length * w_length / g;
+	float L         = w_length * w_length / GRAVITY;
 	float L2        = L * L;
 	
 	float damping   = 0.001f;
 	float l2        = L2 * damping * damping;
 
-	return A * exp(-1.0f / (k_length2 * L2)) / k_length4 * k_dot_w2 * exp(-k_length2 * l2);
+	return A * (float)detExp(-1.0f / (k_length2 * L2)) / k_length4 * k_dot_w2 * (float)detExp(-k_length2 * l2);
 }
 
 complex cOcean::hTilde_0(int n_prime, int m_prime) {
-	complex r = gaussianRandomVariable();
-	return r * sqrt(phillips(n_prime, m_prime) / 2.0f);
+	return hTilde_0(n_prime, m_prime, A, w);
+}
+
+complex cOcean::hTilde_0(int n_prime, int m_prime, float A, const Vector2 &w) {
+	complex r = gaussianRandomVariable(seed, n_prime, m_prime);
+	Vector2 k(M_PI * (2.0f * n_prime - N) / length, M_PI * (2 * m_prime - N) / length);
+	return r * sqrt(phillipsSpectrum(k, A, w) / 2.0f);
 }
 
 complex cOcean::hTilde(float t, int n_prime, int m_prime) {
@@ -519,10 +1307,8 @@ complex cOcean::hTilde(float t, int n_prime, int m_prime) {
 	complex htilde0(vertices[index].a,  vertices[index].b);
 	complex htilde0mkconj(vertices[index]._a, vertices[index]._b);
 
-	float omegat = dispersion(n_prime, m_prime) * t;
-
-	float cos_ = cos(omegat);
-	float sin_ = sin(omegat);
+	float cos_, sin_;
+	detSinCos(phase(t, n_prime, m_prime), sin_, cos_);
 
 	complex c0(cos_,  sin_);
 	complex c1(cos_, -sin_);
@@ -536,6 +1322,7 @@ complex_vector_normal cOcean::h_D_and_n(Vector2      x, float t) {
 	complex h(0.0f, 0.0f);
 	Vector2      D(0.0f, 0.0f);
 	Vector3 n(0.0f, 0.0f, 0.0f);
+	Vector3 J(0.0f, 0.0f, 0.0f);
 
 	complex c, res, htilde_c;
 	Vector2      k;
@@ -559,6 +1346,7 @@ complex_vector_normal cOcean::h_D_and_n(Vector2      x, float t) {
 
 			if (k_length < 0.000001f) continue;
 			D = D + Vector2     (kx / k_length * htilde_c.b, kz / k_length * htilde_c.b);
+			J = J + Vector3(kx * kx, kz * kz, kx * kz) * (htilde_c.a / k_length);
 		}
 	}
 	
@@ -568,169 +1356,432 @@ complex_vector_normal cOcean::h_D_and_n(Vector2      x, float t) {
 	cvn.h = h;
 	cvn.D = D;
 	cvn.n = n;
+	cvn.J = J;
 	return cvn;
 }
 
 // this shows how slow the simulation is w/o FFT
+// - also the reference for evaluateWavesFFT(), so each point is sampled where the FFT output lands:
+//   at the undisplaced grid point, measured from grid index 0 rather than the centered ox, oz
 void cOcean::evaluateWaves(float t) {
 	float lambda = -1.0;
-	int index;
 	Vector2      x;
-	Vector2      d;
 	complex_vector_normal h_d_and_n;
 	for (int m_prime = 0; m_prime < N; m_prime++) {
 		for (int n_prime = 0; n_prime < N; n_prime++) {
-			index = m_prime * Nplus1 + n_prime;
-
-			x = Vector2     (vertices[index].x, vertices[index].z);
+			x = Vector2     (n_prime * length / N, m_prime * length / N);
 
 			h_d_and_n = h_D_and_n(x, t);
 
-			vertices[index].y = h_d_and_n.h.a;
-
-			vertices[index].x = vertices[index].ox + lambda*h_d_and_n.D.x_;
-			vertices[index].z = vertices[index].oz + lambda*h_d_and_n.D.y_;
+			setVertex(n_prime, m_prime, h_d_and_n.h.a, lambda*h_d_and_n.D.x_, lambda*h_d_and_n.D.y_, h_d_and_n.n,
+					  jacobian(h_d_and_n.J, lambda));
+		}
+	}
+}
 
-			vertices[index].nx = h_d_and_n.n.x_;
-			vertices[index].ny = h_d_and_n.n.y_;
-			vertices[index].nz = h_d_and_n.n.z_;
+void cOcean::evaluateWavesFFT(float t) 
+{
+	evaluateSpectrum(t);
+	fftRows();
+	fftColumns();
+	updateVertices();
+}
 
-			if (n_prime == 0 && m_prime == 0) {
-				vertices[index + N + Nplus1 * N].y = h_d_and_n.h.a;
-			
-				vertices[index + N + Nplus1 * N].x = vertices[index + N + Nplus1 * N].ox + lambda*h_d_and_n.D.x_;
-				vertices[index + N + Nplus1 * N].z = vertices[index + N + Nplus1 * N].oz + lambda*h_d_and_n.D.y_;
+// stage 1: evolve h~0 to time t and build the packed field spectra
+// - every field is real in the spatial domain, so two share one complex transform, one in the real
+//   part and one in the imaginary part. h~0(k) and h~0(-k)* are drawn separately, so h~ isn't hermitian
+//   and each field's spectrum F is first reduced to (F(k) + F(-k)*) / 2, the part that the real
+//   output of its own transform comes from
+// - away from the nyquist row and column the field multipliers are odd or even in k, so reducing h~
+//   once is enough; on them -k wraps to k's own index and each field is reduced separately
+void cOcean::evaluateSpectrum(float t)
+{
+	evolveSpectrum(t, 0, N);
+	packSpectrum(0, N);
+}
 
-				vertices[index + N + Nplus1 * N].nx = h_d_and_n.n.x_;
-				vertices[index + N + Nplus1 * N].ny = h_d_and_n.n.y_;
-				vertices[index + N + Nplus1 * N].nz = h_d_and_n.n.z_;
-			}
-			if (n_prime == 0) {
-				vertices[index + N].y = h_d_and_n.h.a;
-			
-				vertices[index + N].x = vertices[index + N].ox + lambda*h_d_and_n.D.x_;
-				vertices[index + N].z = vertices[index + N].oz + lambda*h_d_and_n.D.y_;
-
-				vertices[index + N].nx = h_d_and_n.n.x_;
-				vertices[index + N].ny = h_d_and_n.n.y_;
-				vertices[index + N].nz = h_d_and_n.n.z_;
-			}
-			if (m_prime == 0) {
-				vertices[index + Nplus1 * N].y = h_d_and_n.h.a;
-			
-				vertices[index + Nplus1 * N].x = vertices[index + Nplus1 * N].ox + lambda*h_d_and_n.D.x_;
-				vertices[index + Nplus1 * N].z = vertices[index + Nplus1 * N].oz + lambda*h_d_and_n.D.y_;
-				
-				vertices[index + Nplus1 * N].nx = h_d_and_n.n.x_;
-				vertices[index + Nplus1 * N].ny = h_d_and_n.n.y_;
-				vertices[index + Nplus1 * N].nz = h_d_and_n.n.z_;
-			}
+void cOcean::evolveSpectrum(float t, int m_begin, int m_end)
+{
+	for (int m_prime = m_begin; m_prime < m_end; m_prime++) {
+		for (int n_prime = 0; n_prime < N; n_prime++) {
+			h_tilde[m_prime * N + n_prime] = hTilde(t, n_prime, m_prime);
 		}
 	}
 }
 
-void cOcean::evaluateWavesFFT(float t) 
+void cOcean::packSpectrum(int m_begin, int m_end)
 {
-	float kx, kz, len, lambda = -1.0f;
-	int index, index1;
+	complex factors[OCEAN_FFT_FIELDS], factors_mirror[OCEAN_FFT_FIELDS], field[OCEAN_FFT_FIELDS];
+	complex *packed[OCEAN_FFT_PAIRS] = { fft_height, fft_slope, fft_disp, fft_jacobian };
+	float kx, kz, len, inv_len, a, b, dx, dz;
+	int index, mirror;
 
-	for (int m_prime = 0; m_prime < N; m_prime++) {
+	for (int m_prime = m_begin; m_prime < m_end; m_prime++) {
 		kz = M_PI * (2.0f * m_prime - N) / length;
 		for (int n_prime = 0; n_prime < N; n_prime++) {
-			kx = M_PI*(2.0f * n_prime - N) / length;
-			len = sqrt(kx * kx + kz * kz);
 			index = m_prime * N + n_prime;
+			mirror = ((N - m_prime) & (N - 1)) * N + ((N - n_prime) & (N - 1));
 
-			h_tilde[index] = hTilde(t, n_prime, m_prime);
-			h_tilde_slopex[index] = h_tilde[index] * complex(0, kx);
-			h_tilde_slopez[index] = h_tilde[index] * complex(0, kz);
-			if (len < 0.000001f) {
-				h_tilde_dx[index]     = complex(0.0f, 0.0f);
-				h_tilde_dz[index]     = complex(0.0f, 0.0f);
-			} else {
-				h_tilde_dx[index]     = h_tilde[index] * complex(0, -kx/len);
-				h_tilde_dz[index]     = h_tilde[index] * complex(0, -kz/len);
+			if (n_prime == 0 || m_prime == 0) {
+				fieldFactors(n_prime, m_prime, factors);
+				fieldFactors((N - n_prime) & (N - 1), (N - m_prime) & (N - 1), factors_mirror);
+
+				for (int f = 0; f < OCEAN_FFT_FIELDS; f++) {
+					field[f] = (h_tilde[index] * factors[f] + (h_tilde[mirror] * factors_mirror[f]).conj()) * 0.5f;
+				}
+				for (int p = 0; p < OCEAN_FFT_PAIRS; p++) {
+					if (packed[p] == fft_slope && fd_normals) continue;
+					packed[p][index] = field[2*p] + complex(-field[2*p+1].b, field[2*p+1].a);
+				}
+				continue;
 			}
+
+			kx = M_PI * (2.0f * n_prime - N) / length;
+			len = sqrt(kx * kx + kz * kz);
+			inv_len = len < 0.000001f ? 0.0f : 1.0f / len;
+			dx = kx * inv_len;
+			dz = kz * inv_len;
+
+			// reduced h~, then the same multipliers as fieldFactors() written out per pair
+			a = 0.5f * (h_tilde[index].a + h_tilde[mirror].a);
+			b = 0.5f * (h_tilde[index].b - h_tilde[mirror].b);
+
+			fft_height[index]   = complex(a - kx * dz * b,      b + kx * dz * a);
+			if (!fd_normals)
+				fft_slope[index] = complex(-kx * b - kz * a,     kx * a - kz * b);
+			fft_disp[index]     = complex(dx * b + dz * a,      dz * b - dx * a);
+			fft_jacobian[index] = complex(kx * dx * a - kz * dz * b, kx * dx * b + kz * dz * a);
 		}
 	}
+}
 
-	for (int m_prime = 0; m_prime < N; m_prime++) {
-		fft->fft(h_tilde, h_tilde, 1, m_prime * N);
-		fft->fft(h_tilde_slopex, h_tilde_slopex, 1, m_prime * N);
-		fft->fft(h_tilde_slopez, h_tilde_slopez, 1, m_prime * N);
-		fft->fft(h_tilde_dx, h_tilde_dx, 1, m_prime * N);
-		fft->fft(h_tilde_dz, h_tilde_dz, 1, m_prime * N);
+// the packed transforms needed by the current normal mode
+int cOcean::packedFields(complex **packed) {
+	int count = 0;
+
+	packed[count++] = fft_height;
+	if (!fd_normals) packed[count++] = fft_slope;
+	packed[count++] = fft_disp;
+	packed[count++] = fft_jacobian;
+
+	return count;
+}
+
+// stage 2: 1D transforms along the rows
+void cOcean::fftRows()
+{
+	fftRows(0, N);
+}
+
+void cOcean::fftRows(int m_begin, int m_end)
+{
+	complex *packed[OCEAN_FFT_PAIRS];
+	int count = packedFields(packed);
+
+	for (int m_prime = m_begin; m_prime < m_end; m_prime++) {
+		for (int p = 0; p < count; p++) {
+			fft.fft(packed[p], packed[p], 1, m_prime * N);
+		}
 	}
-	for (int n_prime = 0; n_prime < N; n_prime++) {
-		fft->fft(h_tilde, h_tilde, N, n_prime);
-		fft->fft(h_tilde_slopex, h_tilde_slopex, N, n_prime);
-		fft->fft(h_tilde_slopez, h_tilde_slopez, N, n_prime);
-		fft->fft(h_tilde_dx, h_tilde_dx, N, n_prime);
-		fft->fft(h_tilde_dz, h_tilde_dz, N, n_prime);
+}
+
+// stage 3: 1D transforms along the columns
+void cOcean::fftColumns()
+{
+	fftColumns(0, N);
+}
+
+void cOcean::fftColumns(int n_begin, int n_end)
+{
+	complex *packed[OCEAN_FFT_PAIRS];
+	int count = packedFields(packed);
+
+	for (int n_prime = n_begin; n_prime < n_end; n_prime++) {
+		for (int p = 0; p < count; p++) {
+			fft.fft(packed[p], packed[p], N, n_prime);
+		}
 	}
+}
+
+// stage 4: sign correction, unpack the field pairs and write heights, displacements, normals
+// and the jacobian to the vertices
+void cOcean::updateVertices()
+{
+	updateVertices(0, N);
+
+	if (fd_normals) {
+		finiteDifferenceNormals();
+	}
+}
 
-	float sign;
+void cOcean::updateVertices(int m_begin, int m_end)
+{
+	float sign, lambda = -1.0f;
 	float signs[] = { 1.0f, -1.0f };
-	Vector3 n;
-	for (int m_prime = 0; m_prime < N; m_prime++) {
+	int index;
+	Vector3 n(Vector3::UP), J;
+	for (int m_prime = m_begin; m_prime < m_end; m_prime++) {
 		for (int n_prime = 0; n_prime < N; n_prime++) {
-			index  = m_prime * N + n_prime;		// index into h_tilde..
-			index1 = m_prime * Nplus1 + n_prime;	// index into vertices
+			index = m_prime * N + n_prime;		// index into fft_..
 
 			sign = signs[(n_prime + m_prime) & 1];
 
-			h_tilde[index]     = h_tilde[index] * sign;
-
-			// height
-			vertices[index1].y = h_tilde[index].a;
-
-			// displacement
-			h_tilde_dx[index] = h_tilde_dx[index] * sign;
-			h_tilde_dz[index] = h_tilde_dz[index] * sign;
-			vertices[index1].x = vertices[index1].ox + h_tilde_dx[index].a * lambda;
-			vertices[index1].z = vertices[index1].oz + h_tilde_dz[index].a * lambda;
-			
-			// normal
-			h_tilde_slopex[index] = h_tilde_slopex[index] * sign;
-			h_tilde_slopez[index] = h_tilde_slopez[index] * sign;
-			n = Vector3(0.0f - h_tilde_slopex[index].a, 1.0f, 0.0f - h_tilde_slopez[index].a).Normalized();
-			vertices[index1].nx =  n.x_;
-			vertices[index1].ny =  n.y_;
-			vertices[index1].nz =  n.z_;
-
-			// for tiling
-			if (n_prime == 0 && m_prime == 0) {
-				vertices[index1 + N + Nplus1 * N].y = h_tilde[index].a;
-
-				vertices[index1 + N + Nplus1 * N].x = vertices[index1 + N + Nplus1 * N].ox + h_tilde_dx[index].a * lambda;
-				vertices[index1 + N + Nplus1 * N].z = vertices[index1 + N + Nplus1 * N].oz + h_tilde_dz[index].a * lambda;
-			
-				vertices[index1 + N + Nplus1 * N].nx =  n.x_;
-				vertices[index1 + N + Nplus1 * N].ny =  n.y_;
-				vertices[index1 + N + Nplus1 * N].nz =  n.z_;
-			}
-			if (n_prime == 0) {
-				vertices[index1 + N].y = h_tilde[index].a;
-
-				vertices[index1 + N].x = vertices[index1 + N].ox + h_tilde_dx[index].a * lambda;
-				vertices[index1 + N].z = vertices[index1 + N].oz + h_tilde_dz[index].a * lambda;
-			
-				vertices[index1 + N].nx =  n.x_;
-				vertices[index1 + N].ny =  n.y_;
-				vertices[index1 + N].nz =  n.z_;
-			}
-			if (m_prime == 0) {
-				vertices[index1 + Nplus1 * N].y = h_tilde[index].a;
-
-				vertices[index1 + Nplus1 * N].x = vertices[index1 + Nplus1 * N].ox + h_tilde_dx[index].a * lambda;
-				vertices[index1 + Nplus1 * N].z = vertices[index1 + Nplus1 * N].oz + h_tilde_dz[index].a * lambda;
-			
-				vertices[index1 + Nplus1 * N].nx =  n.x_;
-				vertices[index1 + Nplus1 * N].ny =  n.y_;
-				vertices[index1 + Nplus1 * N].nz =  n.z_;
+			if (!fd_normals) {
+				n = Vector3(0.0f - fft_slope[index].a * sign, 1.0f, 0.0f - fft_slope[index].b * sign).Normalized();
 			}
+			J = Vector3(fft_jacobian[index].a, fft_jacobian[index].b, fft_height[index].b) * sign;
+
+			setVertex(n_prime, m_prime,
+					  fft_height[index].a * sign,
+					  fft_disp[index].a * sign * lambda,
+					  fft_disp[index].b * sign * lambda,
+					  n, jacobian(J, lambda));
 		}
 	}
 }
 
+// normals by central differences of the height over the undisplaced grid, wrapping around at the tile
+// edges - the same slope the spectral path transforms, so the choppy displacement folding the grid over
+// can't flip them. The neighbors past the last row and column are the tiling copies
+void cOcean::finiteDifferenceNormals()
+{
+	finiteDifferenceNormals(0, N);
+}
+
+// needs all the heights, the last row is copied once row 0 is done and the range reaches N
+void cOcean::finiteDifferenceNormals(int m_begin, int m_end)
+{
+	int index, left, up;
+	float inv_two_dx = N / (2.0f * length), dhdx, dhdz;
+	Vector3 n;
+
+	for (int m_prime = m_begin; m_prime < m_end; m_prime++) {
+		for (int n_prime = 0; n_prime < N; n_prime++) {
+			index = m_prime * Nplus1 + n_prime;
+			left  = n_prime > 0 ? index - 1 : index + N - 1;
+			up    = m_prime > 0 ? index - Nplus1 : index + Nplus1 * (N - 1);
+
+			dhdx = (vertices[index + 1].y - vertices[left].y) * inv_two_dx;
+			dhdz = (vertices[index + Nplus1].y - vertices[up].y) * inv_two_dx;
+
+			n = Vector3(-dhdx, 1.0f, -dhdz).Normalized();
+
+			vertices[index].nx = n.x_;
+			vertices[index].ny = n.y_;
+			vertices[index].nz = n.z_;
+		}
+
+		// for tiling
+		int last_col = m_prime * Nplus1 + N, first_col = m_prime * Nplus1;
+
+		vertices[last_col].nx = vertices[first_col].nx;
+		vertices[last_col].ny = vertices[first_col].ny;
+		vertices[last_col].nz = vertices[first_col].nz;
+	}
+
+	if (m_end == N) {
+		for (int i = 0; i < Nplus1; i++) {
+			int last_row = N * Nplus1 + i, first_row = i;
+
+			vertices[last_row].nx = vertices[first_row].nx;
+			vertices[last_row].ny = vertices[first_row].ny;
+			vertices[last_row].nz = vertices[first_row].nz;
+		}
+	}
+}
+
+void cOcean::beginStep(float t)
+{
+	step_t     = t;
+	step_stage = step_evolve;
+	step_unit  = 0;
+}
+
+bool cOcean::advanceStep(int units)
+{
+	while (units > 0 && step_stage != step_done) {
+		int end = Min(step_unit + units, N);
+
+		switch (step_stage) {
+		case step_evolve:	evolveSpectrum(step_t, step_unit, end);		break;
+		case step_spectrum:	packSpectrum(step_unit, end);				break;
+		case step_rows:		fftRows(step_unit, end);					break;
+		case step_columns:	fftColumns(step_unit, end);					break;
+		case step_vertices:	updateVertices(step_unit, end);				break;
+		case step_normals:	finiteDifferenceNormals(step_unit, end);	break;
+		}
+
+		units -= end - step_unit;
+		step_unit = end;
+
+		if (step_unit == N) {
+			step_unit = 0;
+			step_stage++;
 
+			if (step_stage == step_normals && !fd_normals) step_stage++;
+		}
+	}
+
+	return step_stage == step_done;
+}
+
+bool cOcean::isStepDone() const
+{
+	return step_stage == step_done;
+}
+
+bool cOcean::beginBlend(float A, const Vector2 &w) {
+	int count = Nplus1 * Nplus1;
+
+	if (!h0_from && !blend_arena.Allocate(2 * OceanArena::Align(2 * count * sizeof(complex)), false)) return false;
+
+	if (!h0_from) {
+		h0_from = blend_arena.Alloc<complex>(2 * count);
+		h0_to   = blend_arena.Alloc<complex>(2 * count);
+	}
+
+	blend_A = A;
+	blend_w = w;
+
+	// the same gaussians, so a change of amplitude or wind reshapes the waves rather than replacing them
+	for (int m_prime = 0; m_prime < Nplus1; m_prime++) {
+		for (int n_prime = 0; n_prime < Nplus1; n_prime++) {
+			int index = m_prime * Nplus1 + n_prime;
+
+			h0_from[2 * index]     = complex(vertices[index].a,  vertices[index].b);
+			h0_from[2 * index + 1] = complex(vertices[index]._a, vertices[index]._b);
+			h0_to[2 * index]       = hTilde_0( n_prime,  m_prime, A, w);
+			h0_to[2 * index + 1]   = hTilde_0(-n_prime, -m_prime, A, w).conj();
+		}
+	}
+
+	return true;
+}
+
+void cOcean::setBlend(float alpha) {
+	if (!h0_from) return;
+
+	int count = Nplus1 * Nplus1;
+	float beta = 1.0f - alpha;
+
+	for (int index = 0; index < count; index++) {
+		const complex *from = &h0_from[2 * index], *to = &h0_to[2 * index];
+
+		vertices[index].a  = from[0].a * beta + to[0].a * alpha;
+		vertices[index].b  = from[0].b * beta + to[0].b * alpha;
+		vertices[index]._a = from[1].a * beta + to[1].a * alpha;
+		vertices[index]._b = from[1].b * beta + to[1].b * alpha;
+	}
+}
+
+void cOcean::endBlend() {
+	if (!h0_from) return;
+
+	setBlend(1.0f);
+	A = blend_A;
+	w = blend_w;
+
+	blend_arena.Free();
+	h0_from = h0_to = 0;
+}
+
+// write positions and normals to an interleaved MASK_POSITION | MASK_NORMAL vertex stream
+void cOcean::packVertices(unsigned char *dest, unsigned vertexSize) const
+{
+	int numVertices = Nplus1 * Nplus1;
+
+	for (int i = 0; i < numVertices; i++, dest += vertexSize) {
+		float *out = reinterpret_cast<float*>(dest);
+		const vertex_ocean &vert = vertices[i];
+
+		out[0] = vert.x;
+		out[1] = vert.y;
+		out[2] = vert.z;
+		out[3] = vert.nx;
+		out[4] = vert.ny;
+		out[5] = vert.nz;
+	}
+}
+
+// a simulated frame, OCEAN_FRAME_FLOATS per vertex
+void cOcean::packFrame(float *dest) const
+{
+	int numVertices = Nplus1 * Nplus1;
+
+	for (int i = 0; i < numVertices; i++, dest += OCEAN_FRAME_FLOATS) {
+		const vertex_ocean &vert = vertices[i];
+
+		dest[0] = vert.x;
+		dest[1] = vert.y;
+		dest[2] = vert.z;
+		dest[3] = vert.nx;
+		dest[4] = vert.ny;
+		dest[5] = vert.nz;
+		dest[6] = vert.j;
+	}
+}
+
+void cOcean::packVerticesCompact(vertex_ocean_compact *dest) const
+{
+	int numVertices = Nplus1 * Nplus1;
+	float range = length * OCEAN_COMPACT_RANGE;
+
+	for (int i = 0; i < numVertices; i++) {
+		const vertex_ocean &vert = vertices[i];
+
+		encodeCompact(Vector3(vert.x - vert.ox, vert.y, vert.z - vert.oz), Vector3(vert.nx, vert.ny, vert.nz), vert.j, range, dest[i]);
+	}
+}
+
+static unsigned short quantize16(float value, float invRange) {
+	return (unsigned short)Clamp((int)((value * invRange * 0.5f + 0.5f) * 65535.0f + 0.5f), 0, 65535);
+}
+
+static unsigned char quantize8(float value) {
+	return (unsigned char)Clamp((int)((value * 0.5f + 0.5f) * 255.0f + 0.5f), 0, 255);
+}
+
+void cOcean::encodeCompact(const Vector3 &displacement, const Vector3 &normal, float jacobian, float range, vertex_ocean_compact &out) {
+	float invRange = 1.0f / range;
+
+	out.dx = quantize16(displacement.x_, invRange);
+	out.y  = quantize16(displacement.y_, invRange);
+	out.dz = quantize16(displacement.z_, invRange);
+	out.j  = quantize16(jacobian - 1.0f, 1.0f / OCEAN_COMPACT_JACOBIAN);
+	out.spare = 0;
+
+	// project onto the octahedron |u| + |v| + |y| = 1, the lower half folds over the corners
+	float invL1 = 1.0f / (Abs(normal.x_) + Abs(normal.y_) + Abs(normal.z_));
+	float u = normal.x_ * invL1;
+	float v = normal.z_ * invL1;
+
+	if (normal.y_ < 0.0f) {
+		float fu = (1.0f - Abs(v)) * (u < 0.0f ? -1.0f : 1.0f);
+		float fv = (1.0f - Abs(u)) * (v < 0.0f ? -1.0f : 1.0f);
+		u = fu;
+		v = fv;
+	}
+
+	out.nu = quantize8(u);
+	out.nv = quantize8(v);
+}
+
+void cOcean::decodeCompact(const vertex_ocean_compact &in, float range, Vector3 &displacement, Vector3 &normal, float &jacobian) {
+	displacement.x_ = (in.dx / 65535.0f * 2.0f - 1.0f) * range;
+	displacement.y_ = (in.y  / 65535.0f * 2.0f - 1.0f) * range;
+	displacement.z_ = (in.dz / 65535.0f * 2.0f - 1.0f) * range;
+	jacobian = (in.j / 65535.0f * 2.0f - 1.0f) * OCEAN_COMPACT_JACOBIAN + 1.0f;
+
+	float u = in.nu / 255.0f * 2.0f - 1.0f;
+	float v = in.nv / 255.0f * 2.0f - 1.0f;
+	float y = 1.0f - Abs(u) - Abs(v);
+
+	if (y < 0.0f) {
+		float fu = (1.0f - Abs(v)) * (u < 0.0f ? -1.0f : 1.0f);
+		float fv = (1.0f - Abs(u)) * (v < 0.0f ? -1.0f : 1.0f);
+		u = fu;
+		v = fv;
+	}
+
+	normal = Vector3(u, y, v).Normalized();
+}
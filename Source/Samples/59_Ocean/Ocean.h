@@ -25,18 +25,50 @@
 
 #include <Urho3D/Container/Vector.h>
 
-#include "HelperThread.h"
 #include "ComplexFFT.h"
+#include "OceanHull.h"
+#include "OceanRipples.h"
+#include "OceanShoreMask.h"
+#include "OceanSimulation.h"
 
 namespace Urho3D
 {
+class Deserializer;
+class Drawable;
+class Image;
 class Material;
 class Model;
+class Serializer;
+class Terrain;
+class Texture2D;
 class Timer;
 }
 
 using namespace Urho3D;
 
+//=============================================================================
+//=============================================================================
+// dispersion() quantizes the wave frequencies to multiples of 2pi/OCEAN_REPEAT_TIME,
+// which makes the simulation exactly periodic over that many seconds
+#define OCEAN_REPEAT_TIME   200.0f
+
+// real fields per frame; the FFT packs two of them into each complex transform
+#define OCEAN_FFT_FIELDS    8
+#define OCEAN_FFT_PAIRS     (OCEAN_FFT_FIELDS / 2)
+
+// the compact vertex format quantizes displacement and height over +-this fraction of the patch length,
+// and the jacobian over 1 +-this
+#define OCEAN_COMPACT_RANGE 0.5f
+#define OCEAN_COMPACT_JACOBIAN 4.0f
+
+// floats per vertex in a simulated frame, packFrame() - position, normal and jacobian
+#define OCEAN_FRAME_FLOATS  7
+
+#define OCEAN_DEFAULT_SEED  1
+
+// time-sliced step, stage by stage - OceanProfiler's stages start in the same order
+enum { step_evolve, step_spectrum, step_rows, step_columns, step_vertices, step_normals, step_done };
+
 //=============================================================================
 //=============================================================================
 struct vertex_ocean 
@@ -46,6 +78,17 @@ struct vertex_ocean
 	float   a,   b,   c; // htilde0
 	float  _a,  _b,  _c; // htilde0mk conjugate
 	float  ox,  oy,  oz; // original position
+	float   j;           // jacobian of the horizontal displacement, < 0 where the surface folds (foam)
+};
+
+// compact dynamic vertex, 12 bytes - read by the Ocean shaders as three UBYTE4_NORM elements
+struct vertex_ocean_compact
+{
+	unsigned short dx, dz;	// horizontal displacement, 16-bit fixed point over +-range
+	unsigned short y;		// height, same
+	unsigned char  nu, nv;	// octahedral normal, +y is the center of the octahedron
+	unsigned short j;		// jacobian, 16-bit fixed point over 1 +-OCEAN_COMPACT_JACOBIAN
+	unsigned short spare;
 };
 
 // structure used with discrete fourier transform
@@ -54,8 +97,39 @@ struct complex_vector_normal
 	complex h; // wave height
 	Vector2 D; // displacement
 	Vector3 n; // normal
+	Vector3 J; // displacement derivatives dDx/dx, dDz/dz, dDx/dz
+};
+
+//=============================================================================
+// Everything that determines the waves. The spectrum and its evolution are
+// deterministic, so a client given the state regenerates the same ocean as the
+// host, bit for bit. time is the ocean's time when the state was taken.
+// During a weather blend A and wind are where it's going, and the blend runs
+// from fromA and fromWind over blendSeconds of ocean time from blendStart.
+//=============================================================================
+struct OceanState
+{
+    OceanState();
+
+    unsigned seed;
+    int      N;
+    float    A;
+    Vector2  wind;
+    float    length;
+    float    time;
+
+    bool     blending;
+    float    fromA;
+    Vector2  fromWind;
+    float    blendStart;
+    float    blendSeconds;
+
+    bool Write(Serializer &dest) const;
+    bool Read(Deserializer &source);
 };
 
+// gaussian pair for a grid coordinate, the same for a seed regardless of the order it's asked for in
+complex gaussianRandomVariable(unsigned seed, int n_prime, int m_prime);
 
 //=============================================================================
 //=============================================================================
@@ -68,10 +142,21 @@ class cOcean {
 	float A;				// phillips spectrum parameter -- affects heights of waves
 	Vector2      w;			// wind parameter
 	float length;			// length parameter
-	complex *h_tilde,		// for fast fourier transform
-		*h_tilde_slopex, *h_tilde_slopez,
-		*h_tilde_dx, *h_tilde_dz;
-	cFFT *fft;				// fast fourier transform
+	unsigned seed;			// random numbers are hashed from it and the grid coordinates
+	complex *h_tilde;		// h~(k, t)
+	complex *fft_height,	// for fast fourier transform, two real fields per transform (real | imaginary):
+		*fft_slope,			//   height | dDx/dz, slope x | slope z,
+		*fft_disp,			//   displacement x | displacement z,
+		*fft_jacobian;		//   dDx/dx | dDz/dz
+	bool fd_normals;		// normals from central differences of the height, skips the slope transform
+	int step_stage, step_unit;	// time-sliced step, the next row or column of a stage
+	float step_t;
+	OceanArena arena;		// all the buffers below and the fft's, one 64-byte aligned block
+	cFFT fft;				// fast fourier transform
+	OceanArena blend_arena;	// weather transition, h~0 and h~0(-k)* per vertex to blend from and to
+	complex *h0_from, *h0_to;
+	float blend_A;
+	Vector2 blend_w;
 
 public:
 	vertex_ocean *vertices;			// vertices for vertex buffer object
@@ -83,29 +168,95 @@ public:
 	//GLint vertex, normal, texture, light_position, projection, view, model;	// attributes and uniforms
 
 public:
-	cOcean(const int N, const float A, const Vector2      w, const float length, bool geometry);
+	cOcean(const int N, const float A, const Vector2      w, const float length, bool geometry, bool hugePages = false, unsigned seed = OCEAN_DEFAULT_SEED);
 	~cOcean();
 	void release();
 
+	static unsigned int arenaSize(int N);
+	unsigned int getFootprint() const { return arena.GetSize(); }
+	bool usesHugePages() const { return arena.IsHugePages(); }
+
+	int getN() const { return N; }
+	float getLength() const { return length; }
+	unsigned getSeed() const { return seed; }
+	void setVertex(int n_prime, int m_prime, float h, float dx, float dz, const Vector3 &n, float j);
+	void fieldFactors(int n_prime, int m_prime, complex *factors);
+	int packedFields(complex **packed);
+
+	void setFiniteDifferenceNormals(bool enable) { fd_normals = enable; }
+	bool getFiniteDifferenceNormals() const { return fd_normals; }
+
 	float dispersion(int n_prime, int m_prime);		// deep water
+	double phase(float t, int n_prime, int m_prime);	// dispersion() * t in turns, wrapped to the repeat time
 	float phillips(int n_prime, int m_prime);		// phillips spectrum
+	// for a wave vector rather than a grid index, shared with OceanDetailMap - dispersion() as whole turns
+	// per repeat time, phase() and phillips()
+	static double dispersionSteps(float kx, float kz);
+	static double phaseTurns(float kx, float kz, float t);
+	static float phillipsSpectrum(const Vector2 &k, float A, const Vector2 &w);
 	complex hTilde_0(int n_prime, int m_prime);
+	complex hTilde_0(int n_prime, int m_prime, float A, const Vector2 &w);
 	complex hTilde(float t, int n_prime, int m_prime);
 	complex_vector_normal h_D_and_n(Vector2      x, float t);
 	void evaluateWaves(float t);
 	void evaluateWavesFFT(float t);
+
+	// evaluateWavesFFT() stages, in order
+	void evaluateSpectrum(float t);
+	void fftRows();
+	void fftColumns();
+	void updateVertices();
+	void finiteDifferenceNormals();
+
+	// the same stages over a range of rows or columns [begin, end), evolveSpectrum() has to finish
+	// before packSpectrum() starts since each row reads its mirror
+	void evolveSpectrum(float t, int m_begin, int m_end);
+	void packSpectrum(int m_begin, int m_end);
+	void fftRows(int m_begin, int m_end);
+	void fftColumns(int n_begin, int n_end);
+	void updateVertices(int m_begin, int m_end);
+	void finiteDifferenceNormals(int m_begin, int m_end);
+
+	// evaluateWavesFFT() spread over several calls - beginStep(), then advanceStep() until it returns
+	// true. Each unit is a row or column of one stage; the vertices are only complete at the end
+	void beginStep(float t);
+	bool advanceStep(int units);
+	bool isStepDone() const;
+	int getStepStage() const { return step_stage; }
+
+	// weather transition - h~0 is blended from the current spectrum to the one for A and w, which becomes
+	// current at endBlend(). The dispersion doesn't depend on them, so the waves keep their phases and a
+	// step costs what it did. beginBlend() while blending starts from the blend so far
+	bool beginBlend(float A, const Vector2 &w);
+	void setBlend(float alpha);
+	void endBlend();
+	bool isBlending() const { return h0_from != 0; }
+	float getA() const { return A; }
+	const Vector2& getWind() const { return w; }
+
+	void packVertices(unsigned char *dest, unsigned vertexSize) const;
+	void packVerticesCompact(vertex_ocean_compact *dest) const;
+	void packFrame(float *dest) const;
+
+	// range is length * OCEAN_COMPACT_RANGE, decodeCompact() does what the shaders do
+	static void encodeCompact(const Vector3 &displacement, const Vector3 &normal, float jacobian, float range, vertex_ocean_compact &out);
+	static void decodeCompact(const vertex_ocean_compact &in, float range, Vector3 &displacement, Vector3 &normal, float &jacobian);
 	//void render(float t, glm::vec3 light_pos, glm::mat4 Projection, glm::mat4 View, glm::mat4 Model, bool use_fft);
 };
 
 //=============================================================================
 //=============================================================================
-class Ocean : public Component
+class Ocean : public Component, public WaterSurface
 {
     URHO3D_OBJECT(Ocean, Component);
 
+public:
+    enum VisibilityType { Visibility_InView, Visibility_OutOfView, Visibility_Hidden };
+
     struct Mesh
     {
         PODVector<Vector3> vertices;
+        PODVector<float>   jacobians;
         PODVector<Vector2> texcoords;
         PODVector<Vector3> normals;
         PODVector<int>     indices;
@@ -117,42 +268,157 @@ public:
     Ocean(Context *context);
     ~Ocean();
 
+    // components with the same parameters share one simulation
     void InitOcean();
+    void InitOcean(int N, float A, const Vector2 &wind, float length);
+
+    // parameters - changed after InitOcean(), the new simulation is prepared on its worker while
+    // the current one keeps running, and swapped in once it has a frame
+    void SetGridSize(int size);
+    int GetGridSize() const                     { return gridSize_; }
+    void SetAmplitude(float A);
+    float GetAmplitude() const                  { return amplitude_; }
+    void SetWind(const Vector2 &wind);
+    const Vector2& GetWind() const              { return wind_; }
+    void SetPatchLength(float length);
+    float GetPatchLength() const                { return patchLength_; }
+    void SetSeed(unsigned seed);
+    unsigned GetSeed() const                    { return seed_; }
+
+    // weather - blends the running simulation's spectrum to the new amplitude and wind over seconds of
+    // ocean time, the waves reshape rather than being replaced. Falls back to SetAmplitude() and SetWind()
+    // for 0 seconds or while other parameter changes are pending
+    void SetWeather(float A, const Vector2 &wind, float seconds);
+    bool IsWeatherBlending() const;
+
+    // networked sessions - the host sends GetState(), a client's SetState() regenerates the same waves
+    // from it, weather blend included, and moves its ocean time to the host's, less the time the state
+    // took to arrive. GetState() returns false while a blend can't be reproduced from its end points - it
+    // hasn't started on the worker yet or started part way through another - the state then holds where
+    // the weather is going, with no blend
+    bool GetState(OceanState &state);
+    void SetState(const OceanState &state);
+
+    Model* GetOceanModel() const                { return m_pModelOcean; }
+    BoundingBox GetBoundingBox() const          { return m_BoundingBox; }
+
+    // rate, normal mode and baked playback settings are on the shared simulation
+    OceanSimulation* GetSimulation() const      { return simulation_; }
+
+    // scheduling - the sim slows down beyond the full rate distance, drops to the offscreen rate when the
+    // drawable wasn't in view last frame and suspends while it's disabled. Without a drawable it always runs.
+    // Coming close to a camera's view it's resynced to the current time and runs at the full rate again.
+    void SetDrawable(Drawable *drawable);
+    void SetOffscreenSimRate(float hz);
+    void SetFullRateDistance(float distance);
+    VisibilityType GetVisibility() const        { return visibility_; }
 
-    Model* GetOceanModel() const        { return m_pModelOcean; }
-    BoundingBox GetBoundingBox() const  { return m_BoundingBox; }
+    // detail normals at scale times the grid size, 0 for none. The map goes to a clone of the drawable's
+    // material, in the normal unit with DetailOffset set for the shaders' DETAILMAP
+    void SetDetailScale(int scale);
+    int GetDetailScale() const                  { return detailScale_; }
+    Texture2D* GetDetailTexture() const         { return detailTexture_; }
+
+    // shoreline - the water depth over the terrain at each vertex, sampled once and rebuilt with the mesh.
+    // Waves die down over shallowDepth world units and triangles under the terrain aren't drawn. Set it
+    // again after moving the ocean or changing the terrain, NULL for none
+    void SetShoreTerrain(Terrain *terrain, float shallowDepth);
+    Terrain* GetShoreTerrain() const            { return shoreTerrain_; }
+    const OceanShoreMask& GetShoreMask() const  { return shoreMask_; }
+
+    // the surface as written this frame, read on the main thread without locking. It's written whenever the
+    // ocean's in view or has hulls. Heights at world x, z, wrapped to the patch - the ocean's height until
+    // the first frame is written
+    virtual void GetWaterHeights(const float *x, const float *z, float *heights, unsigned count) const;
+    float GetWaterHeight(const Vector3 &worldPosition) const;
+
+    // the surface's jacobian at world x, z, for foam - under 1 where the waves are compressed and under
+    // 0 where they fold over. 1 until the first frame is written
+    void GetWaterJacobians(const float *x, const float *z, float *jacobians, unsigned count) const;
+    float GetWaterJacobian(const Vector3 &worldPosition) const;
+
+    // hulls are updated against the surface after it's written each frame, hidden or not
+    void AddHull(OceanHull *hull);
+    void RemoveHull(OceanHull *hull);
+
+    // ripples, e.g. a boat's wake or a splash - radius in world units, strength is the height at the center
+    void AddDisturbance(const Vector3 &worldPosition, float radius, float strength);
+    unsigned GetNumRippleTiles()                { return ripples_.GetNumActiveTiles(); }
 
     void DbgRender();
 
 protected:
-    // fft
-    void EvaluateWavesFFT();
     void UpdateVertexBuffer();
-    void MakeMesh(int size, Mesh &mesh);
+    void UpdateDetailMap();
+    void UpdateShoreMask();
+    void UpdateHulls();
+    Vector3 SampleDisplacement(float u, float v, const Vector3 &position, const Vector3 &invScale, float cell) const;
+    float SampleJacobian(float u, float v) const;
+    void MakeMesh(int size, float length, Mesh &mesh);
+
+    // reconfiguration
+    void UpdateReconfigure();
+    void SwapSimulation();
+    void ApplyStateTime();
 
-    // threading
-    void SetProcessPending(bool bset);
-    bool IsProcessPending();
-    void BackgroundProcess();
+    // scheduling
+    VisibilityType UpdateVisibility(float &distance, bool &approaching);
+    bool UpdateSchedule();
 
-    void HandleUpdate(StringHash eventType, VariantMap& eventData);
+    void HandlePostUpdate(StringHash eventType, VariantMap& eventData);
 
 protected:
     // ocean
-    cOcean *pCOcean;
+    SharedPtr<OceanSimulation> simulation_;
+    int     gridSize_;
+    float   amplitude_;
+    Vector2 wind_;
+    float   patchLength_;
+    unsigned seed_;
     int     N;
     int     Nplus1;	
 
     Mesh             m_mesh;
     SharedPtr<Model> m_pModelOcean;
     BoundingBox      m_BoundingBox;
+    bool             surfaceValid_;     // m_mesh.vertices holds a written frame, in world space
+
+    // hulls floating on it
+    Vector<WeakPtr<OceanHull> > hulls_;
+
+    // reconfiguration - the pending simulation replaces the current one when ready, the retired one
+    // is held until its worker has exited so releasing it doesn't block
+    SharedPtr<OceanSimulation> pendingSimulation_;
+    SharedPtr<OceanSimulation> retiredSimulation_;
+    bool                parametersDirty_;
+
+    // SetState() time and weather blend, applied once the simulation with the state's parameters is current
+    OceanState          pendingState_;
+    Timer               stateTimer_;
+    bool                stateTimePending_;
+
+    // detail map, the version is the simulation's last copied into the image
+    int                 detailScale_;
+    SharedPtr<Image>    detailImage_;
+    SharedPtr<Texture2D> detailTexture_;
+    SharedPtr<Material> detailMaterial_;
+    unsigned            detailVersion_;
+
+    // shore mask on the mesh's grid
+    WeakPtr<Terrain>    shoreTerrain_;
+    float               shoreDepth_;
+    OceanShoreMask      shoreMask_;
+
+    // ripples on the mesh's grid
+    OceanRipples        ripples_;
 
-    // background thread
-    HelperThread<Ocean> *threadProcess_;
-    Mutex               mutexPendingLock_;
-    bool                processPending_;
-    SharedPtr<Time>     elapsedFrameTimer_;
-    Timer               processTimer_;
+    // scheduling
+    WeakPtr<Drawable>   drawable_;
+    VisibilityType      visibility_;
+    bool                inFrustum_;
+    bool                approaching_;       // in view, or a camera's frustum is within APPROACH_MARGIN of it
+    float               offscreenSimRate_;
+    float               fullRateDistance_;
 };
 
 
@@ -0,0 +1,147 @@
+//=============================================================================
+// Copyright (c) 2016 Lumak
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//=============================================================================
+
+
+#include <Urho3D/Urho3D.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+#include "OceanArena.h"
+
+#include <Urho3D/DebugNew.h>
+
+//=============================================================================
+//=============================================================================
+#define HUGE_PAGE_SIZE      (2 * 1024 * 1024)
+
+//=============================================================================
+//=============================================================================
+OceanArena::OceanArena()
+    : block_(NULL)
+    , allocation_(NULL)
+    , mappedSize_(0)
+    , size_(0)
+    , used_(0)
+{
+}
+
+OceanArena::OceanArena(unsigned size, bool hugePages)
+    : block_(NULL)
+    , allocation_(NULL)
+    , mappedSize_(0)
+    , size_(0)
+    , used_(0)
+{
+    Allocate( size, hugePages );
+}
+
+OceanArena::~OceanArena()
+{
+    Free();
+}
+
+bool OceanArena::Allocate(unsigned size, bool hugePages)
+{
+    Free();
+
+    size = Align( size );
+
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if ( hugePages )
+    {
+        // huge pages need a huge page aligned range, so map an extra one and trim to it
+        size_t mapSize = ((size_t)size + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+        void *mem = mmap( NULL, mapSize + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+
+        if ( mem != MAP_FAILED )
+        {
+            size_t head = ( HUGE_PAGE_SIZE - ((size_t)mem & (HUGE_PAGE_SIZE - 1)) ) & (HUGE_PAGE_SIZE - 1);
+            unsigned char *start = (unsigned char*)mem + head;
+
+            if ( head > 0 )
+                munmap( mem, head );
+
+            munmap( start + mapSize, HUGE_PAGE_SIZE - head );
+
+            if ( madvise( start, mapSize, MADV_HUGEPAGE ) == 0 )
+            {
+                // anonymous mappings are already zeroed
+                allocation_ = start;
+                block_ = start;
+                mappedSize_ = (unsigned)mapSize;
+                size_ = size;
+                return true;
+            }
+
+            munmap( start, mapSize );
+        }
+    }
+#else
+    (void)hugePages;
+#endif
+
+    allocation_ = malloc( size + Alignment - 1 );
+
+    if ( !allocation_ )
+        return false;
+
+    block_ = (unsigned char*)( ((size_t)allocation_ + Alignment - 1) & ~(size_t)(Alignment - 1) );
+    size_ = size;
+    memset( block_, 0, size_ );
+
+    return true;
+}
+
+void OceanArena::Free()
+{
+#if defined(__linux__)
+    if ( mappedSize_ > 0 )
+        munmap( allocation_, mappedSize_ );
+    else
+#endif
+        free( allocation_ );
+
+    block_ = NULL;
+    allocation_ = NULL;
+    mappedSize_ = 0;
+    size_ = 0;
+    used_ = 0;
+}
+
+void* OceanArena::Alloc(unsigned bytes)
+{
+    bytes = Align( bytes );
+
+    if ( !block_ || used_ + bytes > size_ )
+        return NULL;
+
+    void *mem = block_ + used_;
+    used_ += bytes;
+
+    return mem;
+}
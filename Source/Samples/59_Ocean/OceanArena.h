@@ -0,0 +1,66 @@
+//=============================================================================
+// Copyright (c) 2016 Lumak
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//=============================================================================
+
+
+#pragma once
+
+//=============================================================================
+// A single 64-byte aligned block that holds all of an ocean's simulation
+// buffers. The size is worked out up front with Align() and the buffers are
+// carved from it in order, so there's one allocation and one free per ocean.
+// With huge pages, Linux is asked to back the block with transparent huge
+// pages; elsewhere, or if that fails, it's a regular allocation.
+//=============================================================================
+class OceanArena
+{
+public:
+    enum { Alignment = 64 };
+
+    OceanArena();
+    OceanArena(unsigned size, bool hugePages);
+    ~OceanArena();
+
+    bool Allocate(unsigned size, bool hugePages);
+    void Free();
+
+    // aligned and zeroed, NULL if the arena's size was underestimated
+    void* Alloc(unsigned bytes);
+
+    template <class T> T* Alloc(unsigned count)
+    {
+        return static_cast<T*>( Alloc( count * sizeof(T) ) );
+    }
+
+    static unsigned Align(unsigned bytes)   { return (bytes + Alignment - 1) & ~(unsigned)(Alignment - 1); }
+
+    unsigned GetSize() const                { return size_; }
+    unsigned GetUsed() const                { return used_; }
+    bool IsHugePages() const                { return mappedSize_ > 0; }
+
+protected:
+    unsigned char   *block_;        // aligned start
+    void            *allocation_;   // as returned by malloc() or mmap()
+    unsigned        mappedSize_;    // non-zero when mapped for huge pages
+    unsigned        size_;
+    unsigned        used_;
+};
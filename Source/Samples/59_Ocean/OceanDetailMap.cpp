@@ -0,0 +1,261 @@
+//=============================================================================
+// Copyright (c) 2016 Lumak
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//=============================================================================
+
+#include <Urho3D/Urho3D.h>
+#include <Urho3D/Math/MathDefs.h>
+#include <Urho3D/Math/Vector3.h>
+
+#include "OceanDetailMap.h"
+#include "Ocean.h"
+#include "OceanMath.h"
+
+#include <Urho3D/DebugNew.h>
+
+//=============================================================================
+//=============================================================================
+#define MAX_DETAIL_SIZE     1024
+
+//=============================================================================
+//=============================================================================
+OceanDetailMap::OceanDetailMap()
+    : N_(0)
+    , M_(0)
+    , length_(0.0f)
+    , seed_(0)
+    , h0From_(NULL)
+    , h0To_(NULL)
+    , fft_(NULL)
+    , h0_(NULL)
+    , phaseSteps_(NULL)
+    , hTilde_(NULL)
+    , slope_(NULL)
+{
+}
+
+OceanDetailMap::~OceanDetailMap()
+{
+    Clear();
+}
+
+void OceanDetailMap::Clear()
+{
+    delete fft_;
+    fft_ = NULL;
+
+    arena_.Free();
+    blendArena_.Free();
+    h0_ = hTilde_ = slope_ = h0From_ = h0To_ = NULL;
+    phaseSteps_ = NULL;
+    data_.Clear();
+    M_ = 0;
+}
+
+bool OceanDetailMap::Init(int N, float A, const Vector2 &wind, float length, unsigned seed, int scale)
+{
+    Clear();
+
+    int M = N * scale;
+
+    if ( scale < 1 || !IsPowerOfTwo( scale ) || M > MAX_DETAIL_SIZE )
+        return false;
+
+    unsigned bufferBytes = OceanArena::Align( M * M * sizeof(complex) );
+
+    if ( !arena_.Allocate( cFFT::arenaSize( M ) + 4 * bufferBytes + OceanArena::Align( M * M * sizeof(float) ), false ) )
+        return false;
+
+    fft_    = new cFFT( M, arena_ );
+    h0_     = arena_.Alloc<complex>( 2 * M * M );
+    hTilde_ = arena_.Alloc<complex>( M * M );
+    slope_  = arena_.Alloc<complex>( M * M );
+    phaseSteps_ = arena_.Alloc<float>( M * M );
+
+    N_ = N;
+    M_ = M;
+    length_ = length;
+    seed_ = seed;
+    data_.Resize( M * M * 4 );
+
+    DrawSpectrum( A, wind, h0_ );
+
+    // whole numbers, exact in a float
+    for ( int m = 0; m < M; ++m )
+    {
+        for ( int n = 0; n < M; ++n )
+            phaseSteps_[ m * M + n ] = (float)cOcean::dispersionSteps( M_PI * (2.0f * n - M) / length, M_PI * (2.0f * m - M) / length );
+    }
+
+    return true;
+}
+
+void OceanDetailMap::DrawSpectrum(float A, const Vector2 &wind, complex *h0)
+{
+    // texel n is the geometry's grid index n - offset, drawn exactly as cOcean draws it, including
+    // h~0(-k) coming from the grid index -n
+    int offset = ( M_ - N_ ) / 2;
+
+    for ( int m = 0; m < M_; ++m )
+    {
+        for ( int n = 0; n < M_; ++n, h0 += 2 )
+        {
+            int nPrime = n - offset;
+            int mPrime = m - offset;
+            Vector2 k( M_PI * (2.0f * nPrime - N_) / length_, M_PI * (2 * mPrime - N_) / length_ );
+            Vector2 kMinus( M_PI * (2.0f * -nPrime - N_) / length_, M_PI * (2 * -mPrime - N_) / length_ );
+
+            h0[0] = gaussianRandomVariable( seed_, nPrime, mPrime ) * sqrt( cOcean::phillipsSpectrum( k, A, wind ) / 2.0f );
+            h0[1] = ( gaussianRandomVariable( seed_, -nPrime, -mPrime ) * sqrt( cOcean::phillipsSpectrum( kMinus, A, wind ) / 2.0f ) ).conj();
+        }
+    }
+}
+
+bool OceanDetailMap::BeginBlend(float A, const Vector2 &wind)
+{
+    if ( !M_ )
+        return false;
+
+    unsigned count = 2 * M_ * M_;
+
+    if ( !h0From_ )
+    {
+        if ( !blendArena_.Allocate( 2 * OceanArena::Align( count * sizeof(complex) ), false ) )
+            return false;
+
+        h0From_ = blendArena_.Alloc<complex>( count );
+        h0To_   = blendArena_.Alloc<complex>( count );
+    }
+
+    // from the spectrum so far, which is the blend if one was under way
+    for ( unsigned i = 0; i < count; ++i )
+        h0From_[ i ] = h0_[ i ];
+
+    DrawSpectrum( A, wind, h0To_ );
+
+    return true;
+}
+
+void OceanDetailMap::SetBlend(float alpha)
+{
+    if ( !h0From_ )
+        return;
+
+    unsigned count = 2 * M_ * M_;
+
+    for ( unsigned i = 0; i < count; ++i )
+        h0_[ i ] = h0From_[ i ] * (1.0f - alpha) + h0To_[ i ] * alpha;
+}
+
+void OceanDetailMap::EndBlend()
+{
+    SetBlend( 1.0f );
+
+    blendArena_.Free();
+    h0From_ = h0To_ = NULL;
+}
+
+void OceanDetailMap::Evaluate(float t)
+{
+    if ( !M_ )
+        return;
+
+    EvolveSpectrum( t );
+    PackSlope();
+
+    for ( int m = 0; m < M_; ++m )
+        fft_->fft( slope_, slope_, 1, m * M_ );
+
+    for ( int n = 0; n < M_; ++n )
+        fft_->fft( slope_, slope_, M_, n );
+
+    WriteNormals();
+}
+
+void OceanDetailMap::EvolveSpectrum(float t)
+{
+    // cOcean::hTilde(), with phaseTurns()'s dispersion done once in Init()
+    double turns = fmod( (double)t, (double)OCEAN_REPEAT_TIME ) / OCEAN_REPEAT_TIME;
+    int count = M_ * M_;
+
+    for ( int i = 0; i < count; ++i )
+    {
+        const complex *h0 = &h0_[ 2 * i ];
+        float cos_, sin_;
+
+        detSinCos( phaseSteps_[ i ] * turns, sin_, cos_ );
+        hTilde_[ i ] = h0[0] * complex( cos_, sin_ ) + h0[1] * complex( cos_, -sin_ );
+    }
+}
+
+void OceanDetailMap::PackSlope()
+{
+    // as cOcean::packSpectrum(), slope x in the real part and slope z in the imaginary. The nyquist row
+    // and column are left out, they're the map's own finest waves and carry next to nothing, and so
+    // are the mesh's wave numbers - its normals carry them, with the ripples and the shore damping
+    int offset = ( M_ - N_ ) / 2;
+
+    for ( int m = 0; m < M_; ++m )
+    {
+        float kz = M_PI * (2.0f * m - M_) / length_;
+
+        for ( int n = 0; n < M_; ++n )
+        {
+            int index = m * M_ + n;
+
+            bool meshBand = n >= offset && n < offset + N_ && m >= offset && m < offset + N_;
+
+            if ( n == 0 || m == 0 || meshBand )
+            {
+                slope_[ index ] = complex( 0.0f, 0.0f );
+                continue;
+            }
+
+            float kx = M_PI * (2.0f * n - M_) / length_;
+            const complex &h = hTilde_[ index ];
+            const complex &mirror = hTilde_[ (M_ - m) * M_ + (M_ - n) ];
+            float a = 0.5f * ( h.a + mirror.a );
+            float b = 0.5f * ( h.b - mirror.b );
+
+            slope_[ index ] = complex( -kx * b - kz * a, kx * a - kz * b );
+        }
+    }
+}
+
+void OceanDetailMap::WriteNormals()
+{
+    unsigned char *dest = &data_[0];
+
+    for ( int m = 0; m < M_; ++m )
+    {
+        for ( int n = 0; n < M_; ++n, dest += 4 )
+        {
+            const complex &slope = slope_[ m * M_ + n ];
+            float sign = ( (n + m) & 1 ) ? -1.0f : 1.0f;
+            Vector3 normal = Vector3( -slope.a * sign, 1.0f, -slope.b * sign ).Normalized();
+
+            dest[0] = (unsigned char)Clamp( (int)( ( normal.x_ * 0.5f + 0.5f ) * 255.0f + 0.5f ), 0, 255 );
+            dest[1] = (unsigned char)Clamp( (int)( ( normal.z_ * 0.5f + 0.5f ) * 255.0f + 0.5f ), 0, 255 );
+            dest[2] = (unsigned char)Clamp( (int)( ( normal.y_ * 0.5f + 0.5f ) * 255.0f + 0.5f ), 0, 255 );
+            dest[3] = 255;
+        }
+    }
+}
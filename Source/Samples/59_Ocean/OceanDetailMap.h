@@ -0,0 +1,88 @@
+//=============================================================================
+// Copyright (c) 2016 Lumak
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//=============================================================================
+
+#pragma once
+
+#include <Urho3D/Container/Vector.h>
+#include <Urho3D/Math/Vector2.h>
+
+#include "OceanArena.h"
+
+using namespace Urho3D;
+
+class complex;
+class cFFT;
+
+//=============================================================================
+// Normals from a slope FFT at a multiple of the geometry's grid size, so the
+// lighting can be finer than the mesh. The spectrum keeps the geometry's wave
+// numbers, hashing and evolution, but only the waves shorter than the mesh's
+// are in the map - the shaders add it to the interpolated vertex normal as a
+// perturbation. Texel (n, m) is at grid position (n, m) / scale, the same
+// place vertex (n, m) / scale samples, in RGBA8: x, z and up as 0..255,
+// alpha 255.
+//=============================================================================
+class OceanDetailMap
+{
+public:
+    OceanDetailMap();
+    ~OceanDetailMap();
+
+    // scale is a power of two, the map is N * scale texels across
+    bool Init(int N, float A, const Vector2 &wind, float length, unsigned seed, int scale);
+    void Clear();
+
+    bool IsValid() const                { return M_ > 0; }
+    int GetSize() const                 { return M_; }
+    int GetScale() const                { return M_ > 0 ? M_ / N_ : 0; }
+
+    void Evaluate(float t);
+    const PODVector<unsigned char>& GetData() const { return data_; }
+
+    // weather transition, as cOcean's
+    bool BeginBlend(float A, const Vector2 &wind);
+    void SetBlend(float alpha);
+    void EndBlend();
+
+protected:
+    void DrawSpectrum(float A, const Vector2 &wind, complex *h0);
+    void EvolveSpectrum(float t);
+    void PackSlope();
+    void WriteNormals();
+
+protected:
+    int                 N_;
+    int                 M_;
+    float               length_;
+    unsigned            seed_;
+    OceanArena          arena_;
+    OceanArena          blendArena_;
+    complex             *h0From_;
+    complex             *h0To_;
+    cFFT                *fft_;
+    complex             *h0_;           // h~0(k), h~0(-k)* interleaved
+    float               *phaseSteps_;   // cOcean::phaseTurns() turns per repeat time, whole numbers
+    complex             *hTilde_;
+    complex             *slope_;        // slope x | slope z
+    PODVector<unsigned char> data_;
+};
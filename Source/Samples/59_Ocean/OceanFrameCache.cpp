@@ -0,0 +1,472 @@
+//=============================================================================
+// Copyright (c) 2016 Lumak
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//=============================================================================
+
+#include <Urho3D/Urho3D.h>
+#include <Urho3D/Core/Context.h>
+#include <Urho3D/IO/Serializer.h>
+#include <Urho3D/IO/Deserializer.h>
+#include <Urho3D/Math/MathDefs.h>
+#include <SDL/SDL_log.h>
+
+#include "Ocean.h"
+#include "OceanFrameCache.h"
+
+#include <Urho3D/DebugNew.h>
+
+//=============================================================================
+//=============================================================================
+#define QUANTIZE_MAX       32767.0f
+
+//=============================================================================
+// deltas are zigzag mapped and stored as 7-bit varints, small frame to frame
+// changes take a single byte
+//=============================================================================
+static void WriteDelta(PODVector<unsigned char> &data, int delta)
+{
+    unsigned val = ((unsigned)delta << 1) ^ (unsigned)(delta >> 31);
+
+    while ( val >= 0x80 )
+    {
+        data.Push( (unsigned char)(val | 0x80) );
+        val >>= 7;
+    }
+    data.Push( (unsigned char)val );
+}
+
+static int ReadDelta(const unsigned char *&ptr)
+{
+    unsigned val = 0;
+    unsigned shift = 0;
+    unsigned char byte;
+
+    do
+    {
+        byte = *ptr++;
+        val |= (unsigned)(byte & 0x7f) << shift;
+        shift += 7;
+    }
+    while ( byte & 0x80 );
+
+    return (int)(val >> 1) ^ -(int)(val & 1);
+}
+
+// steps over numDeltas varints, false if they'd run past end or one is longer than a 32-bit value takes
+static bool SkipDeltas(const unsigned char *&ptr, const unsigned char *end, unsigned numDeltas)
+{
+    for ( unsigned i = 0; i < numDeltas; ++i )
+    {
+        unsigned length = 0;
+
+        do
+        {
+            if ( ptr == end || ++length > 5 )
+                return false;
+        }
+        while ( *ptr++ & 0x80 );
+    }
+
+    return true;
+}
+
+static float GetChannel(const vertex_ocean &vert, int channel)
+{
+    switch ( channel )
+    {
+    case OceanFrameCache::Channel_Height:   return vert.y;
+    case OceanFrameCache::Channel_DispX:    return vert.x - vert.ox;
+    case OceanFrameCache::Channel_DispZ:    return vert.z - vert.oz;
+    case OceanFrameCache::Channel_NormX:    return vert.nx;
+    case OceanFrameCache::Channel_NormZ:    return vert.nz;
+    case OceanFrameCache::Channel_Jacobian: return vert.j;
+    }
+    return 0.0f;
+}
+
+//=============================================================================
+//=============================================================================
+OceanFrameCache::OceanFrameCache()
+    : N_(0)
+    , numFrames_(0)
+    , frameRate_(0.0f)
+    , bakePass_(BakePass_None)
+    , bakeFrame_(0)
+    , bakeMaxBytes_(0)
+    , curBuff_(0)
+{
+    for ( int c = 0; c < Channel_Max; ++c )
+        scale_[c] = 1.0f;
+
+    frameBuffIdx_[0] = frameBuffIdx_[1] = M_MAX_UNSIGNED;
+}
+
+OceanFrameCache::~OceanFrameCache()
+{
+}
+
+void OceanFrameCache::Clear()
+{
+    N_ = 0;
+    numFrames_ = 0;
+    frameRate_ = 0.0f;
+    data_.Clear();
+    frameOffsets_.Clear();
+
+    bakePass_ = BakePass_None;
+    bakePrev_.Clear();
+
+    for ( int i = 0; i < 2; ++i )
+    {
+        frameBuff_[i].Clear();
+        frameBuffIdx_[i] = M_MAX_UNSIGNED;
+    }
+    curBuff_ = 0;
+}
+
+unsigned OceanFrameCache::GetMemoryUse() const
+{
+    return data_.Size() + frameOffsets_.Size() * sizeof(unsigned) +
+           (frameBuff_[0].Size() + frameBuff_[1].Size() + bakePrev_.Size()) * sizeof(short);
+}
+
+bool OceanFrameCache::BeginBake(int N, float framesPerSec, unsigned maxBytes)
+{
+    Clear();
+
+    if ( N <= 0 || framesPerSec <= 0.0f )
+        return false;
+
+    N_ = N;
+    // round to a whole number of frames per period so the loop is seamless
+    numFrames_ = (unsigned)RoundToInt( OCEAN_REPEAT_TIME * framesPerSec );
+    frameRate_ = (float)numFrames_ / OCEAN_REPEAT_TIME;
+
+    if ( numFrames_ < 2 )
+    {
+        Clear();
+        return false;
+    }
+
+    for ( int c = 0; c < Channel_Max; ++c )
+        scale_[c] = M_EPSILON;
+
+    bakeMaxBytes_ = maxBytes;
+    bakeFrame_ = 0;
+    bakePass_ = BakePass_Range;
+
+    return true;
+}
+
+bool OceanFrameCache::BakeStep(cOcean *ocean, unsigned maxFrames)
+{
+    if ( bakePass_ == BakePass_None )
+        return true;
+
+    if ( ocean->getN() != N_ )
+    {
+        SDL_Log( "ocean frame cache: grid size changed during bake\n" );
+        Clear();
+        return true;
+    }
+
+    const vertex_ocean *vertices = ocean->vertices;
+    int Nplus1 = N_ + 1;
+    PODVector<short> samples;
+
+    for ( unsigned i = 0; i < maxFrames && bakePass_ != BakePass_None; ++i )
+    {
+        ocean->evaluateWavesFFT( (float)bakeFrame_ / frameRate_ );
+
+        if ( bakePass_ == BakePass_Range )
+        {
+            // the first pass only finds the quantization range of each channel
+            for ( int m_prime = 0; m_prime < N_; ++m_prime )
+            {
+                for ( int n_prime = 0; n_prime < N_; ++n_prime )
+                {
+                    const vertex_ocean &vert = vertices[ m_prime * Nplus1 + n_prime ];
+
+                    for ( int c = 0; c < Channel_Max; ++c )
+                        scale_[c] = Max( scale_[c], Abs( GetChannel(vert, c) ) );
+                }
+            }
+
+            if ( ++bakeFrame_ == numFrames_ )
+            {
+                bakeFrame_ = 0;
+                bakePass_ = BakePass_Encode;
+                bakePrev_.Resize( Channel_Max * N_ * N_ );
+                frameOffsets_.Reserve( numFrames_ );
+            }
+        }
+        else
+        {
+            ReadSamples( ocean, samples );
+            EncodeFrame( samples, bakeFrame_ % KeyFrame_Interval == 0 );
+            bakePrev_ = samples;
+
+            if ( bakeMaxBytes_ && data_.Size() > bakeMaxBytes_ )
+            {
+                SDL_Log( "ocean frame cache: bake exceeds %u bytes at frame %u of %u\n", bakeMaxBytes_, bakeFrame_, numFrames_ );
+                Clear();
+                return true;
+            }
+
+            if ( ++bakeFrame_ == numFrames_ )
+            {
+                bakePass_ = BakePass_None;
+                bakePrev_.Clear();
+
+                SDL_Log( "ocean frame cache: %u frames at %.1f fps, %u KB (raw float %u KB)\n",
+                         numFrames_, frameRate_, GetMemoryUse() / 1024,
+                         numFrames_ * Channel_Max * N_ * N_ * (unsigned)sizeof(float) / 1024 );
+            }
+        }
+    }
+
+    return bakePass_ == BakePass_None;
+}
+
+bool OceanFrameCache::Bake(cOcean *ocean, float framesPerSec, unsigned maxBytes)
+{
+    if ( !BeginBake( ocean->getN(), framesPerSec, maxBytes ) )
+        return false;
+
+    while ( !BakeStep( ocean, numFrames_ ) )
+        ;
+
+    return IsBaked();
+}
+
+void OceanFrameCache::ReadSamples(cOcean *ocean, PODVector<short> &samples)
+{
+    const vertex_ocean *vertices = ocean->vertices;
+    int Nplus1 = N_ + 1;
+    int NN = N_ * N_;
+
+    samples.Resize( Channel_Max * NN );
+
+    for ( int c = 0; c < Channel_Max; ++c )
+    {
+        float invScale = QUANTIZE_MAX / scale_[c];
+        short *dest = &samples[ c * NN ];
+
+        for ( int m_prime = 0; m_prime < N_; ++m_prime )
+        {
+            for ( int n_prime = 0; n_prime < N_; ++n_prime )
+            {
+                float val = GetChannel( vertices[ m_prime * Nplus1 + n_prime ], c ) * invScale;
+                *dest++ = (short)Clamp( RoundToInt( val ), -(int)QUANTIZE_MAX, (int)QUANTIZE_MAX );
+            }
+        }
+    }
+}
+
+void OceanFrameCache::EncodeFrame(const PODVector<short> &samples, bool keyFrame)
+{
+    frameOffsets_.Push( data_.Size() );
+
+    // key frames are deltas against zero so both decode the same way
+    for ( unsigned i = 0; i < samples.Size(); ++i )
+    {
+        int prev = keyFrame ? 0 : bakePrev_[i];
+        WriteDelta( data_, (int)samples[i] - prev );
+    }
+}
+
+void OceanFrameCache::DecodeFrame(unsigned frame, PODVector<short> &state)
+{
+    const unsigned char *ptr = &data_[ frameOffsets_[frame] ];
+    unsigned numSamples = state.Size();
+
+    if ( frame % KeyFrame_Interval == 0 )
+    {
+        for ( unsigned i = 0; i < numSamples; ++i )
+            state[i] = (short)ReadDelta( ptr );
+    }
+    else
+    {
+        for ( unsigned i = 0; i < numSamples; ++i )
+            state[i] = (short)( state[i] + ReadDelta( ptr ) );
+    }
+}
+
+void OceanFrameCache::AdvanceTo(PODVector<short> &state, unsigned &stateFrame, unsigned frame)
+{
+    if ( stateFrame == frame )
+        return;
+
+    state.Resize( Channel_Max * N_ * N_ );
+
+    // step forward from the current state unless seeking from the closest key frame is cheaper
+    unsigned fromKey = frame % KeyFrame_Interval;
+
+    if ( stateFrame >= numFrames_ || (frame + numFrames_ - stateFrame) % numFrames_ > fromKey )
+    {
+        stateFrame = frame - fromKey;
+        DecodeFrame( stateFrame, state );
+    }
+
+    while ( stateFrame != frame )
+    {
+        stateFrame = (stateFrame + 1) % numFrames_;
+        DecodeFrame( stateFrame, state );
+    }
+}
+
+void OceanFrameCache::Playback(cOcean *ocean, float t)
+{
+    if ( !IsBaked() || ocean->getN() != N_ )
+        return;
+
+    float ft = fmodf( t * frameRate_, (float)numFrames_ );
+    if ( ft < 0.0f )
+        ft += (float)numFrames_;
+
+    unsigned f0 = Min( (unsigned)ft, numFrames_ - 1 );
+    unsigned f1 = (f0 + 1) % numFrames_;
+    float alpha = ft - (float)f0;
+
+    // playing forward, the later of the two decoded frames becomes the earlier one
+    if ( frameBuffIdx_[curBuff_ ^ 1] == f0 )
+        curBuff_ ^= 1;
+
+    unsigned nextBuff = curBuff_ ^ 1;
+    AdvanceTo( frameBuff_[curBuff_], frameBuffIdx_[curBuff_], f0 );
+    AdvanceTo( frameBuff_[nextBuff], frameBuffIdx_[nextBuff], f1 );
+
+    int NN = N_ * N_;
+    float wA[Channel_Max], wB[Channel_Max];
+
+    for ( int c = 0; c < Channel_Max; ++c )
+    {
+        wA[c] = (1.0f - alpha) * scale_[c] / QUANTIZE_MAX;
+        wB[c] = alpha * scale_[c] / QUANTIZE_MAX;
+    }
+
+    const short *a = &frameBuff_[curBuff_][0];
+    const short *b = &frameBuff_[nextBuff][0];
+
+    for ( int m_prime = 0; m_prime < N_; ++m_prime )
+    {
+        for ( int n_prime = 0; n_prime < N_; ++n_prime )
+        {
+            int i = m_prime * N_ + n_prime;
+            float val[Channel_Max];
+
+            for ( int c = 0; c < Channel_Max; ++c )
+                val[c] = a[c * NN + i] * wA[c] + b[c * NN + i] * wB[c];
+
+            float nx = val[Channel_NormX];
+            float nz = val[Channel_NormZ];
+            float ny = sqrtf( Max( 1.0f - nx * nx - nz * nz, 0.0f ) );
+
+            ocean->setVertex( n_prime, m_prime, val[Channel_Height], val[Channel_DispX], val[Channel_DispZ],
+                              Vector3(nx, ny, nz).Normalized(), val[Channel_Jacobian] );
+        }
+    }
+}
+
+bool OceanFrameCache::Save(Serializer &dest) const
+{
+    if ( !IsBaked() )
+        return false;
+
+    dest.WriteFileID( "OFC2" );
+    dest.WriteInt( N_ );
+    dest.WriteUInt( numFrames_ );
+    dest.WriteFloat( frameRate_ );
+
+    for ( int c = 0; c < Channel_Max; ++c )
+        dest.WriteFloat( scale_[c] );
+
+    dest.WriteUInt( data_.Size() );
+
+    for ( unsigned i = 0; i < frameOffsets_.Size(); ++i )
+        dest.WriteUInt( frameOffsets_[i] );
+
+    return dest.Write( &data_[0], data_.Size() ) == data_.Size();
+}
+
+bool OceanFrameCache::Load(Deserializer &source)
+{
+    Clear();
+
+    if ( source.ReadFileID() != "OFC2" )
+        return false;
+
+    N_ = source.ReadInt();
+    numFrames_ = source.ReadUInt();
+    frameRate_ = source.ReadFloat();
+
+    for ( int c = 0; c < Channel_Max; ++c )
+        scale_[c] = source.ReadFloat();
+
+    unsigned dataSize = source.ReadUInt();
+    unsigned remaining = source.GetSize() - source.GetPosition();
+
+    // the sizes are checked against the file before anything's allocated for them, every sample takes at least a byte
+    if ( numFrames_ == 0 || N_ <= 0 || dataSize == 0 || numFrames_ > remaining / sizeof(unsigned) ||
+         dataSize > remaining - numFrames_ * sizeof(unsigned) || (unsigned)N_ > dataSize / Channel_Max / (unsigned)N_ )
+    {
+        Clear();
+        return false;
+    }
+
+    frameOffsets_.Resize( numFrames_ );
+    data_.Resize( dataSize );
+
+    for ( unsigned i = 0; i < numFrames_; ++i )
+        frameOffsets_[i] = source.ReadUInt();
+
+    if ( source.Read( &data_[0], dataSize ) != dataSize )
+    {
+        Clear();
+        return false;
+    }
+
+    // each frame starts where the one before ends and holds exactly a frame's worth of deltas, so
+    // decoding never reads past it
+    unsigned numSamples = Channel_Max * N_ * N_;
+
+    for ( unsigned i = 0; i < numFrames_; ++i )
+    {
+        unsigned end = i + 1 < numFrames_ ? frameOffsets_[i + 1] : dataSize;
+
+        if ( ( i == 0 && frameOffsets_[i] != 0 ) || end <= frameOffsets_[i] || end > dataSize )
+        {
+            Clear();
+            return false;
+        }
+
+        const unsigned char *ptr = &data_[ frameOffsets_[i] ];
+        const unsigned char *frameEnd = &data_[0] + end;
+
+        if ( !SkipDeltas( ptr, frameEnd, numSamples ) || ptr != frameEnd )
+        {
+            Clear();
+            return false;
+        }
+    }
+
+    return true;
+}
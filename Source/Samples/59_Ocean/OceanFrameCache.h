@@ -0,0 +1,98 @@
+//=============================================================================
+// Copyright (c) 2016 Lumak
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//=============================================================================
+
+#pragma once
+
+#include <Urho3D/Container/Vector.h>
+
+namespace Urho3D
+{
+class Serializer;
+class Deserializer;
+}
+
+using namespace Urho3D;
+
+class cOcean;
+
+//=============================================================================
+// One repeat period of the ocean sampled at a fixed rate. Each frame stores
+// height, displacement, the normal's xz and the jacobian as 16-bit values, delta encoded
+// against the previous frame with a key frame every KeyFrame_Interval frames.
+//=============================================================================
+class OceanFrameCache
+{
+public:
+    enum ChannelType     { Channel_Height, Channel_DispX, Channel_DispZ, Channel_NormX, Channel_NormZ, Channel_Jacobian, Channel_Max };
+    enum KeyFrameType    { KeyFrame_Interval = 32 };
+    enum BakePassType    { BakePass_None, BakePass_Range, BakePass_Encode };
+
+    OceanFrameCache();
+    ~OceanFrameCache();
+
+    void Clear();
+
+    // bake - BakeStep() evaluates up to maxFrames frames with the ocean's FFT and
+    // returns true once the bake is finished; Bake() runs all the steps at once
+    bool BeginBake(int N, float framesPerSec, unsigned maxBytes);
+    bool BakeStep(cOcean *ocean, unsigned maxFrames);
+    bool Bake(cOcean *ocean, float framesPerSec, unsigned maxBytes);
+
+    // decode the two frames around t and write the interpolated result to the ocean vertices
+    void Playback(cOcean *ocean, float t);
+
+    bool Save(Serializer &dest) const;
+    bool Load(Deserializer &source);
+
+    bool IsBaked() const            { return numFrames_ > 0 && bakePass_ == BakePass_None; }
+    bool IsBaking() const           { return bakePass_ != BakePass_None; }
+    int GetGridSize() const         { return N_; }
+    unsigned GetNumFrames() const   { return numFrames_; }
+    float GetFrameRate() const      { return frameRate_; }
+    unsigned GetMemoryUse() const;
+
+protected:
+    void ReadSamples(cOcean *ocean, PODVector<short> &samples);
+    void EncodeFrame(const PODVector<short> &samples, bool keyFrame);
+    void DecodeFrame(unsigned frame, PODVector<short> &state);
+    void AdvanceTo(PODVector<short> &state, unsigned &stateFrame, unsigned frame);
+
+protected:
+    int                         N_;
+    unsigned                    numFrames_;
+    float                       frameRate_;
+    float                       scale_[Channel_Max];
+    PODVector<unsigned char>    data_;
+    PODVector<unsigned>         frameOffsets_;
+
+    // bake state
+    BakePassType                bakePass_;
+    unsigned                    bakeFrame_;
+    unsigned                    bakeMaxBytes_;
+    PODVector<short>            bakePrev_;
+
+    // playback state - two decoded frames, curBuff_ is the earlier one
+    PODVector<short>            frameBuff_[2];
+    unsigned                    frameBuffIdx_[2];
+    unsigned                    curBuff_;
+};
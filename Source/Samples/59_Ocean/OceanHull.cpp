@@ -0,0 +1,357 @@
+//=============================================================================
+// Copyright (c) 2016 Lumak
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//=============================================================================
+
+#include <Urho3D/Urho3D.h>
+#include <Urho3D/Core/Context.h>
+#include <Urho3D/Graphics/Geometry.h>
+#include <Urho3D/Graphics/IndexBuffer.h>
+#include <Urho3D/Graphics/Model.h>
+#include <Urho3D/Graphics/VertexBuffer.h>
+#include <Urho3D/Math/MathDefs.h>
+#include <Urho3D/Scene/Node.h>
+#ifdef URHO3D_PHYSICS
+#include <Urho3D/Physics/RigidBody.h>
+#endif
+#include <SDL/SDL_log.h>
+
+#include "OceanHull.h"
+#include "Ocean.h"
+
+#include <Urho3D/DebugNew.h>
+
+//=============================================================================
+//=============================================================================
+#define GRAVITY                 9.81f
+#define DEFAULT_WATER_DENSITY   1025.0f     // kg/m^3, sea water
+
+#define HULL_BLOCK_SIZE         64          // triangles, in structure of arrays on the stack
+
+PODVector<float> OceanHull::wx_, OceanHull::wy_, OceanHull::wz_, OceanHull::height_, OceanHull::depth_;
+
+//=============================================================================
+//=============================================================================
+void OceanHull::RegisterObject(Context *context)
+{
+    context->RegisterFactory<OceanHull>();
+
+    URHO3D_ACCESSOR_ATTRIBUTE("Water Density", GetWaterDensity, SetWaterDensity, float, DEFAULT_WATER_DENSITY, AM_DEFAULT);
+}
+
+OceanHull::OceanHull(Context *context)
+    : Component(context)
+    , waterDensity_(DEFAULT_WATER_DENSITY)
+    , force_(Vector3::ZERO)
+    , torque_(Vector3::ZERO)
+{
+}
+
+OceanHull::~OceanHull()
+{
+    Ocean *ocean = ocean_;
+
+    if ( ocean )
+        ocean->RemoveHull( this );
+}
+
+void OceanHull::SetOcean(Ocean *ocean)
+{
+    Ocean *current = ocean_;
+
+    if ( current )
+        current->RemoveHull( this );
+
+    ocean_ = ocean;
+
+    if ( ocean )
+        ocean->AddHull( this );
+}
+
+bool OceanHull::SetHullModel(Model *model)
+{
+    PODVector<Vector3> vertices;
+    PODVector<unsigned> indices;
+
+    if ( !model )
+        return false;
+
+    // the model's buffers are shadowed when it's loaded, position is the first element
+    for ( unsigned g = 0; g < model->GetNumGeometries(); ++g )
+    {
+        Geometry *pGeometry = model->GetGeometry(g, 0);
+        VertexBuffer *pVbuffer = pGeometry ? pGeometry->GetVertexBuffer(0) : NULL;
+        IndexBuffer *pIbuffer = pGeometry ? pGeometry->GetIndexBuffer() : NULL;
+
+        if ( !pVbuffer || !pIbuffer || !pVbuffer->GetShadowData() || !pIbuffer->GetShadowData() || !(pVbuffer->GetElementMask() & MASK_POSITION) )
+        {
+            SDL_Log( "ocean hull: model geometry %u has no shadowed positions and indices\n", g );
+            return false;
+        }
+
+        const unsigned char *pVertexData = pVbuffer->GetShadowData();
+        const unsigned char *pIndexData = pIbuffer->GetShadowData();
+        unsigned vertexSize = pVbuffer->GetVertexSize();
+        unsigned base = vertices.Size();
+
+        for ( unsigned i = 0; i < pVbuffer->GetVertexCount(); ++i )
+            vertices.Push( *reinterpret_cast<const Vector3*>( pVertexData + i * vertexSize ) );
+
+        for ( unsigned i = pGeometry->GetIndexStart(); i < pGeometry->GetIndexStart() + pGeometry->GetIndexCount(); ++i )
+        {
+            if ( pIbuffer->GetIndexSize() == sizeof(unsigned short) )
+                indices.Push( base + reinterpret_cast<const unsigned short*>( pIndexData )[ i ] );
+            else
+                indices.Push( base + reinterpret_cast<const unsigned*>( pIndexData )[ i ] );
+        }
+    }
+
+    return SetHull( vertices, indices );
+}
+
+bool OceanHull::SetHull(const PODVector<Vector3> &vertices, const PODVector<unsigned> &indices)
+{
+    unsigned numTriangles = indices.Size() / 3;
+
+    lx_.Resize( vertices.Size() );
+    ly_.Resize( vertices.Size() );
+    lz_.Resize( vertices.Size() );
+    i0_.Resize( numTriangles );
+    i1_.Resize( numTriangles );
+    i2_.Resize( numTriangles );
+
+    for ( unsigned i = 0; i < vertices.Size(); ++i )
+    {
+        lx_[ i ] = vertices[ i ].x_;
+        ly_[ i ] = vertices[ i ].y_;
+        lz_[ i ] = vertices[ i ].z_;
+    }
+
+    // faces out when the signed volume is positive
+    float volume = 0.0f;
+
+    for ( unsigned t = 0; t < numTriangles; ++t )
+    {
+        if ( indices[ t * 3 ] >= vertices.Size() || indices[ t * 3 + 1 ] >= vertices.Size() || indices[ t * 3 + 2 ] >= vertices.Size() )
+        {
+            SDL_Log( "ocean hull: triangle %u indexes past the vertices\n", t );
+            i0_.Clear();
+            i1_.Clear();
+            i2_.Clear();
+            return false;
+        }
+
+        i0_[ t ] = indices[ t * 3 ];
+        i1_[ t ] = indices[ t * 3 + 1 ];
+        i2_[ t ] = indices[ t * 3 + 2 ];
+
+        const Vector3 &a = vertices[ i0_[ t ] ];
+        volume += a.DotProduct( ( vertices[ i1_[ t ] ] - a ).CrossProduct( vertices[ i2_[ t ] ] - a ) );
+    }
+
+    if ( volume < 0.0f )
+        i1_.Swap( i2_ );
+
+    return true;
+}
+
+void OceanHull::Update(const WaterSurface *surface)
+{
+    force_ = Vector3::ZERO;
+    torque_ = Vector3::ZERO;
+
+    unsigned numVertices = lx_.Size();
+    unsigned numTriangles = i0_.Size();
+
+    if ( !node_ || numTriangles == 0 )
+        return;
+
+    // the scratch grows to the largest hull
+    if ( wx_.Size() < numVertices )
+    {
+        wx_.Resize( numVertices );
+        wy_.Resize( numVertices );
+        wz_.Resize( numVertices );
+        height_.Resize( numVertices );
+        depth_.Resize( numVertices );
+    }
+
+    // vertices to world space, relative to the pivot for the torque - the rigid body's center of
+    // mass, where it applies the force, or the node's position without one
+    const Matrix3x4 &transform = node_->GetWorldTransform();
+    Vector3 center = transform.Translation();
+
+#ifdef URHO3D_PHYSICS
+    RigidBody *body = GetComponent<RigidBody>();
+
+    if ( body )
+        center = body->GetPosition() + body->GetRotation() * body->GetCenterOfMass();
+#endif
+
+    Vector3 offset = transform.Translation() - center;
+
+    for ( unsigned i = 0; i < numVertices; ++i )
+    {
+        wx_[ i ] = transform.m00_ * lx_[ i ] + transform.m01_ * ly_[ i ] + transform.m02_ * lz_[ i ] + offset.x_;
+        wy_[ i ] = transform.m10_ * lx_[ i ] + transform.m11_ * ly_[ i ] + transform.m12_ * lz_[ i ] + offset.y_;
+        wz_[ i ] = transform.m20_ * lx_[ i ] + transform.m21_ * ly_[ i ] + transform.m22_ * lz_[ i ] + offset.z_;
+    }
+
+    // the heights are looked up at world positions, in place
+    for ( unsigned i = 0; i < numVertices; ++i )
+    {
+        wx_[ i ] += center.x_;
+        wz_[ i ] += center.z_;
+    }
+
+    surface->GetWaterHeights( &wx_[0], &wz_[0], &height_[0], numVertices );
+
+    for ( unsigned i = 0; i < numVertices; ++i )
+    {
+        wx_[ i ] -= center.x_;
+        wz_[ i ] -= center.z_;
+        depth_[ i ] = height_[ i ] - center.y_ - wy_[ i ];
+    }
+
+    // a block of triangles at a time, in arrays on the stack that the compiler knows don't overlap
+    float pressureScale = waterDensity_ * GRAVITY;
+
+    for ( unsigned first = 0; first < numTriangles; first += HULL_BLOCK_SIZE )
+    {
+        unsigned count = Min( numTriangles - first, (unsigned)HULL_BLOCK_SIZE );
+        float ax[HULL_BLOCK_SIZE], ay[HULL_BLOCK_SIZE], az[HULL_BLOCK_SIZE], da[HULL_BLOCK_SIZE];
+        float bx[HULL_BLOCK_SIZE], by[HULL_BLOCK_SIZE], bz[HULL_BLOCK_SIZE], db[HULL_BLOCK_SIZE];
+        float cx[HULL_BLOCK_SIZE], cy[HULL_BLOCK_SIZE], cz[HULL_BLOCK_SIZE], dc[HULL_BLOCK_SIZE];
+        float fx[HULL_BLOCK_SIZE], fy[HULL_BLOCK_SIZE], fz[HULL_BLOCK_SIZE];
+        float tx[HULL_BLOCK_SIZE], ty[HULL_BLOCK_SIZE], tz[HULL_BLOCK_SIZE];
+        unsigned crossing[HULL_BLOCK_SIZE];
+        unsigned numCrossing = 0;
+
+        // gather the corners, triangles crossing the waterline are set aside to be clipped
+        for ( unsigned t = 0; t < count; ++t )
+        {
+            unsigned a = i0_[ first + t ], b = i1_[ first + t ], c = i2_[ first + t ];
+
+            ax[ t ] = wx_[ a ]; ay[ t ] = wy_[ a ]; az[ t ] = wz_[ a ]; da[ t ] = depth_[ a ];
+            bx[ t ] = wx_[ b ]; by[ t ] = wy_[ b ]; bz[ t ] = wz_[ b ]; db[ t ] = depth_[ b ];
+            cx[ t ] = wx_[ c ]; cy[ t ] = wy_[ c ]; cz[ t ] = wz_[ c ]; dc[ t ] = depth_[ c ];
+
+            crossing[ numCrossing ] = t;
+            numCrossing += ( Max( Max( da[ t ], db[ t ] ), dc[ t ] ) > 0.0f ) & ( Min( Min( da[ t ], db[ t ] ), dc[ t ] ) <= 0.0f );
+        }
+
+        // the pressure at the centroid's depth on the area, pushing in. Triangles not wholly submerged
+        // are masked to 0 rather than branched around
+        for ( unsigned t = 0; t < count; ++t )
+        {
+            float e1x = bx[ t ] - ax[ t ], e1y = by[ t ] - ay[ t ], e1z = bz[ t ] - az[ t ];
+            float e2x = cx[ t ] - ax[ t ], e2y = cy[ t ] - ay[ t ], e2z = cz[ t ] - az[ t ];
+
+            // twice the area along the outward normal
+            float nx = e1y * e2z - e1z * e2y;
+            float ny = e1z * e2x - e1x * e2z;
+            float nz = e1x * e2y - e1y * e2x;
+
+            float submerged = Min( Min( da[ t ], db[ t ] ), dc[ t ] ) > 0.0f ? 1.0f : 0.0f;
+            float p = -pressureScale * ( da[ t ] + db[ t ] + dc[ t ] ) * ( 1.0f / 6.0f ) * submerged;
+
+            float rx = ( ax[ t ] + bx[ t ] + cx[ t ] ) * ( 1.0f / 3.0f );
+            float ry = ( ay[ t ] + by[ t ] + cy[ t ] ) * ( 1.0f / 3.0f );
+            float rz = ( az[ t ] + bz[ t ] + cz[ t ] ) * ( 1.0f / 3.0f );
+
+            fx[ t ] = p * nx;
+            fy[ t ] = p * ny;
+            fz[ t ] = p * nz;
+            tx[ t ] = ry * fz[ t ] - rz * fy[ t ];
+            ty[ t ] = rz * fx[ t ] - rx * fz[ t ];
+            tz[ t ] = rx * fy[ t ] - ry * fx[ t ];
+        }
+
+        float sum[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+
+        for ( unsigned t = 0; t < count; ++t )
+        {
+            sum[0] += fx[ t ];
+            sum[1] += fy[ t ];
+            sum[2] += fz[ t ];
+            sum[3] += tx[ t ];
+            sum[4] += ty[ t ];
+            sum[5] += tz[ t ];
+        }
+
+        force_ += Vector3( sum[0], sum[1], sum[2] );
+        torque_ += Vector3( sum[3], sum[4], sum[5] );
+
+        for ( unsigned i = 0; i < numCrossing; ++i )
+        {
+            unsigned t = crossing[ i ];
+            Vector3 corner[3] = { Vector3( ax[ t ], ay[ t ], az[ t ] ), Vector3( bx[ t ], by[ t ], bz[ t ] ), Vector3( cx[ t ], cy[ t ], cz[ t ] ) };
+            float depth[3] = { da[ t ], db[ t ], dc[ t ] };
+
+            AddCrossing( corner, depth, pressureScale );
+        }
+    }
+
+#ifdef URHO3D_PHYSICS
+    if ( body )
+    {
+        body->ApplyForce( force_ );
+        body->ApplyTorque( torque_ );
+    }
+#endif
+}
+
+void OceanHull::AddCrossing(const Vector3 *corner, const float *depth, float pressureScale)
+{
+    // the submerged part is a triangle or a quad, fanned from its first corner
+    Vector3 clipped[4];
+    float clippedDepth[4];
+    unsigned numClipped = 0;
+
+    for ( unsigned j = 0; j < 3; ++j )
+    {
+        unsigned k = ( j + 1 ) % 3;
+
+        if ( depth[ j ] > 0.0f )
+        {
+            clipped[ numClipped ] = corner[ j ];
+            clippedDepth[ numClipped++ ] = depth[ j ];
+        }
+
+        if ( ( depth[ j ] > 0.0f ) != ( depth[ k ] > 0.0f ) )
+        {
+            clipped[ numClipped ] = corner[ j ].Lerp( corner[ k ], depth[ j ] / ( depth[ j ] - depth[ k ] ) );
+            clippedDepth[ numClipped++ ] = 0.0f;
+        }
+    }
+
+    for ( unsigned j = 1; j + 1 < numClipped; ++j )
+        AddSubmerged( clipped[0], clipped[ j ], clipped[ j + 1 ], clippedDepth[0], clippedDepth[ j ], clippedDepth[ j + 1 ], pressureScale );
+}
+
+void OceanHull::AddSubmerged(const Vector3 &a, const Vector3 &b, const Vector3 &c, float da, float db, float dc, float pressureScale)
+{
+    Vector3 normal = ( b - a ).CrossProduct( c - a );
+    Vector3 force = normal * ( -pressureScale * ( da + db + dc ) * ( 1.0f / 6.0f ) );
+
+    force_ += force;
+    torque_ += ( ( a + b + c ) * ( 1.0f / 3.0f ) ).CrossProduct( force );
+}
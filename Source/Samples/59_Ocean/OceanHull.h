@@ -0,0 +1,110 @@
+//=============================================================================
+// Copyright (c) 2016 Lumak
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//=============================================================================
+
+#pragma once
+
+#include <Urho3D/Scene/Component.h>
+#include <Urho3D/Container/Vector.h>
+#include <Urho3D/Math/Vector3.h>
+
+namespace Urho3D
+{
+class Model;
+}
+
+using namespace Urho3D;
+
+class Ocean;
+
+//=============================================================================
+// What a hull floats on, water heights at world x, z. The Ocean component's
+// are of the surface it wrote this frame
+//=============================================================================
+class WaterSurface
+{
+public:
+    virtual ~WaterSurface() {}
+
+    virtual void GetWaterHeights(const float *x, const float *z, float *heights, unsigned count) const = 0;
+};
+
+//=============================================================================
+// Buoyancy of a closed, low-poly hull. Each frame the ocean updates its hulls
+// against the surface it wrote for the renderer: the hull's triangles are
+// clipped at the water's height and the hydrostatic pressure on what's under
+// integrated into a force and a torque. With a RigidBody on the node they're
+// applied to it, the torque about its center of mass; without one the torque
+// is about the node's position.
+//
+// The triangles are gathered in blocks as structure of arrays. Wholly
+// submerged triangles go through one branch-free loop the compiler can
+// vectorize, and only those crossing the waterline are clipped one at a time.
+//=============================================================================
+class OceanHull : public Component
+{
+    URHO3D_OBJECT(OceanHull, Component);
+
+public:
+    static void RegisterObject(Context *context);
+
+    OceanHull(Context *context);
+    virtual ~OceanHull();
+
+    void SetOcean(Ocean *ocean);
+    Ocean* GetOcean() const                     { return ocean_; }
+
+    // the hull in the node's space, from the model's first LOD or as vertices and triangle
+    // list indices. Either winding works, it's made to face out
+    bool SetHullModel(Model *model);
+    bool SetHull(const PODVector<Vector3> &vertices, const PODVector<unsigned> &indices);
+    unsigned GetNumTriangles() const            { return i0_.Size(); }
+
+    void SetWaterDensity(float density)         { waterDensity_ = density; }
+    float GetWaterDensity() const               { return waterDensity_; }
+
+    // from the last update, in world space, the torque about the rigid body's center of mass or the node's position
+    const Vector3& GetForce() const             { return force_; }
+    const Vector3& GetTorque() const            { return torque_; }
+
+    // called by the ocean once its surface is written, or with any other water, e.g. a fixed surface
+    void Update(const WaterSurface *surface);
+
+protected:
+    void AddCrossing(const Vector3 *corner, const float *depth, float pressureScale);
+    void AddSubmerged(const Vector3 &a, const Vector3 &b, const Vector3 &c, float da, float db, float dc, float pressureScale);
+
+protected:
+    WeakPtr<Ocean>      ocean_;
+    float               waterDensity_;
+
+    // hull vertices in the node's space, and triangles as indices into them
+    PODVector<float>    lx_, ly_, lz_;
+    PODVector<unsigned> i0_, i1_, i2_;
+
+    // per update scratch, shared as hulls are only updated by their ocean on the main thread - the
+    // vertices relative to the pivot in world space and their depth under the water
+    static PODVector<float> wx_, wy_, wz_, height_, depth_;
+
+    Vector3             force_;
+    Vector3             torque_;
+};
@@ -0,0 +1,110 @@
+//=============================================================================
+// Copyright (c) 2016 Lumak
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//=============================================================================
+
+#pragma once
+
+#include <math.h>
+
+//=============================================================================
+// Deterministic math for the ocean's spectrum and its evolution. libm's sin,
+// cos, exp and log differ between platforms in the last bit, so these use
+// only IEEE basic operations, sqrt, floor, frexp and ldexp, evaluated in a
+// fixed order - with the sources built without FP contraction, the same
+// OceanState gives bit-identical waves on every client.
+//=============================================================================
+
+// integer hash (lowbias32), the ocean's random numbers are hashed from the seed and grid coordinates
+inline unsigned hashUInt(unsigned x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+// uniform in [0, 1), the i'th number of a stream
+inline double hashUniform(unsigned stream, unsigned i)
+{
+    return ( hashUInt( stream + i ) >> 8 ) * ( 1.0 / 16777216.0 );
+}
+
+// sine and cosine of an angle in turns
+inline void detSinCos(double turns, float &s, float &c)
+{
+    // the nearest quarter turn, the remainder is within +-pi/4
+    double q = floor( turns * 4.0 + 0.5 );
+    double x = ( turns * 4.0 - q ) * 1.5707963267948966;
+    double x2 = x * x;
+    int quadrant = (int)( q - 4.0 * floor( q * 0.25 ) );
+
+    double sn = x * ( 1.0 + x2 * ( -1.0/6.0 + x2 * ( 1.0/120.0 + x2 * ( -1.0/5040.0 + x2 * ( 1.0/362880.0 + x2 * ( -1.0/39916800.0 ) ) ) ) ) );
+    double cs = 1.0 + x2 * ( -1.0/2.0 + x2 * ( 1.0/24.0 + x2 * ( -1.0/720.0 + x2 * ( 1.0/40320.0 + x2 * ( -1.0/3628800.0 + x2 * ( 1.0/479001600.0 ) ) ) ) ) );
+
+    switch ( quadrant )
+    {
+    case 0: s = (float) sn; c = (float) cs; break;
+    case 1: s = (float) cs; c = (float)-sn; break;
+    case 2: s = (float)-sn; c = (float)-cs; break;
+    default: s = (float)-cs; c = (float) sn; break;
+    }
+}
+
+inline double detExp(double x)
+{
+    if ( x < -708.0 )
+        return 0.0;
+
+    x = x < 708.0 ? x : 708.0;
+
+    // 2^n * e^r, |r| <= ln2/2
+    double n = floor( x * 1.4426950408889634 + 0.5 );
+    double r = x - n * 0.69314718055994531;
+
+    double p = 1.0 + r * ( 1.0 + r * ( 1.0/2.0 + r * ( 1.0/6.0 + r * ( 1.0/24.0 + r * ( 1.0/120.0 + r * ( 1.0/720.0 + r * ( 1.0/5040.0 +
+               r * ( 1.0/40320.0 + r * ( 1.0/362880.0 + r * ( 1.0/3628800.0 + r * ( 1.0/39916800.0 + r * ( 1.0/479001600.0 ) ) ) ) ) ) ) ) ) ) ) );
+
+    return ldexp( p, (int)n );
+}
+
+// x > 0
+inline double detLog(double x)
+{
+    // m * 2^e with m in [sqrt(1/2), sqrt(2)), then log(m) = 2 atanh(s)
+    int e;
+    double m = frexp( x, &e );
+
+    if ( m < 0.70710678118654752 )
+    {
+        m *= 2.0;
+        --e;
+    }
+
+    double s = ( m - 1.0 ) / ( m + 1.0 );
+    double s2 = s * s;
+    double p = 1.0 + s2 * ( 1.0/3.0 + s2 * ( 1.0/5.0 + s2 * ( 1.0/7.0 + s2 * ( 1.0/9.0 + s2 * ( 1.0/11.0 + s2 * ( 1.0/13.0 +
+               s2 * ( 1.0/15.0 + s2 * ( 1.0/17.0 + s2 * ( 1.0/19.0 + s2 * ( 1.0/21.0 ) ) ) ) ) ) ) ) ) );
+
+    return 2.0 * s * p + e * 0.69314718055994531;
+}
@@ -0,0 +1,126 @@
+//=============================================================================
+// Copyright (c) 2016 Lumak
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//=============================================================================
+
+#include <Urho3D/Urho3D.h>
+#include <Urho3D/Math/MathDefs.h>
+
+#include <string.h>
+
+#include "OceanProfiler.h"
+
+#include <Urho3D/DebugNew.h>
+
+//=============================================================================
+//=============================================================================
+static const char* stageNames[ OceanProfiler::Stage_Max ] =
+{
+    "evolve", "pack", "fft rows", "fft columns", "vertices", "fd normals", "detail map", "publish", "vertex buffer", "hulls", "display error"
+};
+
+OceanProfiler::OceanProfiler()
+    : pendingMask_(0)
+{
+    memset( history_, 0, sizeof(history_) );
+    memset( pendingUSec_, 0, sizeof(pendingUSec_) );
+}
+
+void OceanProfiler::Accumulate(StageType stage, long long usec)
+{
+    pendingUSec_[ stage ] += usec;
+    pendingMask_ |= 1 << stage;
+}
+
+void OceanProfiler::CommitStep()
+{
+    MutexLock lock(mutexHistoryLock_);
+
+    // only the stages that ran, e.g. fd normals are skipped with fft normals
+    for ( int i = 0; i < Stage_Max; ++i )
+    {
+        if ( pendingMask_ & (1 << i) )
+            Push( (StageType)i, pendingUSec_[ i ] );
+    }
+
+    DiscardStep();
+}
+
+void OceanProfiler::DiscardStep()
+{
+    memset( pendingUSec_, 0, sizeof(pendingUSec_) );
+    pendingMask_ = 0;
+}
+
+void OceanProfiler::Record(StageType stage, long long usec)
+{
+    MutexLock lock(mutexHistoryLock_);
+    Push( stage, usec );
+}
+
+void OceanProfiler::Reset()
+{
+    MutexLock lock(mutexHistoryLock_);
+    memset( history_, 0, sizeof(history_) );
+}
+
+void OceanProfiler::Push(StageType stage, long long usec)
+{
+    History &history = history_[ stage ];
+
+    history.samplesMs[ history.next ] = usec / 1000.0f;
+    history.next = ( history.next + 1 ) % HistorySize;
+    history.count = Min( history.count + 1, (unsigned)HistorySize );
+}
+
+bool OceanProfiler::GetStats(StageType stage, StageStats &stats)
+{
+    MutexLock lock(mutexHistoryLock_);
+    const History &history = history_[ stage ];
+
+    if ( history.count == 0 )
+        return false;
+
+    stats.lastMs = history.samplesMs[ ( history.next + HistorySize - 1 ) % HistorySize ];
+    stats.minMs = M_INFINITY;
+    stats.maxMs = -M_INFINITY;
+    stats.numSamples = history.count;
+
+    // the ring is filled from 0, so the first count samples are the valid ones
+    float sumMs = 0.0f;
+
+    for ( unsigned i = 0; i < history.count; ++i )
+    {
+        float ms = history.samplesMs[ i ];
+        sumMs += ms;
+        stats.minMs = Min( stats.minMs, ms );
+        stats.maxMs = Max( stats.maxMs, ms );
+    }
+
+    stats.avgMs = sumMs / history.count;
+
+    return true;
+}
+
+const char* OceanProfiler::GetStageName(StageType stage)
+{
+    return stage < Stage_Max ? stageNames[ stage ] : "";
+}
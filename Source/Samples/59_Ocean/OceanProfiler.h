@@ -0,0 +1,87 @@
+//=============================================================================
+// Copyright (c) 2016 Lumak
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//=============================================================================
+
+#pragma once
+
+#include <Urho3D/Core/Mutex.h>
+
+using namespace Urho3D;
+
+//=============================================================================
+// Rolling timings of the ocean's stages. The worker accumulates a step's
+// stages without locking and commits them once the step is done, so a step
+// spread over several slices is one sample; other threads record directly.
+// URHO3D_PROFILE only sees the main thread, this covers the worker as well.
+// Stage_DisplayError isn't a stage: it's how far the display time fell
+// outside the frames it was interpolated between, positive when they're late.
+//=============================================================================
+class OceanProfiler
+{
+public:
+    // the first six follow cOcean's step stages
+    enum StageType
+    {
+        Stage_Evolve, Stage_Pack, Stage_Rows, Stage_Columns, Stage_Vertices, Stage_Normals,
+        Stage_DetailMap, Stage_Publish, Stage_VertexBuffer, Stage_Hulls, Stage_DisplayError, Stage_Max
+    };
+    enum { HistorySize = 120 };
+
+    struct StageStats
+    {
+        float    lastMs;
+        float    avgMs;
+        float    minMs;
+        float    maxMs;
+        unsigned numSamples;
+    };
+
+    OceanProfiler();
+
+    // the step in progress, the worker's own
+    void Accumulate(StageType stage, long long usec);
+    void CommitStep();
+    void DiscardStep();
+
+    void Record(StageType stage, long long usec);
+    void Reset();
+
+    // over the last HistorySize samples, false if the stage hasn't run
+    bool GetStats(StageType stage, StageStats &stats);
+    static const char* GetStageName(StageType stage);
+
+protected:
+    void Push(StageType stage, long long usec);
+
+protected:
+    struct History
+    {
+        float    samplesMs[HistorySize];
+        unsigned next;
+        unsigned count;
+    };
+
+    History     history_[Stage_Max];
+    Mutex       mutexHistoryLock_;
+    long long   pendingUSec_[Stage_Max];
+    unsigned    pendingMask_;
+};
@@ -0,0 +1,420 @@
+//=============================================================================
+// Copyright (c) 2016 Lumak
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//=============================================================================
+
+#include <Urho3D/Urho3D.h>
+#include <Urho3D/Math/MathDefs.h>
+#include <SDL/SDL_log.h>
+
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "Ocean.h"
+#include "OceanRecording.h"
+
+#include <Urho3D/DebugNew.h>
+
+//=============================================================================
+//=============================================================================
+#define RECORDING_ID            "OREC"
+#define RECORDING_VERSION       2           // 1 had no jacobian
+#define RECORDING_HEADER_BYTES  OceanMappedFile::ViewAlignment
+#define CHUNK_ID                "OCHK"
+#define CHUNK_HEADER_BYTES      64
+#define CHUNK_TARGET_BYTES      (4 * 1024 * 1024)
+#define FRAME_HEADER_BYTES      16
+#define FRAME_ALIGNMENT         64
+
+struct RecordingHeader
+{
+    char     id[4];
+    unsigned version;
+    int      N;
+    float    length;
+    unsigned frameFloats;
+    unsigned frameStride;
+    unsigned framesPerChunk;
+    unsigned chunkBytes;
+    unsigned numChunks;
+};
+
+struct ChunkHeader
+{
+    char     id[4];
+    unsigned numFrames;
+};
+
+struct FrameHeader
+{
+    float    time;
+    unsigned index;
+};
+
+//=============================================================================
+//=============================================================================
+OceanMappedFile::OceanMappedFile()
+    : handle_(NULL)
+    , fd_(-1)
+    , write_(false)
+{
+}
+
+OceanMappedFile::~OceanMappedFile()
+{
+    Close();
+}
+
+bool OceanMappedFile::Open(const String &fileName, bool write)
+{
+    Close();
+    write_ = write;
+
+#ifdef _WIN32
+    HANDLE file = CreateFileW( WString( fileName ).CString(), write ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ,
+                               FILE_SHARE_READ, NULL, write ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+
+    if ( file == INVALID_HANDLE_VALUE )
+        return false;
+
+    handle_ = file;
+#else
+    fd_ = open( fileName.CString(), write ? O_RDWR | O_CREAT | O_TRUNC : O_RDONLY, 0644 );
+
+    if ( fd_ < 0 )
+        return false;
+#endif
+
+    return true;
+}
+
+void OceanMappedFile::Close()
+{
+#ifdef _WIN32
+    if ( handle_ )
+        CloseHandle( (HANDLE)handle_ );
+#else
+    if ( fd_ >= 0 )
+        close( fd_ );
+#endif
+
+    handle_ = NULL;
+    fd_ = -1;
+}
+
+bool OceanMappedFile::IsOpen() const
+{
+    return handle_ != NULL || fd_ >= 0;
+}
+
+bool OceanMappedFile::SetSize(unsigned long long size)
+{
+#ifdef _WIN32
+    LARGE_INTEGER distance;
+    distance.QuadPart = (LONGLONG)size;
+
+    return handle_ && SetFilePointerEx( (HANDLE)handle_, distance, NULL, FILE_BEGIN ) && SetEndOfFile( (HANDLE)handle_ );
+#else
+    return fd_ >= 0 && ftruncate( fd_, (off_t)size ) == 0;
+#endif
+}
+
+unsigned long long OceanMappedFile::GetSize() const
+{
+#ifdef _WIN32
+    LARGE_INTEGER size;
+
+    return handle_ && GetFileSizeEx( (HANDLE)handle_, &size ) ? (unsigned long long)size.QuadPart : 0;
+#else
+    struct stat info;
+
+    return fd_ >= 0 && fstat( fd_, &info ) == 0 ? (unsigned long long)info.st_size : 0;
+#endif
+}
+
+unsigned char* OceanMappedFile::MapView(unsigned long long offset, unsigned long long size)
+{
+    if ( !IsOpen() || size == 0 || offset % ViewAlignment || size > (size_t)-1 )
+        return NULL;
+
+#ifdef _WIN32
+    // the view keeps the mapping alive
+    unsigned long long end = offset + size;
+    HANDLE mapping = CreateFileMappingW( (HANDLE)handle_, NULL, write_ ? PAGE_READWRITE : PAGE_READONLY,
+                                         (DWORD)(end >> 32), (DWORD)end, NULL );
+
+    if ( !mapping )
+        return NULL;
+
+    void *view = MapViewOfFile( mapping, write_ ? FILE_MAP_WRITE : FILE_MAP_READ, (DWORD)(offset >> 32), (DWORD)offset, (SIZE_T)size );
+    CloseHandle( mapping );
+
+    return (unsigned char*)view;
+#else
+    void *view = mmap( NULL, (size_t)size, write_ ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd_, (off_t)offset );
+
+    return view != MAP_FAILED ? (unsigned char*)view : NULL;
+#endif
+}
+
+void OceanMappedFile::UnmapView(unsigned char *view, unsigned long long size)
+{
+    if ( !view )
+        return;
+
+#ifdef _WIN32
+    (void)size;
+    UnmapViewOfFile( view );
+#else
+    munmap( view, (size_t)size );
+#endif
+}
+
+//=============================================================================
+//=============================================================================
+OceanRecorder::OceanRecorder()
+    : header_(NULL)
+    , chunk_(NULL)
+    , frameFloats_(0)
+    , frameStride_(0)
+    , framesPerChunk_(0)
+    , chunkBytes_(0)
+    , numChunks_(0)
+    , chunkFrames_(0)
+    , numFrames_(0)
+    , lastTime_(0.0f)
+{
+}
+
+OceanRecorder::~OceanRecorder()
+{
+    Close();
+}
+
+bool OceanRecorder::Open(const String &fileName, int N, float length)
+{
+    Close();
+
+    if ( !file_.Open( fileName, true ) || !file_.SetSize( RECORDING_HEADER_BYTES ) ||
+         (header_ = file_.MapView( 0, RECORDING_HEADER_BYTES )) == NULL )
+    {
+        SDL_Log( "unable to create ocean recording %s\n", fileName.CString() );
+        file_.Close();
+        return false;
+    }
+
+    // chunks are a whole number of views so each can be mapped on its own
+    frameFloats_ = (N + 1) * (N + 1) * OCEAN_FRAME_FLOATS;
+    frameStride_ = ( FRAME_HEADER_BYTES + frameFloats_ * sizeof(float) + FRAME_ALIGNMENT - 1 ) & ~(FRAME_ALIGNMENT - 1);
+    framesPerChunk_ = Max( ( CHUNK_TARGET_BYTES - CHUNK_HEADER_BYTES ) / frameStride_, 1U );
+    chunkBytes_ = ( CHUNK_HEADER_BYTES + framesPerChunk_ * frameStride_ + RECORDING_HEADER_BYTES - 1 ) & ~(RECORDING_HEADER_BYTES - 1);
+    numChunks_ = 0;
+    chunkFrames_ = 0;
+    numFrames_ = 0;
+    lastTime_ = -M_INFINITY;
+
+    RecordingHeader *header = (RecordingHeader*)header_;
+    memcpy( header->id, RECORDING_ID, 4 );
+    header->version        = RECORDING_VERSION;
+    header->N              = N;
+    header->length         = length;
+    header->frameFloats    = frameFloats_;
+    header->frameStride    = frameStride_;
+    header->framesPerChunk = framesPerChunk_;
+    header->chunkBytes     = chunkBytes_;
+    header->numChunks      = 0;
+
+    return true;
+}
+
+void OceanRecorder::Close()
+{
+    file_.UnmapView( chunk_, chunkBytes_ );
+    file_.UnmapView( header_, RECORDING_HEADER_BYTES );
+    file_.Close();
+
+    chunk_ = NULL;
+    header_ = NULL;
+}
+
+bool OceanRecorder::Append(float time, const float *data)
+{
+    if ( !header_ || time <= lastTime_ )
+        return false;
+
+    if ( !chunk_ || chunkFrames_ == framesPerChunk_ )
+    {
+        if ( !BeginChunk() )
+        {
+            SDL_Log( "ocean recording stopped after %u frames, unable to grow the file\n", numFrames_ );
+            Close();
+            return false;
+        }
+    }
+
+    unsigned char *slot = chunk_ + CHUNK_HEADER_BYTES + chunkFrames_ * frameStride_;
+    FrameHeader *frame = (FrameHeader*)slot;
+    frame->time = time;
+    frame->index = numFrames_;
+    memcpy( slot + FRAME_HEADER_BYTES, data, frameFloats_ * sizeof(float) );
+
+    // counted once the frame is in
+    ((ChunkHeader*)chunk_)->numFrames = ++chunkFrames_;
+    ++numFrames_;
+    lastTime_ = time;
+
+    return true;
+}
+
+bool OceanRecorder::BeginChunk()
+{
+    file_.UnmapView( chunk_, chunkBytes_ );
+    chunk_ = NULL;
+
+    unsigned long long offset = RECORDING_HEADER_BYTES + (unsigned long long)numChunks_ * chunkBytes_;
+
+    if ( !file_.SetSize( offset + chunkBytes_ ) || (chunk_ = file_.MapView( offset, chunkBytes_ )) == NULL )
+        return false;
+
+    ChunkHeader *chunk = (ChunkHeader*)chunk_;
+    memcpy( chunk->id, CHUNK_ID, 4 );
+    chunk->numFrames = 0;
+    chunkFrames_ = 0;
+
+    ((RecordingHeader*)header_)->numChunks = ++numChunks_;
+
+    return true;
+}
+
+//=============================================================================
+//=============================================================================
+OceanRecording::OceanRecording()
+    : base_(NULL)
+    , size_(0)
+    , N_(0)
+    , length_(0.0f)
+    , frameStride_(0)
+    , framesPerChunk_(0)
+    , chunkBytes_(0)
+    , numFrames_(0)
+{
+}
+
+OceanRecording::~OceanRecording()
+{
+    Close();
+}
+
+bool OceanRecording::Open(const String &fileName)
+{
+    Close();
+
+    if ( !file_.Open( fileName, false ) )
+        return false;
+
+    size_ = file_.GetSize();
+    base_ = size_ >= RECORDING_HEADER_BYTES ? file_.MapView( 0, size_ ) : NULL;
+
+    const RecordingHeader *header = (const RecordingHeader*)base_;
+
+    if ( !header || memcmp( header->id, RECORDING_ID, 4 ) || header->version != RECORDING_VERSION || header->N <= 0 ||
+         header->frameFloats != (unsigned)((header->N + 1) * (header->N + 1) * OCEAN_FRAME_FLOATS) ||
+         header->frameStride < FRAME_HEADER_BYTES + header->frameFloats * sizeof(float) || header->framesPerChunk == 0 ||
+         header->chunkBytes < CHUNK_HEADER_BYTES + (unsigned long long)header->framesPerChunk * header->frameStride ||
+         RECORDING_HEADER_BYTES + (unsigned long long)header->numChunks * header->chunkBytes > size_ )
+    {
+        SDL_Log( "%s is not an ocean recording\n", fileName.CString() );
+        Close();
+        return false;
+    }
+
+    N_ = header->N;
+    length_ = header->length;
+    frameStride_ = header->frameStride;
+    framesPerChunk_ = header->framesPerChunk;
+    chunkBytes_ = header->chunkBytes;
+
+    // only the last chunk can be partly filled
+    numFrames_ = 0;
+
+    if ( header->numChunks > 0 )
+    {
+        const ChunkHeader *last = (const ChunkHeader*)( base_ + RECORDING_HEADER_BYTES + (unsigned long long)(header->numChunks - 1) * chunkBytes_ );
+        numFrames_ = (header->numChunks - 1) * framesPerChunk_ + Min( last->numFrames, framesPerChunk_ );
+    }
+
+    return true;
+}
+
+void OceanRecording::Close()
+{
+    file_.UnmapView( base_, size_ );
+    file_.Close();
+
+    base_ = NULL;
+    size_ = 0;
+    numFrames_ = 0;
+}
+
+const unsigned char* OceanRecording::GetSlot(unsigned index) const
+{
+    unsigned chunk = index / framesPerChunk_;
+    unsigned slot = index % framesPerChunk_;
+
+    return base_ + RECORDING_HEADER_BYTES + (unsigned long long)chunk * chunkBytes_ + CHUNK_HEADER_BYTES + (unsigned long long)slot * frameStride_;
+}
+
+float OceanRecording::GetFrameTime(unsigned index) const
+{
+    return index < numFrames_ ? ((const FrameHeader*)GetSlot( index ))->time : 0.0f;
+}
+
+const float* OceanRecording::GetFrame(unsigned index) const
+{
+    return index < numFrames_ ? (const float*)( GetSlot( index ) + FRAME_HEADER_BYTES ) : NULL;
+}
+
+unsigned OceanRecording::FindFrame(float time) const
+{
+    unsigned lo = 0;
+    unsigned hi = numFrames_;
+
+    // first frame after time, less one
+    while ( lo < hi )
+    {
+        unsigned mid = ( lo + hi ) / 2;
+
+        if ( GetFrameTime( mid ) <= time )
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo > 0 ? lo - 1 : 0;
+}
@@ -0,0 +1,134 @@
+//=============================================================================
+// Copyright (c) 2016 Lumak
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//=============================================================================
+
+#pragma once
+
+#include <Urho3D/Container/Str.h>
+
+using namespace Urho3D;
+
+//=============================================================================
+// A file mapped into memory in views, read only or read/write. Views start at
+// multiples of ViewAlignment, the coarsest of the platforms' granularities.
+//=============================================================================
+class OceanMappedFile
+{
+public:
+    enum { ViewAlignment = 65536 };
+
+    OceanMappedFile();
+    ~OceanMappedFile();
+
+    // writing creates or truncates the file
+    bool Open(const String &fileName, bool write);
+    void Close();
+    bool IsOpen() const;
+
+    bool SetSize(unsigned long long size);
+    unsigned long long GetSize() const;
+
+    unsigned char* MapView(unsigned long long offset, unsigned long long size);
+    void UnmapView(unsigned char *view, unsigned long long size);
+
+protected:
+    void    *handle_;   // HANDLE on Windows
+    int     fd_;
+    bool    write_;
+};
+
+//=============================================================================
+// Simulated frames recorded as they're published, for reproducing what the
+// ocean did. The file is a header followed by fixed size chunks of fixed size
+// frames: a time stamp, then the position, normal and jacobian of each vertex
+// in the packFrame() layout. It grows a chunk at a time and the current chunk is
+// written through its mapping, so everything appended so far is readable even
+// if the recording is never closed.
+//=============================================================================
+class OceanRecorder
+{
+public:
+    OceanRecorder();
+    ~OceanRecorder();
+
+    bool Open(const String &fileName, int N, float length);
+    void Close();
+    bool IsOpen() const                 { return header_ != NULL; }
+
+    // frames have to be in time order, one earlier than the last is skipped
+    bool Append(float time, const float *data);
+    unsigned GetNumFrames() const       { return numFrames_; }
+
+protected:
+    bool BeginChunk();
+
+protected:
+    OceanMappedFile     file_;
+    unsigned char       *header_;
+    unsigned char       *chunk_;
+    unsigned            frameFloats_;
+    unsigned            frameStride_;
+    unsigned            framesPerChunk_;
+    unsigned            chunkBytes_;
+    unsigned            numChunks_;
+    unsigned            chunkFrames_;
+    unsigned            numFrames_;
+    float               lastTime_;
+};
+
+//=============================================================================
+// A recording mapped read only. Frames are read in place, with no copies, and
+// found by time with a binary search over their fixed size slots.
+//=============================================================================
+class OceanRecording
+{
+public:
+    OceanRecording();
+    ~OceanRecording();
+
+    bool Open(const String &fileName);
+    void Close();
+    bool IsOpen() const                 { return base_ != NULL; }
+
+    int GetGridSize() const             { return N_; }
+    float GetPatchLength() const        { return length_; }
+    unsigned GetNumFrames() const       { return numFrames_; }
+    float GetFrameTime(unsigned index) const;
+    const float* GetFrame(unsigned index) const;
+
+    // the last frame at or before time, 0 if time is before the first
+    unsigned FindFrame(float time) const;
+
+protected:
+    const unsigned char* GetSlot(unsigned index) const;
+
+protected:
+    OceanMappedFile     file_;
+    unsigned char       *base_;
+    unsigned long long  size_;
+    int                 N_;
+    float               length_;
+    unsigned            frameStride_;
+    unsigned            framesPerChunk_;
+    unsigned            chunkBytes_;
+    unsigned            numFrames_;
+};
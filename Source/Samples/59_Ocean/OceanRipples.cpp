@@ -0,0 +1,454 @@
+//=============================================================================
+// Copyright (c) 2016 Lumak
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//=============================================================================
+
+#include <Urho3D/Urho3D.h>
+#include <Urho3D/Math/MathDefs.h>
+
+#include "Ocean.h"
+#include "OceanRipples.h"
+
+#include <Urho3D/DebugNew.h>
+
+//=============================================================================
+//=============================================================================
+#define RIPPLE_STEP_MS          33
+#define RIPPLE_STEP_SEC         (RIPPLE_STEP_MS / 1000.0f)
+#define RIPPLE_WAVE_SPEED       8.0f        // m/s
+#define RIPPLE_MAX_COURANT      0.5f        // c dt / dx of a substep, stable below 1/sqrt(2)
+#define RIPPLE_DAMPING          0.98f       // of the vertical velocity, per step
+#define RIPPLE_RELAX            0.995f      // of the height, per step, so the water left raised settles
+#define RIPPLE_SPREAD_HEIGHT    0.02f       // a neighbor tile is added when an edge is higher than this
+#define RIPPLE_CALM_HEIGHT      0.01f       // a tile is freed when it's been lower than this
+#define RIPPLE_CALM_STEPS       30          // for this many steps
+
+//=============================================================================
+//=============================================================================
+OceanRipples::OceanRipples()
+    : N_(0)
+    , spacing_(1.0f)
+    , tilesPerSide_(0)
+    , current_(0)
+    , idle_(false)
+    , threadProcess_(NULL)
+    , threaded_(false)
+{
+}
+
+OceanRipples::~OceanRipples()
+{
+    if ( threadProcess_ )
+    {
+        delete threadProcess_;
+        threadProcess_ = NULL;
+    }
+}
+
+void OceanRipples::Init(int N, float length)
+{
+    // the worker is restarted by the next disturbance
+    if ( threadProcess_ )
+    {
+        delete threadProcess_;
+        threadProcess_ = NULL;
+    }
+
+    N_ = N;
+    spacing_ = length / N;
+    tilesPerSide_ = ( N + TileCells ) / TileCells;
+
+    tiles_.Clear();
+    freeTiles_.Clear();
+    activeTiles_.Clear();
+    tileGrid_.Resize( tilesPerSide_ * tilesPerSide_ );
+    current_ = 0;
+
+    for ( unsigned i = 0; i < tileGrid_.Size(); ++i )
+        tileGrid_[i] = -1;
+
+    {
+        MutexLock lock(mutexDisturbanceLock_);
+        disturbances_.Clear();
+        idle_ = false;
+    }
+
+    MutexLock lock(mutexPublishLock_);
+    published_.Clear();
+    publishedTiles_.Clear();
+    publishedGrid_.Resize( tileGrid_.Size() );
+
+    for ( unsigned i = 0; i < publishedGrid_.Size(); ++i )
+        publishedGrid_[i] = -1;
+}
+
+void OceanRipples::AddDisturbance(float x, float z, float radius, float strength)
+{
+    if ( N_ == 0 )
+        return;
+
+    bool restart = false;
+
+    {
+        MutexLock lock(mutexDisturbanceLock_);
+        Disturbance disturbance = { x, z, radius, strength };
+        disturbances_.Push( disturbance );
+        restart = idle_;
+        idle_ = false;
+    }
+
+    // a stopped worker has already been asked to exit, it's replaced
+    if ( restart && threadProcess_ )
+    {
+        delete threadProcess_;
+        threadProcess_ = NULL;
+    }
+
+    if ( !threadProcess_ )
+    {
+        threadProcess_ = new HelperThread<OceanRipples>(this, &OceanRipples::BackgroundProcess);
+        threaded_ = threadProcess_->Start();
+    }
+}
+
+void OceanRipples::Update()
+{
+    if ( threadProcess_ && !threaded_ )
+        Process();
+}
+
+unsigned OceanRipples::GetNumActiveTiles()
+{
+    MutexLock lock(mutexPublishLock_);
+    return publishedTiles_.Size();
+}
+
+void OceanRipples::BackgroundProcess()
+{
+    unsigned sleepMSec = Process();
+
+    if ( sleepMSec )
+        Time::Sleep( sleepMSec );
+}
+
+unsigned OceanRipples::Process()
+{
+    if ( stepTimer_.GetMSec(false) < RIPPLE_STEP_MS )
+        return 1;
+
+    stepTimer_.Reset();
+
+    ApplyDisturbances();
+
+    // calm, the worker stops until the next disturbance starts it again
+    if ( activeTiles_.Empty() )
+    {
+        MutexLock lock(mutexDisturbanceLock_);
+
+        if ( disturbances_.Empty() )
+        {
+            idle_ = true;
+
+            if ( threadProcess_ )
+                threadProcess_->RequestExit();
+        }
+
+        return 0;
+    }
+
+    // substeps keep the wave equation stable on fine grids
+    float courant = RIPPLE_WAVE_SPEED * RIPPLE_STEP_SEC / spacing_;
+    int substeps = Max( CeilToInt( courant / RIPPLE_MAX_COURANT ), 1 );
+    float k = ( courant / substeps ) * ( courant / substeps );
+    float damping = powf( RIPPLE_DAMPING, 1.0f / substeps );
+    float relax = powf( RIPPLE_RELAX, 1.0f / substeps );
+
+    for ( int s = 0; s < substeps; ++s )
+        Step( k, damping, relax );
+
+    UpdateTiles();
+    Publish();
+
+    return 0;
+}
+
+void OceanRipples::ApplyDisturbances()
+{
+    PODVector<Disturbance> disturbances;
+
+    {
+        MutexLock lock(mutexDisturbanceLock_);
+        disturbances.Swap( disturbances_ );
+    }
+
+    for ( unsigned d = 0; d < disturbances.Size(); ++d )
+    {
+        // raised cosine, at least a cell across so it isn't lost between vertices
+        const Disturbance &disturbance = disturbances[d];
+        float cx = disturbance.x / spacing_ + N_ / 2.0f;
+        float cz = disturbance.z / spacing_ + N_ / 2.0f;
+        float radius = Max( disturbance.radius / spacing_, 1.0f );
+
+        int xMin = Max( FloorToInt( cx - radius ), 0 );
+        int xMax = Min( CeilToInt( cx + radius ), N_ );
+        int zMin = Max( FloorToInt( cz - radius ), 0 );
+        int zMax = Min( CeilToInt( cz + radius ), N_ );
+
+        for ( int z = zMin; z <= zMax; ++z )
+        {
+            for ( int x = xMin; x <= xMax; ++x )
+            {
+                float dist = sqrtf( (x - cx) * (x - cx) + (z - cz) * (z - cz) );
+
+                if ( dist >= radius )
+                    continue;
+
+                // added to both steps, so it starts at rest and spreads out
+                Tile &tile = tiles_[ AllocateTile( x / TileCells, z / TileCells ) ];
+                int cell = (z % TileCells) * TileCells + (x % TileCells);
+                float height = disturbance.strength * 0.5f * ( 1.0f + cosf( M_PI * dist / radius ) );
+
+                tile.height[0][cell] += height;
+                tile.height[1][cell] += height;
+                tile.calmSteps = 0;
+            }
+        }
+    }
+}
+
+void OceanRipples::Step(float k, float damping, float relax)
+{
+    // the next step is written over the previous one, the current one is left for the neighbors to read
+    for ( unsigned t = 0; t < activeTiles_.Size(); ++t )
+    {
+        Tile &tile = tiles_[ activeTiles_[t] ];
+        const float *cur = tile.height[ current_ ];
+        float *next = tile.height[ current_ ^ 1 ];
+        int x0 = tile.tx * TileCells;
+        int z0 = tile.tz * TileCells;
+
+        for ( int j = 0; j < TileCells; ++j )
+        {
+            for ( int i = 0; i < TileCells; ++i )
+            {
+                int c = j * TileCells + i;
+                int x = x0 + i;
+                int z = z0 + j;
+
+                // past the grid's last vertex
+                if ( x > N_ || z > N_ )
+                {
+                    next[c] = 0.0f;
+                    continue;
+                }
+
+                float sum = ( i > 0             ? cur[c - 1]         : GetHeight( x - 1, z ) ) +
+                            ( i < TileCells - 1 ? cur[c + 1]         : GetHeight( x + 1, z ) ) +
+                            ( j > 0             ? cur[c - TileCells] : GetHeight( x, z - 1 ) ) +
+                            ( j < TileCells - 1 ? cur[c + TileCells] : GetHeight( x, z + 1 ) );
+
+                next[c] = ( cur[c] + ( cur[c] - next[c] ) * damping + k * ( sum - 4.0f * cur[c] ) ) * relax;
+            }
+        }
+    }
+
+    current_ ^= 1;
+}
+
+void OceanRipples::UpdateTiles()
+{
+    PODVector<int> calm;
+    PODVector<int> spread;
+
+    for ( unsigned t = 0; t < activeTiles_.Size(); ++t )
+    {
+        Tile &tile = tiles_[ activeTiles_[t] ];
+        const float *height = tile.height[ current_ ];
+        float maxHeight = 0.0f;
+        float edges[4] = { 0.0f, 0.0f, 0.0f, 0.0f };   // -x, +x, -z, +z
+
+        for ( int j = 0; j < TileCells; ++j )
+        {
+            for ( int i = 0; i < TileCells; ++i )
+            {
+                float h = Abs( height[ j * TileCells + i ] );
+                maxHeight = Max( maxHeight, h );
+
+                if ( i == 0 )             edges[0] = Max( edges[0], h );
+                if ( i == TileCells - 1 ) edges[1] = Max( edges[1], h );
+                if ( j == 0 )             edges[2] = Max( edges[2], h );
+                if ( j == TileCells - 1 ) edges[3] = Max( edges[3], h );
+            }
+        }
+
+        tile.calmSteps = maxHeight < RIPPLE_CALM_HEIGHT ? tile.calmSteps + 1 : 0;
+
+        if ( tile.calmSteps >= RIPPLE_CALM_STEPS )
+            calm.Push( activeTiles_[t] );
+
+        // waves reaching an edge need the tile beyond it
+        static const int offsets[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+
+        for ( int e = 0; e < 4; ++e )
+        {
+            int tx = tile.tx + offsets[e][0];
+            int tz = tile.tz + offsets[e][1];
+
+            if ( edges[e] > RIPPLE_SPREAD_HEIGHT && tx >= 0 && tz >= 0 && tx < tilesPerSide_ && tz < tilesPerSide_ &&
+                 tileGrid_[ tz * tilesPerSide_ + tx ] < 0 )
+                spread.Push( tz * tilesPerSide_ + tx );
+        }
+    }
+
+    for ( unsigned i = 0; i < calm.Size(); ++i )
+        FreeTile( calm[i] );
+
+    for ( unsigned i = 0; i < spread.Size(); ++i )
+        AllocateTile( spread[i] % tilesPerSide_, spread[i] / tilesPerSide_ );
+}
+
+void OceanRipples::Publish()
+{
+    const unsigned cells = TileCells * TileCells;
+
+    MutexLock lock(mutexPublishLock_);
+
+    for ( unsigned i = 0; i < publishedTiles_.Size(); ++i )
+        publishedGrid_[ publishedTiles_[i] ] = -1;
+
+    publishedTiles_.Resize( activeTiles_.Size() );
+    published_.Resize( activeTiles_.Size() * cells );
+
+    for ( unsigned i = 0; i < activeTiles_.Size(); ++i )
+    {
+        const Tile &tile = tiles_[ activeTiles_[i] ];
+        int index = tile.tz * tilesPerSide_ + tile.tx;
+
+        publishedTiles_[i] = index;
+        publishedGrid_[ index ] = i;
+        memcpy( &published_[ i * cells ], tile.height[ current_ ], cells * sizeof(float) );
+    }
+}
+
+void OceanRipples::Composite(vertex_ocean_compact *dest, Vector3 *positions, float range, const OceanShoreMask *shore)
+{
+    // a mask for another grid size is left until it's rebuilt for this one
+    const float *attenuation = shore && shore->IsValid() && shore->GetGridSize() == N_ ? shore->GetAttenuation() : NULL;
+
+    MutexLock lock(mutexPublishLock_);
+
+    int Nplus1 = N_ + 1;
+    float invTwoSpacing = 0.5f / spacing_;
+
+    for ( unsigned t = 0; t < publishedTiles_.Size(); ++t )
+    {
+        const float *height = &published_[ t * TileCells * TileCells ];
+        int x0 = ( publishedTiles_[t] % tilesPerSide_ ) * TileCells;
+        int z0 = ( publishedTiles_[t] / tilesPerSide_ ) * TileCells;
+
+        for ( int j = 0; j < TileCells && z0 + j <= N_; ++j )
+        {
+            for ( int i = 0; i < TileCells && x0 + i <= N_; ++i )
+            {
+                int x = x0 + i;
+                int z = z0 + j;
+                int index = z * Nplus1 + x;
+                float scale = attenuation ? attenuation[ index ] : 1.0f;
+
+                if ( scale == 0.0f )
+                    continue;
+
+                float h = height[ j * TileCells + i ] * scale;
+                float dhdx = ( GetPublishedHeight( x + 1, z ) - GetPublishedHeight( x - 1, z ) ) * invTwoSpacing * scale;
+                float dhdz = ( GetPublishedHeight( x, z + 1 ) - GetPublishedHeight( x, z - 1 ) ) * invTwoSpacing * scale;
+
+                Vector3 displacement, normal;
+                float jacobian;
+                cOcean::decodeCompact( dest[index], range, displacement, normal, jacobian );
+
+                displacement.y_ += h;
+                normal = Vector3( normal.x_ - dhdx * normal.y_, normal.y_, normal.z_ - dhdz * normal.y_ ).Normalized();
+
+                cOcean::encodeCompact( displacement, normal, jacobian, range, dest[index] );
+
+                if ( positions )
+                    positions[index].y_ += h;
+            }
+        }
+    }
+}
+
+int OceanRipples::AllocateTile(int tx, int tz)
+{
+    int &slot = tileGrid_[ tz * tilesPerSide_ + tx ];
+
+    if ( slot >= 0 )
+        return slot;
+
+    if ( !freeTiles_.Empty() )
+    {
+        slot = freeTiles_.Back();
+        freeTiles_.Pop();
+    }
+    else
+    {
+        slot = tiles_.Size();
+        tiles_.Resize( slot + 1 );
+    }
+
+    Tile &tile = tiles_[ slot ];
+    memset( &tile, 0, sizeof(Tile) );
+    tile.tx = tx;
+    tile.tz = tz;
+
+    activeTiles_.Push( slot );
+
+    return slot;
+}
+
+void OceanRipples::FreeTile(int slot)
+{
+    const Tile &tile = tiles_[ slot ];
+
+    tileGrid_[ tile.tz * tilesPerSide_ + tile.tx ] = -1;
+    activeTiles_.Remove( slot );
+    freeTiles_.Push( slot );
+}
+
+float OceanRipples::GetHeight(int x, int z) const
+{
+    if ( x < 0 || z < 0 || x > N_ || z > N_ )
+        return 0.0f;
+
+    int slot = tileGrid_[ (z / TileCells) * tilesPerSide_ + x / TileCells ];
+
+    return slot < 0 ? 0.0f : tiles_[ slot ].height[ current_ ][ (z % TileCells) * TileCells + x % TileCells ];
+}
+
+float OceanRipples::GetPublishedHeight(int x, int z) const
+{
+    if ( x < 0 || z < 0 || x > N_ || z > N_ )
+        return 0.0f;
+
+    int tile = publishedGrid_[ (z / TileCells) * tilesPerSide_ + x / TileCells ];
+
+    return tile < 0 ? 0.0f : published_[ tile * TileCells * TileCells + (z % TileCells) * TileCells + x % TileCells ];
+}
@@ -0,0 +1,122 @@
+//=============================================================================
+// Copyright (c) 2016 Lumak
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//=============================================================================
+
+#pragma once
+
+#include <Urho3D/Core/Mutex.h>
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/Container/Vector.h>
+#include <Urho3D/Math/Vector3.h>
+
+#include "HelperThread.h"
+
+using namespace Urho3D;
+
+struct vertex_ocean_compact;
+class OceanShoreMask;
+
+//=============================================================================
+// Interactive ripples on top of the FFT ocean, for wakes and splashes. A damped
+// 2D wave equation runs on the ocean's vertex grid, but only in tiles around
+// disturbances - tiles are added as the waves spread and freed once they've
+// calmed down, so the cost follows the disturbances rather than the ocean's
+// size. It steps at a fixed rate on its own worker, which stops once the
+// water's calm, and the latest step is added to the vertices as they're packed.
+//=============================================================================
+class OceanRipples
+{
+public:
+    enum { TileCells = 8 };
+
+    OceanRipples();
+    ~OceanRipples();
+
+    // the ocean mesh's grid, (N+1)^2 vertices spaced length/N apart and centered on the origin. Clears the ripples
+    void Init(int N, float length);
+
+    // x, z and radius in the mesh's space, strength is the height added at the center.
+    // The worker is started by the first one, and again by the first after it's stopped
+    void AddDisturbance(float x, float z, float radius, float strength);
+
+    // adds the latest heights to the vertices in the active tiles and tilts their normals by the slope.
+    // The optional shore mask damps them like the waves, dry vertices are left as they are
+    void Composite(vertex_ocean_compact *dest, Vector3 *positions, float range, const OceanShoreMask *shore = NULL);
+
+    // steps on the calling thread when the worker couldn't be started
+    void Update();
+
+    unsigned GetNumActiveTiles();
+
+protected:
+    struct Tile
+    {
+        int      tx, tz;
+        float    height[2][TileCells * TileCells];  // height[current_] is the latest step, the other the one before
+        unsigned calmSteps;
+    };
+
+    struct Disturbance
+    {
+        float x, z, radius, strength;
+    };
+
+    // worker, Process() returns the ms it can sleep for
+    unsigned Process();
+    void BackgroundProcess();
+    void ApplyDisturbances();
+    void Step(float k, float damping, float relax);
+    void UpdateTiles();
+    void Publish();
+
+    int AllocateTile(int tx, int tz);
+    void FreeTile(int slot);
+    float GetHeight(int x, int z) const;
+    float GetPublishedHeight(int x, int z) const;
+
+protected:
+    int                 N_;
+    float               spacing_;
+    int                 tilesPerSide_;
+
+    // tiles, the worker's
+    PODVector<Tile>     tiles_;             // pool, slots on the free list are unused
+    PODVector<int>      freeTiles_;
+    PODVector<int>      activeTiles_;
+    PODVector<int>      tileGrid_;          // slot per tile, -1 where there's none
+    unsigned            current_;
+    Timer               stepTimer_;
+
+    // disturbances for the next step, idle_ is set when the worker's stopped for lack of them
+    PODVector<Disturbance> disturbances_;
+    bool                idle_;
+    Mutex               mutexDisturbanceLock_;
+
+    // copy of the latest step for Composite()
+    PODVector<float>    published_;         // TileCells^2 heights per tile
+    PODVector<int>      publishedTiles_;    // grid index per tile
+    PODVector<int>      publishedGrid_;     // published tile per grid index, -1 where there's none
+    Mutex               mutexPublishLock_;
+
+    HelperThread<OceanRipples> *threadProcess_;
+    bool                threaded_;
+};
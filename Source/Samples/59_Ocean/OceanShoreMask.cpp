@@ -0,0 +1,73 @@
+//=============================================================================
+// Copyright (c) 2016 Lumak
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//=============================================================================
+
+#include <Urho3D/Urho3D.h>
+#include <Urho3D/Math/MathDefs.h>
+
+#include "OceanShoreMask.h"
+
+#include <Urho3D/DebugNew.h>
+
+//=============================================================================
+//=============================================================================
+OceanShoreMask::OceanShoreMask()
+    : N_(0)
+    , numDamped_(0)
+    , numDry_(0)
+{
+}
+
+void OceanShoreMask::Init(int N, const PODVector<float> &depths, float shallowDepth)
+{
+    Clear();
+
+    unsigned numVertices = (unsigned)( (N + 1) * (N + 1) );
+
+    if ( depths.Size() != numVertices )
+        return;
+
+    N_ = N;
+    attenuation_.Resize( numVertices );
+    shallowDepth = Max( shallowDepth, M_EPSILON );
+
+    for ( unsigned i = 0; i < numVertices; ++i )
+    {
+        // the waves die down linearly over the shallows
+        float attenuation = Clamp( depths[ i ] / shallowDepth, 0.0f, 1.0f );
+        attenuation_[ i ] = attenuation;
+
+        if ( attenuation < 1.0f )
+            ++numDamped_;
+
+        if ( attenuation == 0.0f )
+            ++numDry_;
+    }
+}
+
+void OceanShoreMask::Clear()
+{
+    N_ = 0;
+    attenuation_.Clear();
+    numDamped_ = 0;
+    numDry_ = 0;
+}
@@ -0,0 +1,61 @@
+//=============================================================================
+// Copyright (c) 2016 Lumak
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//=============================================================================
+
+#pragma once
+
+#include <Urho3D/Container/Vector.h>
+
+using namespace Urho3D;
+
+//=============================================================================
+// Where the ocean meets the terrain. Built once from the water depth at each
+// vertex of the ocean's grid, it holds the fraction of the waves kept there:
+// all of them in open water, scaling down to none where the depth goes under
+// shallowDepth. Vertices at or below 0 are dry, under the terrain - they're
+// packed flat and triangles with only dry corners needn't be drawn. The cost
+// is a lookup per vertex, however much shoreline there is.
+//=============================================================================
+class OceanShoreMask
+{
+public:
+    OceanShoreMask();
+
+    // depths per vertex of the (N+1)^2 grid, row by row, positive under water
+    void Init(int N, const PODVector<float> &depths, float shallowDepth);
+    void Clear();
+
+    // false when there's no mask or nothing in it is damped
+    bool IsValid() const                        { return numDamped_ > 0; }
+    int GetGridSize() const                     { return N_; }
+
+    const float* GetAttenuation() const         { return attenuation_.Size() ? &attenuation_[0] : 0; }
+    bool IsDry(unsigned index) const            { return attenuation_[ index ] == 0.0f; }
+    unsigned GetNumDamped() const               { return numDamped_; }
+    unsigned GetNumDry() const                  { return numDry_; }
+
+protected:
+    int                 N_;
+    PODVector<float>    attenuation_;
+    unsigned            numDamped_;         // below 1, dry ones included
+    unsigned            numDry_;
+};
@@ -0,0 +1,1019 @@
+//=============================================================================
+// Copyright (c) 2016 Lumak
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//=============================================================================
+
+#include <Urho3D/Urho3D.h>
+#include <Urho3D/Core/Context.h>
+#include <Urho3D/Core/CoreEvents.h>
+#include <Urho3D/Core/Profiler.h>
+#include <Urho3D/Core/StringUtils.h>
+#include <Urho3D/IO/File.h>
+#include <Urho3D/Resource/Image.h>
+#include <SDL/SDL_log.h>
+#include <string.h>
+
+#include "OceanSimulation.h"
+#include "Ocean.h"
+#include "OceanShoreMask.h"
+
+#include <Urho3D/DebugNew.h>
+
+//=============================================================================
+//=============================================================================
+#define DEFAULT_CPU_BUDGET      0.25f
+#define DEFAULT_MIN_RATE        10.0f
+#define DEFAULT_MAX_RATE        60.0f
+#define SUSPEND_SLEEP_MS        10
+#define BAKE_FRAMES_PER_UPDATE  4
+#define MAIN_THREAD_SLICE_MS    2.0f
+#define MAX_DISPLAY_LATENCY     0.1f
+
+HashMap<String, OceanSimulation*> OceanSimulation::simulations_;
+
+// a float's bit pattern, keys compare the parameters exactly
+static unsigned FloatBits(float value)
+{
+    unsigned bits;
+    memcpy( &bits, &value, sizeof(bits) );
+    return bits;
+}
+
+//=============================================================================
+//=============================================================================
+SharedPtr<OceanSimulation> OceanSimulation::Acquire(Context *context, int N, float A, const Vector2 &wind, float length, unsigned seed)
+{
+    String key = MakeKey( N, A, wind, length, seed );
+    HashMap<String, OceanSimulation*>::Iterator itr = simulations_.Find( key );
+
+    if ( itr != simulations_.End() )
+        return SharedPtr<OceanSimulation>( itr->second_ );
+
+    SharedPtr<OceanSimulation> simulation( new OceanSimulation( context, key, N, A, wind, length, seed ) );
+    simulations_[ key ] = simulation;
+
+    return simulation;
+}
+
+String OceanSimulation::MakeKey(int N, float A, const Vector2 &wind, float length, unsigned seed)
+{
+    return ToString( "%d %08x %08x %08x %08x %u", N, FloatBits( A ), FloatBits( wind.x_ ), FloatBits( wind.y_ ), FloatBits( length ), seed );
+}
+
+OceanSimulation::OceanSimulation(Context *context, const String &key, int N, float A, const Vector2 &wind, float length, unsigned seed)
+    : Object(context)
+    , pCOcean(NULL)
+    , N_(N)
+    , A_(A)
+    , wind_(wind)
+    , length_(length)
+    , seed_(seed)
+    , key_(key)
+    , simMode_(SimMode_FFT)
+    , bakeFrameRate_(0.0f)
+    , bakeMaxBytes_(0)
+    , bakeRequested_(false)
+    , newestFrame_(0)
+    , numSimFrames_(0)
+    , publishedFrames_(0)
+    , detailSize_(0)
+    , detailVersion_(0)
+    , renderNewest_(0)
+    , numRenderFrames_(0)
+    , takenFrames_(0)
+    , threadProcess_(NULL)
+    , normalMode_(NormalMode_FFT)
+    , cpuBudget_(DEFAULT_CPU_BUDGET)
+    , minSimRate_(DEFAULT_MIN_RATE)
+    , maxSimRate_(DEFAULT_MAX_RATE)
+    , simInterval_(1.0f / DEFAULT_MAX_RATE)
+    , avgEvalSec_(0.0f)
+    , displayLatency_(0.0f)
+    , timeOffset_(0.0f)
+    , threaded_(true)
+    , sliceBudget_(0.0f)
+    , frameCount_(0)
+    , slicedFrame_(0)
+    , stepping_(false)
+    , stepTime_(0.0f)
+    , stepResync_(false)
+    , stepResyncRequest_(0)
+    , stepCostSec_(0.0f)
+    , avgStepWallSec_(0.0f)
+    , detailScale_(0)
+    , weatherRequest_(0)
+    , weatherSeconds_(0.0f)
+    , weatherStart_(M_INFINITY)
+    , weatherDone_(0)
+    , blending_(false)
+    , blendExact_(true)
+    , blendFromA_(0.0f)
+    , blendStart_(0.0f)
+    , blendSeconds_(0.0f)
+    , simRateCap_(DEFAULT_MAX_RATE)
+    , suspended_(false)
+    , resyncRequest_(0)
+    , resyncDone_(0)
+{
+    // start thread, cOcean is created on it
+    elapsedFrameTimer_ = new Time(context_);
+    threadProcess_ = new HelperThread<OceanSimulation>(this, &OceanSimulation::BackgroundProcess);
+
+    // without a worker the simulation runs in slices on the main thread
+    if ( !threadProcess_->Start() )
+    {
+        threaded_ = false;
+        sliceBudget_ = MAIN_THREAD_SLICE_MS;
+        SDL_Log( "ocean N=%d worker thread unavailable, time slicing on the main thread\n", N_ );
+    }
+
+    SubscribeToEvent(E_BEGINFRAME, URHO3D_HANDLER(OceanSimulation, HandleBeginFrame));
+}
+
+OceanSimulation::~OceanSimulation()
+{
+    // a shut down simulation may already be replaced in the registry
+    HashMap<String, OceanSimulation*>::Iterator itr = simulations_.Find( key_ );
+
+    if ( itr != simulations_.End() && itr->second_ == this )
+        simulations_.Erase( key_ );
+
+    if ( threadProcess_ )
+    {
+        delete threadProcess_;
+        threadProcess_ = NULL;
+    }
+
+    if ( pCOcean )
+    {
+        delete pCOcean;
+        pCOcean = NULL;
+    }
+}
+
+float OceanSimulation::GetElapsedTime()
+{
+    MutexLock lock(mutexSettingsLock_);
+    return elapsedFrameTimer_->GetElapsedTime() + timeOffset_;
+}
+
+float OceanSimulation::GetDisplayTime()
+{
+    MutexLock lock(mutexSettingsLock_);
+    return elapsedFrameTimer_->GetElapsedTime() + timeOffset_ + displayLatency_;
+}
+
+void OceanSimulation::SetTime(float t)
+{
+    MutexLock lock(mutexSettingsLock_);
+    timeOffset_ = t - elapsedFrameTimer_->GetElapsedTime();
+
+    // the frames from before the jump aren't interpolated with
+    ++resyncRequest_;
+}
+
+bool OceanSimulation::IsReady()
+{
+    if ( IsPlayingRecording() )
+        return true;
+
+    MutexLock lock(mutexFrameLock_);
+    return numSimFrames_ > 0;
+}
+
+bool OceanSimulation::Shutdown()
+{
+    HashMap<String, OceanSimulation*>::Iterator itr = simulations_.Find( key_ );
+
+    if ( itr != simulations_.End() && itr->second_ == this )
+        simulations_.Erase( key_ );
+
+    threadProcess_->RequestExit();
+
+    return threadProcess_->HasFnExited();
+}
+
+void OceanSimulation::SetSimMode(SimModeType mode)
+{
+    MutexLock lock(mutexCacheLock_);
+    simMode_ = mode;
+}
+
+OceanSimulation::SimModeType OceanSimulation::GetSimMode()
+{
+    MutexLock lock(mutexCacheLock_);
+    return simMode_;
+}
+
+void OceanSimulation::SetNormalMode(NormalModeType mode)
+{
+    // picked up by the worker at the start of its next evaluation
+    MutexLock lock(mutexSettingsLock_);
+    normalMode_ = mode;
+}
+
+OceanSimulation::NormalModeType OceanSimulation::GetNormalMode()
+{
+    MutexLock lock(mutexSettingsLock_);
+    return normalMode_;
+}
+
+void OceanSimulation::SetCpuBudget(float fraction)
+{
+    MutexLock lock(mutexSettingsLock_);
+    cpuBudget_ = Clamp( fraction, 0.01f, 1.0f );
+}
+
+float OceanSimulation::GetCpuBudget()
+{
+    MutexLock lock(mutexSettingsLock_);
+    return cpuBudget_;
+}
+
+void OceanSimulation::SetSimRateRange(float minHz, float maxHz)
+{
+    MutexLock lock(mutexSettingsLock_);
+    minSimRate_ = Max( minHz, 1.0f );
+    maxSimRate_ = Max( maxHz, minSimRate_ );
+}
+
+void OceanSimulation::GetSimRateRange(float &minHz, float &maxHz)
+{
+    MutexLock lock(mutexSettingsLock_);
+    minHz = minSimRate_;
+    maxHz = maxSimRate_;
+}
+
+float OceanSimulation::GetSimRate()
+{
+    MutexLock lock(mutexSettingsLock_);
+    return suspended_ ? 0.0f : 1.0f / Max( simInterval_, 1.0f / simRateCap_ );
+}
+
+void OceanSimulation::SetTimeSlice(float budgetMs)
+{
+    MutexLock lock(mutexSettingsLock_);
+    sliceBudget_ = threaded_ ? Max( budgetMs, 0.0f ) : Max( budgetMs, MAIN_THREAD_SLICE_MS );
+}
+
+float OceanSimulation::GetTimeSlice()
+{
+    MutexLock lock(mutexSettingsLock_);
+    return sliceBudget_;
+}
+
+void OceanSimulation::SetClientRateCap(Ocean *client, float hz)
+{
+    clientRateCaps_[ client ] = hz;
+    UpdateRateCap();
+}
+
+void OceanSimulation::RemoveClient(Ocean *client)
+{
+    clientRateCaps_.Erase( client );
+    UpdateRateCap();
+}
+
+void OceanSimulation::UpdateRateCap()
+{
+    float rateCap = 0.0f;
+
+    for ( HashMap<Ocean*, float>::ConstIterator itr = clientRateCaps_.Begin(); itr != clientRateCaps_.End(); ++itr )
+        rateCap = Max( rateCap, itr->second_ );
+
+    MutexLock lock(mutexSettingsLock_);
+    suspended_ = rateCap <= 0.0f;
+    simRateCap_ = suspended_ ? maxSimRate_ : rateCap;
+}
+
+unsigned OceanSimulation::RequestResync()
+{
+    MutexLock lock(mutexSettingsLock_);
+    return ++resyncRequest_;
+}
+
+bool OceanSimulation::IsResynced(unsigned request)
+{
+    MutexLock lock(mutexSettingsLock_);
+    return resyncDone_ - request < 0x80000000;
+}
+
+void OceanSimulation::BakeFrames(float framesPerSec, unsigned maxBytes)
+{
+    // the bake shares cOcean with the live simulation, so it's done in steps on the worker thread
+    MutexLock lock(mutexCacheLock_);
+    bakeFrameRate_ = framesPerSec;
+    bakeMaxBytes_  = maxBytes;
+    bakeRequested_ = true;
+}
+
+bool OceanSimulation::IsBakeComplete()
+{
+    MutexLock lock(mutexCacheLock_);
+    return !bakeRequested_ && frameCache_.IsBaked();
+}
+
+bool OceanSimulation::SaveFrameCache(const String &fileName)
+{
+    File file(context_, fileName, FILE_WRITE);
+
+    if ( !file.IsOpen() )
+        return false;
+
+    MutexLock lock(mutexCacheLock_);
+    return frameCache_.Save( file );
+}
+
+bool OceanSimulation::LoadFrameCache(const String &fileName)
+{
+    File file(context_, fileName, FILE_READ);
+
+    if ( !file.IsOpen() )
+        return false;
+
+    MutexLock lock(mutexCacheLock_);
+    bakeRequested_ = false;
+
+    if ( !frameCache_.Load( file ) )
+        return false;
+
+    if ( frameCache_.GetGridSize() != N_ )
+    {
+        SDL_Log( "frame cache %s grid size %d does not match ocean size %d\n", fileName.CString(), frameCache_.GetGridSize(), N_ );
+        frameCache_.Clear();
+        return false;
+    }
+
+    return true;
+}
+
+void OceanSimulation::SetWeather(float A, const Vector2 &wind, float seconds, float start)
+{
+    String key = MakeKey( N_, A, wind, length_, seed_ );
+
+    if ( key == key_ )
+        return;
+
+    // components acquiring the new parameters share this simulation, unless one is already running them
+    HashMap<String, OceanSimulation*>::Iterator itr = simulations_.Find( key_ );
+
+    if ( itr != simulations_.End() && itr->second_ == this )
+        simulations_.Erase( key_ );
+
+    key_ = key;
+
+    if ( !simulations_.Contains( key_ ) )
+        simulations_[ key_ ] = this;
+
+    // picked up by the worker at the start of its next step
+    MutexLock lock(mutexSettingsLock_);
+    A_ = A;
+    wind_ = wind;
+    weatherSeconds_ = Max( seconds, M_EPSILON );
+    weatherStart_ = start;
+    ++weatherRequest_;
+}
+
+float OceanSimulation::GetAmplitude()
+{
+    MutexLock lock(mutexSettingsLock_);
+    return A_;
+}
+
+Vector2 OceanSimulation::GetWind()
+{
+    MutexLock lock(mutexSettingsLock_);
+    return wind_;
+}
+
+bool OceanSimulation::IsWeatherBlending()
+{
+    MutexLock lock(mutexSettingsLock_);
+    return weatherRequest_ != weatherDone_ || blending_;
+}
+
+bool OceanSimulation::GetWeatherBlend(bool &blending, float &fromA, Vector2 &fromWind, float &start, float &seconds)
+{
+    MutexLock lock(mutexSettingsLock_);
+    blending = false;
+
+    if ( weatherRequest_ != weatherDone_ )
+        return false;
+
+    if ( !blending_ )
+        return true;
+
+    blending = true;
+    fromA = blendFromA_;
+    fromWind = blendFromWind_;
+    start = blendStart_;
+    seconds = blendSeconds_;
+
+    return blendExact_;
+}
+
+void OceanSimulation::SetDetailScale(int scale)
+{
+    // picked up by the worker at the start of its next step
+    MutexLock lock(mutexSettingsLock_);
+    detailScale_ = scale > 0 ? (int)NextPowerOfTwo( (unsigned)scale ) : 0;
+}
+
+int OceanSimulation::GetDetailScale()
+{
+    MutexLock lock(mutexSettingsLock_);
+    return detailScale_;
+}
+
+bool OceanSimulation::GetDetailMap(Image *image, unsigned &version)
+{
+    MutexLock lock(mutexFrameLock_);
+
+    if ( version == detailVersion_ || detailSize_ == 0 )
+        return false;
+
+    image->SetSize( detailSize_, detailSize_, 4 );
+    image->SetData( &detailData_[0] );
+    version = detailVersion_;
+
+    return true;
+}
+
+bool OceanSimulation::StartRecording(const String &fileName)
+{
+    MutexLock lock(mutexRecordLock_);
+
+    if ( !recorder_.Open( fileName, N_, length_ ) )
+        return false;
+
+    SDL_Log( "ocean N=%d recording to %s\n", N_, fileName.CString() );
+    return true;
+}
+
+void OceanSimulation::StopRecording()
+{
+    MutexLock lock(mutexRecordLock_);
+
+    if ( recorder_.IsOpen() )
+        SDL_Log( "ocean N=%d recorded %u frames\n", N_, recorder_.GetNumFrames() );
+
+    recorder_.Close();
+}
+
+bool OceanSimulation::IsRecording()
+{
+    MutexLock lock(mutexRecordLock_);
+    return recorder_.IsOpen();
+}
+
+bool OceanSimulation::LoadRecording(const String &fileName)
+{
+    MutexLock lock(mutexRecordLock_);
+
+    if ( !recording_.Open( fileName ) )
+        return false;
+
+    if ( recording_.GetGridSize() != N_ || recording_.GetPatchLength() != length_ || recording_.GetNumFrames() == 0 )
+    {
+        SDL_Log( "recording %s, N=%d length %g with %u frames, does not match ocean N=%d length %g\n", fileName.CString(),
+                 recording_.GetGridSize(), recording_.GetPatchLength(), recording_.GetNumFrames(), N_, length_ );
+        recording_.Close();
+        return false;
+    }
+
+    return true;
+}
+
+bool OceanSimulation::IsPlayingRecording()
+{
+    if ( GetSimMode() != SimMode_Recording )
+        return false;
+
+    MutexLock lock(mutexRecordLock_);
+    return recording_.IsOpen();
+}
+
+bool OceanSimulation::ProcessFrameCache(float t)
+{
+    MutexLock lock(mutexCacheLock_);
+
+    if ( bakeRequested_ )
+    {
+        frameCache_.BeginBake( pCOcean->getN(), bakeFrameRate_, bakeMaxBytes_ );
+        bakeRequested_ = false;
+    }
+
+    // a few bake frames per update, the live frame is evaluated afterwards
+    if ( frameCache_.IsBaking() )
+    {
+        frameCache_.BakeStep( pCOcean, BAKE_FRAMES_PER_UPDATE );
+        return false;
+    }
+
+    if ( simMode_ == SimMode_Playback && frameCache_.IsBaked() )
+    {
+        frameCache_.Playback( pCOcean, t );
+        return true;
+    }
+
+    return false;
+}
+
+void OceanSimulation::PublishFrame(float t, bool resync)
+{
+    // packed and recorded into the worker's own frame, only the swap with the older frame is under the lock
+    int Nplus1 = N_ + 1;
+
+    publishFrame_.data.Resize( Nplus1 * Nplus1 * OCEAN_FRAME_FLOATS );
+    pCOcean->packFrame( &publishFrame_.data[0] );
+    publishFrame_.time = t;
+
+    {
+        MutexLock recordLock(mutexRecordLock_);
+
+        if ( recorder_.IsOpen() )
+            recorder_.Append( t, &publishFrame_.data[0] );
+    }
+
+    // overwrites the older frame
+    MutexLock lock(mutexFrameLock_);
+
+    // after a resync the frames from before aren't interpolated with
+    if ( resync )
+        numSimFrames_ = 0;
+
+    unsigned next = newestFrame_ ^ 1;
+    simFrames_[ next ].data.Swap( publishFrame_.data );
+    simFrames_[ next ].time = t;
+
+    newestFrame_ = next;
+    numSimFrames_ = Min( numSimFrames_ + 1, 2U );
+    ++publishedFrames_;
+
+    // only the newest detail map is kept, it isn't interpolated
+    detailSize_ = detailMap_.GetSize();
+
+    if ( detailSize_ )
+    {
+        detailData_ = detailMap_.GetData();
+        ++detailVersion_;
+    }
+}
+
+void OceanSimulation::UpdateSimRate(float evalSec)
+{
+    MutexLock lock(mutexSettingsLock_);
+
+    // smoothed cost of a frame, spaced out to stay within the budget
+    avgEvalSec_ = avgEvalSec_ > 0.0f ? Lerp( avgEvalSec_, evalSec, 0.1f ) : evalSec;
+    simInterval_ = Clamp( avgEvalSec_ / cpuBudget_, 1.0f / maxSimRate_, 1.0f / minSimRate_ );
+}
+
+unsigned OceanSimulation::Process()
+{
+    // generating the spectrum takes a while at larger sizes, so it's kept off the thread that acquired the simulation
+    // and the settings lock isn't held while it's generated, the main thread takes it every frame
+    if ( !pCOcean )
+    {
+        int N;
+        float A, length;
+        Vector2 wind;
+        unsigned seed, weatherRequest;
+
+        {
+            MutexLock lock(mutexSettingsLock_);
+            N = N_;
+            A = A_;
+            wind = wind_;
+            length = length_;
+            seed = seed_;
+            weatherRequest = weatherRequest_;
+        }
+
+        cOcean *ocean = new cOcean( N, A, wind, length, false, false, seed );
+        SDL_Log( "ocean N=%d simulation memory %u KB\n", N, ocean->getFootprint() / 1024 );
+
+        // weather changed while it was generated blends in on the first step
+        MutexLock lock(mutexSettingsLock_);
+        pCOcean = ocean;
+        weatherDone_ = weatherRequest;
+    }
+
+    // the recording stands in for the simulation, resyncs have nothing to wait for
+    if ( IsPlayingRecording() )
+    {
+        stepping_ = false;
+
+        MutexLock lock(mutexSettingsLock_);
+        resyncDone_ = resyncRequest_;
+        return SUSPEND_SLEEP_MS;
+    }
+
+    bool suspended, resync;
+    unsigned resyncRequest, frameCount;
+    float interval, sliceBudget, evalSec, displayLatency, weatherSeconds, weatherStart;
+    int detailScale;
+    unsigned weatherRequest;
+    float A;
+    Vector2 wind;
+
+    {
+        MutexLock lock(mutexSettingsLock_);
+        suspended = suspended_;
+        resyncRequest = resyncRequest_;
+        resync = resyncRequest_ != resyncDone_;
+        interval = Max( simInterval_, 1.0f / simRateCap_ );
+        sliceBudget = sliceBudget_;
+        frameCount = frameCount_;
+        evalSec = avgEvalSec_;
+        displayLatency = displayLatency_;
+        detailScale = detailScale_;
+        weatherRequest = weatherRequest_;
+        weatherSeconds = weatherSeconds_;
+        weatherStart = weatherStart_;
+        A = A_;
+        wind = wind_;
+    }
+
+    // a newer resync restarts the step at the current time
+    if ( stepping_ && resync && resyncRequest != stepResyncRequest_ )
+        stepping_ = false;
+
+    if ( !stepping_ )
+    {
+        // sleep rather than spin when there's nothing to do, a resync is done right away
+        if ( !resync && suspended )
+            return SUSPEND_SLEEP_MS;
+
+        if ( !resync && processTimer_.GetMSec(false) < (unsigned)(interval * 1000.0f) )
+            return 1;
+    }
+
+    // one slice per rendered frame. A resync on the worker isn't sliced, the component is waiting for it
+    bool sliced = sliceBudget > 0.0f && !( threaded_ && ( stepping_ ? stepResync_ : resync ) );
+
+    if ( sliced )
+    {
+        if ( frameCount == slicedFrame_ )
+            return 1;
+
+        slicedFrame_ = frameCount;
+    }
+
+    HiresTimer evalTimer;
+
+    if ( !stepping_ )
+    {
+        processTimer_.Reset();
+        stepTimer_.Reset();
+        // evaluated at the display time it's predicted to be the newest frame until: it's published a step's
+        // wall time from now and replaced when the next one is, an interval or a step later. A resync is
+        // shown as soon as it's done
+        float lead = resync ? evalSec : Max( interval, avgStepWallSec_ ) + avgStepWallSec_;
+        stepTime_ = GetElapsedTime() + lead + displayLatency;
+        stepResync_ = resync;
+        stepResyncRequest_ = resyncRequest;
+        stepCostSec_ = 0.0f;
+        profiler_.DiscardStep();
+
+        if ( detailScale != detailMap_.GetScale() )
+        {
+            if ( detailScale == 0 || !detailMap_.Init( N_, A, wind, length_, seed_, detailScale ) )
+                detailMap_.Clear();
+        }
+
+        // weather blends between steps, a newer request starts from wherever the blend has got to
+        if ( weatherRequest != weatherDone_ )
+        {
+            // the spectrum's parameters stay the blend's start until it ends
+            float fromA = pCOcean->getA();
+            Vector2 fromWind = pCOcean->getWind();
+            bool exact = !blending_;
+            bool blending = pCOcean->beginBlend( A, wind );
+
+            if ( blending )
+                detailMap_.BeginBlend( A, wind );
+
+            MutexLock lock(mutexSettingsLock_);
+
+            if ( blending )
+            {
+                blendExact_ = exact;
+                blendFromA_ = fromA;
+                blendFromWind_ = fromWind;
+                blendStart_ = weatherStart == M_INFINITY ? stepTime_ : weatherStart;
+                blendSeconds_ = weatherSeconds;
+            }
+
+            weatherDone_ = weatherRequest;
+            blending_ = blending;
+        }
+
+        if ( blending_ )
+        {
+            float alpha = Clamp( ( stepTime_ - blendStart_ ) / blendSeconds_, 0.0f, 1.0f );
+
+            if ( alpha < 1.0f )
+            {
+                pCOcean->setBlend( alpha );
+                detailMap_.SetBlend( alpha );
+            }
+            else
+            {
+                pCOcean->endBlend();
+                detailMap_.EndBlend();
+
+                MutexLock lock(mutexSettingsLock_);
+                blending_ = false;
+            }
+        }
+
+        stepping_ = !BeginStep( stepTime_ );
+    }
+
+    if ( stepping_ )
+    {
+        if ( sliced )
+        {
+            long long budgetUSec = (long long)( sliceBudget * 1000.0f );
+
+            while ( !AdvanceStep( 1 ) && evalTimer.GetUSec(false) < budgetUSec )
+                ;
+        }
+        else
+        {
+            while ( !AdvanceStep( N_ ) )
+                ;
+        }
+
+        stepping_ = !pCOcean->isStepDone();
+    }
+
+    stepCostSec_ += evalTimer.GetUSec(false) / 1000000.0f;
+
+    if ( stepping_ )
+        return 0;
+
+    // the detail map isn't sliced, it's one pass after the step
+    if ( detailMap_.IsValid() )
+    {
+        URHO3D_PROFILE(OceanDetailMap);
+        HiresTimer detailTimer;
+        detailMap_.Evaluate( stepTime_ );
+        profiler_.Accumulate( OceanProfiler::Stage_DetailMap, detailTimer.GetUSec(false) );
+    }
+
+    // the frame is published once its step has completed, the lag covers the frames it was spread over
+    HiresTimer publishTimer;
+    PublishFrame( stepTime_, stepResync_ );
+    UpdateSimRate( stepCostSec_ );
+
+    // resyncs aren't sliced, they'd throw off the prediction for the regular steps
+    if ( !stepResync_ )
+    {
+        float stepWallSec = stepTimer_.GetUSec(false) / 1000000.0f;
+        avgStepWallSec_ = avgStepWallSec_ > 0.0f ? Lerp( avgStepWallSec_, stepWallSec, 0.1f ) : stepWallSec;
+    }
+
+    profiler_.Accumulate( OceanProfiler::Stage_Publish, publishTimer.GetUSec(false) );
+    profiler_.CommitStep();
+
+    if ( stepResync_ )
+    {
+        MutexLock lock(mutexSettingsLock_);
+        resyncDone_ = stepResyncRequest_;
+    }
+
+    return 0;
+}
+
+void OceanSimulation::BackgroundProcess()
+{
+    unsigned sleepMSec = Process();
+
+    if ( sleepMSec )
+        Time::Sleep( sleepMSec );
+}
+
+void OceanSimulation::HandleBeginFrame(StringHash /*eventType*/, VariantMap& eventData)
+{
+    using namespace BeginFrame;
+
+    // the vertices written this frame are shown once it's rendered, about a frame later
+    float timeStep = Min( eventData[P_TIMESTEP].GetFloat(), MAX_DISPLAY_LATENCY );
+
+    {
+        MutexLock lock(mutexSettingsLock_);
+        ++frameCount_;
+        displayLatency_ = displayLatency_ > 0.0f ? Lerp( displayLatency_, timeStep, 0.1f ) : timeStep;
+    }
+
+    if ( !threaded_ )
+        Process();
+}
+
+bool OceanSimulation::BeginStep(float t)
+{
+    pCOcean->setFiniteDifferenceNormals( GetNormalMode() == NormalMode_FiniteDifference );
+
+    // playback fills the vertices in one go
+    if ( ProcessFrameCache( t ) )
+        return true;
+
+    pCOcean->beginStep( t );
+    return false;
+}
+
+bool OceanSimulation::AdvanceStep(int units)
+{
+    // N units finish a stage that's at its start, one unit is a row or column of it
+    int stage = pCOcean->getStepStage();
+    HiresTimer timer;
+    bool done = false;
+
+    switch ( stage )
+    {
+    case step_evolve:   { URHO3D_PROFILE(OceanEvolveSpectrum);  done = pCOcean->advanceStep( units ); } break;
+    case step_spectrum: { URHO3D_PROFILE(OceanPackSpectrum);    done = pCOcean->advanceStep( units ); } break;
+    case step_rows:     { URHO3D_PROFILE(OceanFFTRows);         done = pCOcean->advanceStep( units ); } break;
+    case step_columns:  { URHO3D_PROFILE(OceanFFTColumns);      done = pCOcean->advanceStep( units ); } break;
+    case step_vertices: { URHO3D_PROFILE(OceanUpdateVertices);  done = pCOcean->advanceStep( units ); } break;
+    case step_normals:  { URHO3D_PROFILE(OceanFDNormals);       done = pCOcean->advanceStep( units ); } break;
+    default:            return pCOcean->advanceStep( units );
+    }
+
+    profiler_.Accumulate( (OceanProfiler::StageType)stage, timer.GetUSec(false) );
+
+    return done;
+}
+
+bool OceanSimulation::WriteVertices(float renderTime, vertex_ocean_compact *dest, Vector3 *positions, float *jacobians, const OceanShoreMask *shore)
+{
+    // a mask for another grid size is left until it's rebuilt for this one
+    const float *attenuation = shore && shore->IsValid() && shore->GetGridSize() == N_ ? shore->GetAttenuation() : NULL;
+
+    if ( IsPlayingRecording() )
+        return WriteRecordedVertices( renderTime, dest, positions, jacobians, attenuation );
+
+    if ( !TakeFrames() )
+        return false;
+
+    // interpolate the two most recent frames to render time
+    const SimFrame &frameB = renderFrames_[ renderNewest_ ];
+    const SimFrame &frameA = numRenderFrames_ > 1 ? renderFrames_[ renderNewest_ ^ 1 ] : frameB;
+    float alpha = 1.0f;
+
+    if ( frameB.time > frameA.time )
+        alpha = Clamp( (renderTime - frameA.time) / (frameB.time - frameA.time), 0.0f, 1.0f );
+
+    // outside the two frames the prediction was off, late frames are held and early ones wait
+    float errorSec = 0.0f;
+
+    if ( renderTime > frameB.time )
+        errorSec = renderTime - frameB.time;
+    else if ( renderTime < frameA.time )
+        errorSec = renderTime - frameA.time;
+
+    profiler_.Record( OceanProfiler::Stage_DisplayError, (long long)( errorSec * 1000000.0f ) );
+
+    EncodeVertices( &frameA.data[0], &frameB.data[0], alpha, dest, positions, jacobians, attenuation );
+
+    return true;
+}
+
+bool OceanSimulation::TakeFrames()
+{
+    // the frames published since the last call are swapped out for the render frames they replace, the
+    // worker packs its next frame into whatever buffer it gets back
+    MutexLock lock(mutexFrameLock_);
+
+    unsigned fresh = Min( publishedFrames_ - takenFrames_, numSimFrames_ );
+    takenFrames_ = publishedFrames_;
+
+    // a resync since the last call leaves only the frames published after it
+    numRenderFrames_ = fresh >= numSimFrames_ ? numSimFrames_ : Min( numRenderFrames_ + fresh, 2U );
+
+    for ( unsigned i = fresh; i > 0; --i )
+    {
+        SimFrame &frame = simFrames_[ i > 1 ? newestFrame_ ^ 1 : newestFrame_ ];
+
+        renderNewest_ ^= 1;
+        renderFrames_[ renderNewest_ ].data.Swap( frame.data );
+        renderFrames_[ renderNewest_ ].time = frame.time;
+    }
+
+    return numRenderFrames_ > 0;
+}
+
+bool OceanSimulation::WriteRecordedVertices(float renderTime, vertex_ocean_compact *dest, Vector3 *positions, float *jacobians, const float *attenuation)
+{
+    MutexLock lock(mutexRecordLock_);
+
+    unsigned numFrames = recording_.GetNumFrames();
+
+    if ( numFrames == 0 )
+        return false;
+
+    // loop over the recorded span, frames are read in place from the mapping
+    float firstTime = recording_.GetFrameTime( 0 );
+    float span = recording_.GetFrameTime( numFrames - 1 ) - firstTime;
+    float t = firstTime;
+
+    if ( span > 0.0f )
+    {
+        t = fmodf( renderTime - firstTime, span );
+        t = firstTime + ( t < 0.0f ? t + span : t );
+    }
+
+    unsigned frameA = recording_.FindFrame( t );
+    unsigned frameB = Min( frameA + 1, numFrames - 1 );
+    float timeA = recording_.GetFrameTime( frameA );
+    float timeB = recording_.GetFrameTime( frameB );
+    float alpha = timeB > timeA ? Clamp( (t - timeA) / (timeB - timeA), 0.0f, 1.0f ) : 0.0f;
+
+    EncodeVertices( recording_.GetFrame( frameA ), recording_.GetFrame( frameB ), alpha, dest, positions, jacobians, attenuation );
+
+    return true;
+}
+
+void OceanSimulation::EncodeVertices(const float *frameA, const float *frameB, float alpha, vertex_ocean_compact *dest, Vector3 *positions,
+                                     float *jacobians, const float *attenuation)
+{
+    const float *srcA = frameA;
+    const float *srcB = frameB;
+    float range = length_ * OCEAN_COMPACT_RANGE;
+    float spacing = length_ / N_;
+    int Nplus1 = N_ + 1;
+
+    // dry vertices are flat, and skip the interpolation
+    vertex_ocean_compact flat;
+    cOcean::encodeCompact( Vector3::ZERO, Vector3::UP, 1.0f, range, flat );
+
+    // displacement is stored relative to the undisplaced grid, same as cOcean's ox, oz
+    for ( int m = 0; m < Nplus1; ++m )
+    {
+        float oz = (m - N_ / 2.0f) * spacing;
+
+        for ( int n = 0; n < Nplus1; ++n, srcA += OCEAN_FRAME_FLOATS, srcB += OCEAN_FRAME_FLOATS, ++dest )
+        {
+            float ox = (n - N_ / 2.0f) * spacing;
+            float shore = attenuation ? *attenuation++ : 1.0f;
+
+            if ( shore == 0.0f )
+            {
+                *dest = flat;
+
+                if ( positions )
+                    *positions++ = Vector3( ox, 0.0f, oz );
+
+                if ( jacobians )
+                    *jacobians++ = 1.0f;
+
+                continue;
+            }
+
+            const Vector3 *vertA = reinterpret_cast<const Vector3*>( srcA );
+            const Vector3 *vertB = reinterpret_cast<const Vector3*>( srcB );
+            Vector3 vPos = vertA[0].Lerp( vertB[0], alpha );
+            Vector3 vNorm = vertA[1].Lerp( vertB[1], alpha ).Normalized();
+            Vector3 vDisp( vPos.x_ - ox, vPos.y_, vPos.z_ - oz );
+            float jacobian = Lerp( srcA[6], srcB[6], alpha );
+
+            // shallows keep a fraction of the waves, and their normals tilt back up by as much. The
+            // jacobian's departure from 1 is about linear in the displacement
+            if ( shore < 1.0f )
+            {
+                vDisp *= shore;
+                vPos = Vector3( ox, 0.0f, oz ) + vDisp;
+                vNorm = Vector3( vNorm.x_ * shore, vNorm.y_, vNorm.z_ * shore ).Normalized();
+                jacobian = 1.0f + ( jacobian - 1.0f ) * shore;
+            }
+
+            cOcean::encodeCompact( vDisp, vNorm, jacobian, range, *dest );
+
+            if ( positions )
+                *positions++ = vPos;
+
+            if ( jacobians )
+                *jacobians++ = jacobian;
+        }
+    }
+}
@@ -0,0 +1,277 @@
+//=============================================================================
+// Copyright (c) 2016 Lumak
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//=============================================================================
+
+#pragma once
+
+#include <Urho3D/Core/Object.h>
+#include <Urho3D/Core/Mutex.h>
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/Container/HashMap.h>
+#include <Urho3D/Container/Vector.h>
+
+#include "HelperThread.h"
+#include "OceanDetailMap.h"
+#include "OceanFrameCache.h"
+#include "OceanProfiler.h"
+#include "OceanRecording.h"
+
+namespace Urho3D
+{
+class Image;
+}
+
+using namespace Urho3D;
+
+class cOcean;
+class Ocean;
+class OceanShoreMask;
+struct vertex_ocean_compact;
+
+//=============================================================================
+// The FFT simulation, its worker thread and the two most recent frames.
+// Components with the same ocean parameters share one simulation, which runs
+// as fast as the most demanding of them needs.
+//=============================================================================
+class OceanSimulation : public Object
+{
+    URHO3D_OBJECT(OceanSimulation, Object);
+
+public:
+    enum SimModeType { SimMode_FFT, SimMode_Playback, SimMode_Recording };
+    enum NormalModeType { NormalMode_FFT, NormalMode_FiniteDifference };
+
+    // a simulated frame - position, normal and jacobian per vertex, packFrame() layout
+    struct SimFrame
+    {
+        PODVector<float> data;
+        float            time;
+    };
+
+public:
+    // returns the running simulation for these parameters or starts a new one. A new simulation
+    // generates its spectrum on its worker thread and has no frames until IsReady()
+    static SharedPtr<OceanSimulation> Acquire(Context *context, int N, float A, const Vector2 &wind, float length, unsigned seed);
+
+    virtual ~OceanSimulation();
+
+    int GetGridSize() const             { return N_; }
+    float GetPatchLength() const        { return length_; }
+    unsigned GetSeed() const            { return seed_; }
+
+    // weather - the spectrum is blended from the current amplitude and wind to these over the given
+    // seconds of ocean time, with no second simulation. The blend starts at the next step, or at the
+    // ocean time start, e.g. a host's. The simulation is re-registered under the new parameters,
+    // components sharing it follow
+    void SetWeather(float A, const Vector2 &wind, float seconds, float start = M_INFINITY);
+    float GetAmplitude();
+    Vector2 GetWind();
+    bool IsWeatherBlending();
+
+    // the blend under way, if any. Returns false when it can't be reproduced from these - the request
+    // hasn't reached the worker yet, or the blend started part way through another
+    bool GetWeatherBlend(bool &blending, float &fromA, Vector2 &fromWind, float &start, float &seconds);
+
+    // the ocean's time, SetTime() moves it, e.g. to a host's OceanState, and resyncs the frames
+    float GetElapsedTime();
+    void SetTime(float t);
+
+    // when a frame written now will be on screen, about a frame's time ahead. Steps are evaluated
+    // at the display time predicted for them, so frames are interpolated to this with no lag
+    float GetDisplayTime();
+    bool IsReady();
+
+    // takes the simulation out of the registry and asks the worker to exit without waiting,
+    // returns true once it has and the simulation can be released without blocking
+    bool Shutdown();
+
+    // baked playback
+    void SetSimMode(SimModeType mode);
+    SimModeType GetSimMode();
+    void BakeFrames(float framesPerSec, unsigned maxBytes);
+    bool IsBakeComplete();
+    bool SaveFrameCache(const String &fileName);
+    bool LoadFrameCache(const String &fileName);
+
+    // recording - every published frame is appended to the file. SimMode_Recording renders a loaded
+    // recording straight from its mapping instead, looping over its time span, and the FFT suspends
+    bool StartRecording(const String &fileName);
+    void StopRecording();
+    bool IsRecording();
+    bool LoadRecording(const String &fileName);
+
+    // finite difference normals skip the slope FFT, for distant or low-end oceans
+    void SetNormalMode(NormalModeType mode);
+    NormalModeType GetNormalMode();
+
+    // adaptive rate - the simulation runs as often as its share of a core allows, within
+    // the min and max rates, and the two most recent frames are interpolated to render time
+    void SetCpuBudget(float fraction);
+    float GetCpuBudget();
+    void SetSimRateRange(float minHz, float maxHz);
+    void GetSimRateRange(float &minHz, float &maxHz);
+    float GetSimRate();
+
+    // time slicing - each rendered frame runs at most budgetMs of a step, and a frame is only
+    // published once its step completes. 0 runs whole steps, unless there's no worker thread
+    void SetTimeSlice(float budgetMs);
+    float GetTimeSlice();
+    bool IsThreaded() const             { return threaded_; }
+
+    // detail normal map at scale times the grid size, evaluated with each frame, 0 for none. GetDetailMap()
+    // copies the newest into the image if it's changed since version, main thread only
+    void SetDetailScale(int scale);
+    int GetDetailScale();
+    bool GetDetailMap(Image *image, unsigned &version);
+
+    // per stage timings of the steps, components add their vertex buffer updates
+    OceanProfiler& GetProfiler()        { return profiler_; }
+
+    // clients - each component caps the rate it needs, 0 while it needs no frames. The simulation
+    // runs at the highest cap and suspends when all are 0. Main thread only.
+    void SetClientRateCap(Ocean *client, float hz);
+    void RemoveClient(Ocean *client);
+    unsigned RequestResync();
+    bool IsResynced(unsigned request);
+
+    // interpolate the two most recent frames to renderTime and write them in the compact format,
+    // positions and jacobians also go to the optional arrays. The optional shore mask damps the waves
+    // as they're packed
+    bool WriteVertices(float renderTime, vertex_ocean_compact *dest, Vector3 *positions, float *jacobians, const OceanShoreMask *shore = NULL);
+
+protected:
+    OceanSimulation(Context *context, const String &key, int N, float A, const Vector2 &wind, float length, unsigned seed);
+    static String MakeKey(int N, float A, const Vector2 &wind, float length, unsigned seed);
+
+    bool BeginStep(float t);
+    bool AdvanceStep(int units);
+    bool ProcessFrameCache(float t);
+    bool IsPlayingRecording();
+    bool TakeFrames();
+    bool WriteRecordedVertices(float renderTime, vertex_ocean_compact *dest, Vector3 *positions, float *jacobians, const float *attenuation);
+    void EncodeVertices(const float *frameA, const float *frameB, float alpha, vertex_ocean_compact *dest, Vector3 *positions,
+                        float *jacobians, const float *attenuation);
+
+    // threading, Process() returns the ms the worker can sleep for
+    void PublishFrame(float t, bool resync);
+    void UpdateSimRate(float evalSec);
+    void UpdateRateCap();
+    unsigned Process();
+    void BackgroundProcess();
+    void HandleBeginFrame(StringHash eventType, VariantMap& eventData);
+
+protected:
+    // ocean, A_ and wind_ are under mutexSettingsLock_
+    cOcean          *pCOcean;
+    int             N_;
+    float           A_;
+    Vector2         wind_;
+    float           length_;
+    unsigned        seed_;
+    String          key_;
+
+    // baked playback
+    OceanFrameCache  frameCache_;
+    Mutex            mutexCacheLock_;
+    SimModeType      simMode_;
+    float            bakeFrameRate_;
+    unsigned         bakeMaxBytes_;
+    bool             bakeRequested_;
+
+    // recording, appended to on the worker and played back on the main thread
+    OceanRecorder    recorder_;
+    OceanRecording   recording_;
+    Mutex            mutexRecordLock_;
+
+    // simulated frames, simFrames_[newestFrame_] is the latest. publishFrame_ is the worker's, packed
+    // before it's swapped in
+    SimFrame            simFrames_[2];
+    SimFrame            publishFrame_;
+    unsigned            newestFrame_;
+    unsigned            numSimFrames_;
+    unsigned            publishedFrames_;
+    PODVector<unsigned char> detailData_;
+    int                 detailSize_;
+    unsigned            detailVersion_;
+    Mutex               mutexFrameLock_;
+
+    // the main thread's two most recent frames, taken from simFrames_ and encoded from outside the lock
+    SimFrame            renderFrames_[2];
+    unsigned            renderNewest_;
+    unsigned            numRenderFrames_;
+    unsigned            takenFrames_;
+
+    // background thread
+    HelperThread<OceanSimulation> *threadProcess_;
+    Mutex               mutexSettingsLock_;
+    NormalModeType      normalMode_;
+    float               cpuBudget_;
+    float               minSimRate_;
+    float               maxSimRate_;
+    float               simInterval_;
+    float               avgEvalSec_;
+    float               displayLatency_;
+    SharedPtr<Time>     elapsedFrameTimer_;
+    float               timeOffset_;
+    Timer               processTimer_;
+    bool                threaded_;
+
+    // time slicing, the budget and frame count are under mutexSettingsLock_, the step is the worker's
+    float               sliceBudget_;
+    unsigned            frameCount_;
+    unsigned            slicedFrame_;
+    bool                stepping_;
+    float               stepTime_;
+    bool                stepResync_;
+    unsigned            stepResyncRequest_;
+    float               stepCostSec_;
+    float               avgStepWallSec_;
+    HiresTimer          stepTimer_;
+
+    // stage timings
+    OceanProfiler       profiler_;
+
+    // detail map, the scale is under mutexSettingsLock_ and the map is the worker's
+    int                 detailScale_;
+    OceanDetailMap      detailMap_;
+
+    // weather, under mutexSettingsLock_, the blend is only written by the worker
+    unsigned            weatherRequest_;
+    float               weatherSeconds_;
+    float               weatherStart_;
+    unsigned            weatherDone_;
+    bool                blending_;
+    bool                blendExact_;
+    float               blendFromA_;
+    Vector2             blendFromWind_;
+    float               blendStart_;
+    float               blendSeconds_;
+
+    // clients, the combined rate cap and resync are passed to the worker under mutexSettingsLock_
+    HashMap<Ocean*, float> clientRateCaps_;
+    float               simRateCap_;
+    bool                suspended_;
+    unsigned            resyncRequest_;
+    unsigned            resyncDone_;
+
+    static HashMap<String, OceanSimulation*> simulations_;
+};
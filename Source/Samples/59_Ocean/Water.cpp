@@ -25,6 +25,7 @@
 
 #include <Urho3D/Graphics/Camera.h>
 #include <Urho3D/Core/CoreEvents.h>
+#include <Urho3D/Core/StringUtils.h>
 #include <Urho3D/Engine/Engine.h>
 #include <Urho3D/IO/File.h>
 #include <Urho3D/IO/FileSystem.h>
@@ -46,9 +47,16 @@
 #include <SDL/SDL_log.h>
 #include <Urho3D/Graphics/StaticModel.h>
 #include <Urho3D/Graphics/DebugRenderer.h>
+#include <Urho3D/Math/Ray.h>
+#ifdef URHO3D_PHYSICS
+#include <Urho3D/Physics/CollisionShape.h>
+#include <Urho3D/Physics/PhysicsWorld.h>
+#include <Urho3D/Physics/RigidBody.h>
+#endif
 
 #include "Water.h"
 #include "Ocean.h"
+#include "OceanHull.h"
 
 #include <Urho3D/DebugNew.h>
 
@@ -60,12 +68,14 @@ URHO3D_DEFINE_APPLICATION_MAIN(Water)
 //=============================================================================
 Water::Water(Context* context) 
     : Sample(context)
-    , fpsCounter_(0)
+    , stormy_(false)
     , m_dbgShow(false)
+    , fpsCounter_(0)
 {
     // register objects
     DStaticModel::RegisterObject(context);
     Ocean::RegisterObject(context);
+    OceanHull::RegisterObject(context);
 }
 
 Water::~Water()
@@ -92,6 +102,9 @@ void Water::Start()
     // Execute base class startup
     Sample::Start();
 
+    // where F9 records the ocean to and F10 plays it back from
+    recordingFile_ = GetSubsystem<FileSystem>()->GetAppPreferencesDir("urho3d", "59_Ocean") + "OceanRecording.orec";
+
     // Create the scene content
     CreateScene();
 
@@ -118,6 +131,11 @@ void Water::CreateScene()
     // Create octree, use default volume (-1000, -1000, -1000) to (1000, 1000, 1000)
     scene_->CreateComponent<Octree>();
 
+#ifdef URHO3D_PHYSICS
+    // for the boats
+    scene_->CreateComponent<PhysicsWorld>();
+#endif
+
     // Create a Zone component for ambient lighting & fog control
     Node* zoneNode = scene_->CreateChild("Zone");
     Zone* zone = zoneNode->CreateComponent<Zone>();
@@ -175,12 +193,17 @@ void Water::CreateScene()
 
     // create and start
     m_pOcean = oceanNode_->CreateComponent<Ocean>();
+    m_pOcean->SetDetailScale( 2 );
     m_pOcean->InitOcean();
+    m_pOcean->SetShoreTerrain( terrain, 6.0f );
 
     m_pStaticModelOcean = oceanNode_->CreateComponent<DStaticModel>();
     m_pStaticModelOcean->SetModel( m_pOcean->GetOceanModel() );
-    m_pStaticModelOcean->SetMaterial(cache->GetResource<Material>("Ocean/MatOcean.xml"));
+    m_pStaticModelOcean->SetMaterial(cache->GetResource<Material>("Ocean/MatOceanDetail.xml"));
     m_pStaticModelOcean->SetViewMask(0x80000000);
+
+    // schedules the simulation by the model's visibility
+    m_pOcean->SetDrawable( m_pStaticModelOcean );
 }
 
 //=============================================================================
@@ -193,7 +216,12 @@ void Water::CreateInstructions()
     
     // Construct new Text object, set string to display and font to use
     Text* instructionText = ui->GetRoot()->CreateChild<Text>();
-    instructionText->SetText("Use WASD keys and mouse/touch to move");
+    String instructions = "Use WASD keys and mouse/touch to move\nSpace to splash, F6 for a storm\n";
+#ifdef URHO3D_PHYSICS
+    instructions += "F4 to drop a boat\n";
+#endif
+    instructions += "F8 for ocean timings, F9 to record, F10 to play the recording";
+    instructionText->SetText(instructions);
     instructionText->SetFont(cache->GetResource<Font>("Fonts/Anonymous Pro.ttf"), 15);
     instructionText->SetTextAlignment(HA_CENTER);
     
@@ -208,6 +236,12 @@ void Water::CreateInstructions()
     fpsText_->SetPosition(graphics->GetWidth() - 100, 5);
     fpsText_->SetColor(Color::BLACK);
     fpsText_->SetText("60");
+
+    profileText_ = ui->GetRoot()->CreateChild<Text>();
+    profileText_->SetFont(cache->GetResource<Font>("Fonts/Anonymous Pro.ttf"), 12);
+    profileText_->SetPosition(5, 5);
+    profileText_->SetColor(Color::BLACK);
+    profileText_->SetVisible(false);
 }
 
 //=============================================================================
@@ -294,6 +328,9 @@ void Water::HandleUpdate(StringHash eventType, VariantMap& eventData)
         fpsText_->SetText(String("fps: ") + String(fpsCounter_));
         fpsCounter_ = 0;
         timerFps_.Reset();
+
+        if ( profileText_->IsVisible() )
+            UpdateProfileText();
     }
 
     Input* input = GetSubsystem<Input>();
@@ -308,6 +345,109 @@ void Water::HandleUpdate(StringHash eventType, VariantMap& eventData)
         m_pOcean->DbgRender();
     }
 
+    if ( input->GetKeyPress( KEY_F8 ) )
+    {
+        profileText_->SetVisible( !profileText_->IsVisible() );
+        UpdateProfileText();
+    }
+
+    // splash where the camera's looking
+    if ( input->GetKeyPress( KEY_SPACE ) )
+    {
+        Ray ray( cameraNode_->GetWorldPosition(), cameraNode_->GetWorldDirection() );
+        float distance = ray.HitDistance( Plane( Vector3::UP, oceanNode_->GetWorldPosition() ) );
+
+        if ( distance < M_INFINITY )
+            m_pOcean->AddDisturbance( ray.origin_ + ray.direction_ * distance, 40.0f, 4.0f );
+    }
+
+#ifdef URHO3D_PHYSICS
+    // drop a boat where the camera's looking, its hull floats it on the waves
+    if ( input->GetKeyPress( KEY_F4 ) )
+    {
+        Ray ray( cameraNode_->GetWorldPosition(), cameraNode_->GetWorldDirection() );
+        float distance = ray.HitDistance( Plane( Vector3::UP, oceanNode_->GetWorldPosition() ) );
+
+        if ( distance < M_INFINITY )
+        {
+            ResourceCache* cache = GetSubsystem<ResourceCache>();
+            Model *boxModel = cache->GetResource<Model>("Models/Box.mdl");
+
+            Node *boatNode = scene_->CreateChild("Boat");
+            boatNode->SetPosition( ray.origin_ + ray.direction_ * distance + Vector3( 0.0f, 8.0f, 0.0f ) );
+            boatNode->SetRotation( Quaternion( 0.0f, cameraNode_->GetRotation().YawAngle(), 0.0f ) );
+            boatNode->SetScale( Vector3( 4.0f, 2.0f, 10.0f ) );
+
+            StaticModel *boatModel = boatNode->CreateComponent<StaticModel>();
+            boatModel->SetModel( boxModel );
+            boatModel->SetMaterial( cache->GetResource<Material>("Materials/Stone.xml") );
+            boatModel->SetCastShadows( true );
+
+            // floats about a third under, the damping stands in for the water's drag
+            RigidBody *body = boatNode->CreateComponent<RigidBody>();
+            body->SetMass( 25000.0f );
+            body->SetLinearDamping( 0.4f );
+            body->SetAngularDamping( 0.6f );
+            boatNode->CreateComponent<CollisionShape>()->SetBox( Vector3::ONE );
+
+            OceanHull *hull = boatNode->CreateComponent<OceanHull>();
+            hull->SetHullModel( boxModel );
+            hull->SetOcean( m_pOcean );
+        }
+    }
+#endif
+
+    // the storm builds and dies down over 20 seconds, powers of 2 so calm comes back exactly
+    if ( input->GetKeyPress( KEY_F6 ) )
+    {
+        stormy_ = !stormy_;
+        float scale = stormy_ ? 2.0f : 0.5f;
+        m_pOcean->SetWeather( m_pOcean->GetAmplitude() * scale * scale, m_pOcean->GetWind() * scale, 20.0f );
+    }
+
+    // record what the ocean does, or play the recording back in place of the simulation
+    OceanSimulation *simulation = m_pOcean->GetSimulation();
+
+    if ( simulation && input->GetKeyPress( KEY_F9 ) )
+    {
+        if ( simulation->IsRecording() )
+            simulation->StopRecording();
+        else
+            simulation->StartRecording( recordingFile_ );
+    }
+
+    if ( simulation && input->GetKeyPress( KEY_F10 ) )
+    {
+        if ( simulation->GetSimMode() == OceanSimulation::SimMode_Recording )
+            simulation->SetSimMode( OceanSimulation::SimMode_FFT );
+        else if ( !simulation->IsRecording() && simulation->LoadRecording( recordingFile_ ) )
+            simulation->SetSimMode( OceanSimulation::SimMode_Recording );
+    }
+
+}
+
+//=============================================================================
+//=============================================================================
+void Water::UpdateProfileText()
+{
+    OceanSimulation *simulation = m_pOcean->GetSimulation();
+
+    if ( !simulation )
+        return;
+
+    OceanProfiler &profiler = simulation->GetProfiler();
+    OceanProfiler::StageStats stats;
+    String text = ToString( "ocean N=%d  %.1f Hz\n%-14s %7s %7s %7s\n", simulation->GetGridSize(), simulation->GetSimRate(), "ms", "last", "avg", "max" );
+
+    for ( int i = 0; i < OceanProfiler::Stage_Max; ++i )
+    {
+        OceanProfiler::StageType stage = (OceanProfiler::StageType)i;
+
+        if ( profiler.GetStats( stage, stats ) )
+            text += ToString( "%-14s %7.3f %7.3f %7.3f\n", OceanProfiler::GetStageName( stage ), stats.lastMs, stats.avgMs, stats.maxMs );
+    }
+
+    profileText_->SetText( text );
 }
 
 //=============================================================================
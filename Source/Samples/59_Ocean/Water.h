@@ -86,6 +86,8 @@ private:
     void MoveCamera(float timeStep);
     /// Handle the logic update event.
     void HandleUpdate(StringHash eventType, VariantMap& eventData);
+    /// Show the ocean's stage timings.
+    void UpdateProfileText();
 
 private:
     /// Reflection camera scene node.
@@ -103,6 +105,8 @@ private:
 
     SharedPtr<DStaticModel> m_pStaticModelOcean;
     BoundingBox m_boundingbox;
+    bool stormy_;
+    String recordingFile_;
 
     // dbg
     SharedPtr<DebugRenderer> m_pDbgRenderer;
@@ -110,6 +114,7 @@ private:
     SharedPtr<Text> fpsText_;
     int fpsCounter_;
     Timer timerFps_;
+    SharedPtr<Text> profileText_;
 
 };
 
@@ -21,6 +21,7 @@
 //
 
 #include <Urho3D/Core/CoreEvents.h>
+#include <Urho3D/Core/WorkQueue.h>
 #include <Urho3D/Engine/Engine.h>
 #include <Urho3D/Graphics/Camera.h>
 #include <Urho3D/Graphics/Graphics.h>
@@ -57,6 +58,29 @@
 #define VERT_INDEX_VISUAL
 #endif
 
+// replication - instances are transformed in blocks of this many, one per SIMD lane, and
+// a work queue task gets at least MIN_INSTANCES_PER_TASK of them
+#define REPLICATE_BLOCK_SIZE        8
+#define MIN_INSTANCES_PER_TASK      1024
+
+// wind animation - verts move back at half the speed they're blown out at, and geoms
+// start up to WIND_PHASE_RANGE secs into the cycle
+#define WIND_REVERSE_DIRECTION      -0.5f
+#define WIND_PHASE_RANGE            0.2f
+
+//=============================================================================
+//=============================================================================
+// the analytic wind's phase for a geom, hashed from its index
+static float GeomWindPhase(unsigned geomIndex)
+{
+    unsigned h = geomIndex * 0x9e3779b1u;
+    h ^= h >> 15;
+    h *= 0x85ebca77u;
+    h ^= h >> 13;
+
+    return (float)( h & 0xffffff ) / 16777216.0f * WIND_PHASE_RANGE;
+}
+
 //=============================================================================
 //=============================================================================
 unsigned GeomReplicator::Replicate(const PODVector<PRotScale> &qplist, const Vector3 &normalOverride)
@@ -67,6 +91,7 @@ unsigned GeomReplicator::Replicate(const PODVector<PRotScale> &qplist, const Vec
     unsigned uElementMask = pVbuffer->GetElementMask();
     unsigned vertexSize = pVbuffer->GetVertexSize();
     unsigned numVertices = pVbuffer->GetVertexCount();
+    unsigned numInstances = qplist.Size();
 
     // for movement
     numVertsPerGeom = numVertices;
@@ -85,107 +110,227 @@ unsigned GeomReplicator::Replicate(const PODVector<PRotScale> &qplist, const Vec
         pVbuffer->Unlock();
     }
 
+    // for movement, the animation's configured again for the new geoms
+    numGeoms_ = numInstances;
+    animPhases_.Clear();
+    animDirections_.Clear();
+    animDeltas_.Clear();
+    animOrigPositions_.Clear();
+
     // replicate
-    pVbuffer->SetSize( numVertices * qplist.Size(), uElementMask );
-    pVertexData = (unsigned char*)pVbuffer->Lock(0, pVbuffer->GetVertexCount());
-    bool overrideNormal = normalOverride != Vector3::ZERO;
+    pVbuffer->SetSize( numVertices * numInstances, uElementMask );
+    unsigned char *pDestData = (unsigned char*)pVbuffer->Lock(0, pVbuffer->GetVertexCount());
 
-    if ( pVertexData )
+    if ( pDestData )
     {
-        for ( unsigned i = 0; i < qplist.Size(); ++i )
+        // split the instances across the work queue threads, the main thread takes a share in Complete()
+        WorkQueue *queue = GetSubsystem<WorkQueue>();
+        unsigned numTasks = Min( queue->GetNumThreads() + 1, (numInstances + MIN_INSTANCES_PER_TASK - 1) / MIN_INSTANCES_PER_TASK );
+        unsigned instancesPerTask = numTasks ? (numInstances + numTasks - 1) / numTasks : 0;
+        Vector<ReplicateTask> tasks( numTasks );
+
+        for ( unsigned i = 0; i < numTasks; ++i )
+        {
+            ReplicateTask &task = tasks[i];
+            task.instances      = &qplist[0];
+            task.origVerts      = origVertBuff.Get();
+            task.destVerts      = pDestData;
+            task.begin          = i * instancesPerTask;
+            task.end            = Min( task.begin + instancesPerTask, numInstances );
+            task.numVertices    = numVertices;
+            task.vertexSize     = vertexSize;
+            task.elementMask    = uElementMask;
+            task.normalOverride = normalOverride;
+
+            SharedPtr<WorkItem> item = queue->GetFreeItem();
+            item->priority_ = M_MAX_UNSIGNED;
+            item->workFunction_ = ReplicateWork;
+            item->aux_ = &task;
+            queue->AddWorkItem( item );
+        }
+
+        queue->Complete( M_MAX_UNSIGNED );
+
+        for ( unsigned i = 0; i < numTasks; ++i )
+        {
+            bbox.Merge( tasks[i].bbox );
+        }
+
+        #ifdef VERT_INDEX_VISUAL
+        // text3d dbg
+        if ( numInstances > 0 )
         {
-            Quaternion rot(qplist[i].rot);
-            Matrix3x4 mat(qplist[i].pos, rot, qplist[i].scale);
-            unsigned begOfGeomAnimVertIndex = animatedVertexList_.Size();
+            ResourceCache* cache = GetSubsystem<ResourceCache>();
 
             for ( unsigned j = 0; j < numVertices; ++j )
             {
-                unsigned char *pOrigDataAlign = (unsigned char *)(origVertBuff.Get() + j * vertexSize);
-                unsigned char *pDataAlign = (unsigned char *)(pVertexData + (i * numVertices + j) * vertexSize);
-                unsigned sizeRemaining = vertexSize;
+                const Vector3 &nPos = *reinterpret_cast<Vector3*>( pDestData + j * vertexSize );
+                Node* textNode = GetScene()->CreateChild();
+                textNode->SetPosition(nPos + Vector3(0.0f, 0.1f, 0.0f));
+                textNode->SetEnabled(false);
+
+                Text3D* text3d = textNode->CreateComponent<Text3D>();
+                text3d->SetText( String(j) );
+                text3d->SetFont(cache->GetResource<Font>("Fonts/Anonymous Pro.ttf"), 12);
+                text3d->SetColor(Color::YELLOW);
+                text3d->SetFaceCameraMode(FC_ROTATE_XYZ);
+
+                nodeText3DVertList_.Push(textNode);
+            }
+        }
+        #endif
 
-                // position
-                const Vector3 &vPos = *reinterpret_cast<Vector3*>( pOrigDataAlign );
-                Vector3 &nPos = *reinterpret_cast<Vector3*>( pDataAlign );
-                nPos = mat * vPos;
+        //unlock
+        pVbuffer->Unlock();
+    }
 
-                pOrigDataAlign += sizeof(Vector3);
-                pDataAlign     += sizeof(Vector3);
-                sizeRemaining  -= sizeof(Vector3);
+    // replicate indeces
+    unsigned newIdxCount = ReplicateIndeces(pIbuffer, numVertices, numInstances);
 
-                // for movement
-                MoveAccumulator movPt;
-                movPt.origPos = nPos;
+    // set draw range and bounding box
+    pGeometry->SetDrawRange(TRIANGLE_LIST, 0, newIdxCount);
+    SetBoundingBox( bbox );
 
-                // sync timers for verts in the same geom
-                if ( j > 0 )
-                {
-                    movPt.timeAccumlated = animatedVertexList_[begOfGeomAnimVertIndex].timeAccumlated;
-                }
-                animatedVertexList_.Push(movPt);
+    return numInstances;
+}
 
-                // bbox
-                bbox.Merge(nPos);
+void GeomReplicator::ReplicateWork(const WorkItem *item, unsigned /*threadIndex*/)
+{
+    TransformInstances( *reinterpret_cast<ReplicateTask*>( item->aux_ ) );
+}
 
-                #ifdef VERT_INDEX_VISUAL
-                // text3d dbg
-                if ( i == 0 )
-                {
-                    ResourceCache* cache = GetSubsystem<ResourceCache>();
-                    //Scene *scene = GetScene();
-                    Node* textNode = GetScene()->CreateChild();
-                    textNode->SetPosition(nPos + Vector3(0.0f, 0.1f, 0.0f));
-                    textNode->SetEnabled(false);
-
-                    Text3D* text3d = textNode->CreateComponent<Text3D>();
-                    text3d->SetText( String(j) );
-                    text3d->SetFont(cache->GetResource<Font>("Fonts/Anonymous Pro.ttf"), 12);
-                    text3d->SetColor(Color::YELLOW);
-                    text3d->SetFaceCameraMode(FC_ROTATE_XYZ);
-
-                    nodeText3DVertList_.Push(textNode);
-                }
-                #endif
+void GeomReplicator::TransformInstances(ReplicateTask &task)
+{
+    // transforms for a block of instances, laid out so each row is one matrix element
+    // and the per vertex math below runs across the block in SIMD lanes
+    float m[12][REPLICATE_BLOCK_SIZE];
+    float r[9][REPLICATE_BLOCK_SIZE];
+    float x[REPLICATE_BLOCK_SIZE], y[REPLICATE_BLOCK_SIZE], z[REPLICATE_BLOCK_SIZE];
+    float minX[REPLICATE_BLOCK_SIZE], minY[REPLICATE_BLOCK_SIZE], minZ[REPLICATE_BLOCK_SIZE];
+    float maxX[REPLICATE_BLOCK_SIZE], maxY[REPLICATE_BLOCK_SIZE], maxZ[REPLICATE_BLOCK_SIZE];
+
+    const unsigned numVertices = task.numVertices;
+    const unsigned vertexSize = task.vertexSize;
+    const unsigned instanceSize = numVertices * vertexSize;
+    const bool hasNormal = ( task.elementMask & MASK_NORMAL ) != 0;
+    const bool overrideNormal = task.normalOverride != Vector3::ZERO;
+
+    // position, then normal - let's not make any assumptions that the normals exist for every model
+    const unsigned normalOffset = sizeof(Vector3);
+    const unsigned copyOffset = hasNormal ? 2 * sizeof(Vector3) : sizeof(Vector3);
+    const unsigned sizeRemaining = vertexSize - copyOffset;
+
+    for ( unsigned k = 0; k < REPLICATE_BLOCK_SIZE; ++k )
+    {
+        minX[k] = minY[k] = minZ[k] = M_INFINITY;
+        maxX[k] = maxY[k] = maxZ[k] = -M_INFINITY;
+    }
+
+    for ( unsigned blockBeg = task.begin; blockBeg < task.end; blockBeg += REPLICATE_BLOCK_SIZE )
+    {
+        const unsigned count = Min( (unsigned)REPLICATE_BLOCK_SIZE, task.end - blockBeg );
+
+        for ( unsigned k = 0; k < count; ++k )
+        {
+            const PRotScale &qp = task.instances[blockBeg + k];
+            Matrix3x4 mat( qp.pos, qp.rot, qp.scale );
+            Matrix3 rot = qp.rot.RotationMatrix();
+
+            m[0][k] = mat.m00_; m[1][k] = mat.m01_; m[2][k]  = mat.m02_; m[3][k]  = mat.m03_;
+            m[4][k] = mat.m10_; m[5][k] = mat.m11_; m[6][k]  = mat.m12_; m[7][k]  = mat.m13_;
+            m[8][k] = mat.m20_; m[9][k] = mat.m21_; m[10][k] = mat.m22_; m[11][k] = mat.m23_;
+
+            r[0][k] = rot.m00_; r[1][k] = rot.m01_; r[2][k] = rot.m02_;
+            r[3][k] = rot.m10_; r[4][k] = rot.m11_; r[5][k] = rot.m12_;
+            r[6][k] = rot.m20_; r[7][k] = rot.m21_; r[8][k] = rot.m22_;
+        }
+
+        // a partial block repeats its last instance in the spare lanes, which keeps the bbox exact
+        for ( unsigned k = count; k < REPLICATE_BLOCK_SIZE; ++k )
+        {
+            for ( unsigned e = 0; e < 12; ++e ) m[e][k] = m[e][count - 1];
+            for ( unsigned e = 0; e < 9; ++e )  r[e][k] = r[e][count - 1];
+        }
+
+        for ( unsigned j = 0; j < numVertices; ++j )
+        {
+            const unsigned char *pOrigDataAlign = task.origVerts + j * vertexSize;
+            unsigned char *pDataAlign = task.destVerts + blockBeg * instanceSize + j * vertexSize;
+
+            // position
+            const Vector3 &vPos = *reinterpret_cast<const Vector3*>( pOrigDataAlign );
+
+            for ( unsigned k = 0; k < REPLICATE_BLOCK_SIZE; ++k )
+            {
+                x[k] = m[0][k] * vPos.x_ + m[1][k] * vPos.y_ + m[2][k]  * vPos.z_ + m[3][k];
+                y[k] = m[4][k] * vPos.x_ + m[5][k] * vPos.y_ + m[6][k]  * vPos.z_ + m[7][k];
+                z[k] = m[8][k] * vPos.x_ + m[9][k] * vPos.y_ + m[10][k] * vPos.z_ + m[11][k];
+            }
+
+            // bbox
+            for ( unsigned k = 0; k < REPLICATE_BLOCK_SIZE; ++k )
+            {
+                minX[k] = x[k] < minX[k] ? x[k] : minX[k];
+                minY[k] = y[k] < minY[k] ? y[k] : minY[k];
+                minZ[k] = z[k] < minZ[k] ? z[k] : minZ[k];
+                maxX[k] = x[k] > maxX[k] ? x[k] : maxX[k];
+                maxY[k] = y[k] > maxY[k] ? y[k] : maxY[k];
+                maxZ[k] = z[k] > maxZ[k] ? z[k] : maxZ[k];
+            }
+
+            for ( unsigned k = 0; k < count; ++k )
+            {
+                *reinterpret_cast<Vector3*>( pDataAlign + k * instanceSize ) = Vector3( x[k], y[k], z[k] );
+            }
+
+            // normal
+            if ( hasNormal )
+            {
+                const Vector3 &vNorm = *reinterpret_cast<const Vector3*>( pOrigDataAlign + normalOffset );
 
-                // normal - let's not make any assumptions that the normals exist for every model
-                if ( uElementMask & MASK_NORMAL )
+                if ( !overrideNormal )
                 {
-                    const Vector3 &vNorm = *reinterpret_cast<Vector3*>( pOrigDataAlign );
-                    Vector3 &norm = *reinterpret_cast<Vector3*>( pDataAlign );
+                    for ( unsigned k = 0; k < REPLICATE_BLOCK_SIZE; ++k )
+                    {
+                        x[k] = r[0][k] * vNorm.x_ + r[1][k] * vNorm.y_ + r[2][k] * vNorm.z_;
+                        y[k] = r[3][k] * vNorm.x_ + r[4][k] * vNorm.y_ + r[5][k] * vNorm.z_;
+                        z[k] = r[6][k] * vNorm.x_ + r[7][k] * vNorm.y_ + r[8][k] * vNorm.z_;
+                    }
 
-                    if ( !overrideNormal )
+                    for ( unsigned k = 0; k < count; ++k )
                     {
-                        norm = rot * vNorm;
+                        *reinterpret_cast<Vector3*>( pDataAlign + k * instanceSize + normalOffset ) = Vector3( x[k], y[k], z[k] );
                     }
-                    else
+                }
+                else
+                {
+                    for ( unsigned k = 0; k < count; ++k )
                     {
-                        norm = normalOverride;
+                        *reinterpret_cast<Vector3*>( pDataAlign + k * instanceSize + normalOffset ) = task.normalOverride;
                     }
+                }
+            }
 
-                    pOrigDataAlign += sizeof(Vector3);
-                    pDataAlign     += sizeof(Vector3);
-                    sizeRemaining  -= sizeof(Vector3);
+            // how about tangents?
+
+            // copy everything else excluding what's copied already
+            if ( sizeRemaining )
+            {
+                for ( unsigned k = 0; k < count; ++k )
+                {
+                    memcpy( pDataAlign + k * instanceSize + copyOffset, pOrigDataAlign + copyOffset, sizeRemaining );
                 }
-                
-                // how about tangents?
-                
-                // copy everything else excluding what's copied already
-                memcpy(pDataAlign, pOrigDataAlign, sizeRemaining);
             }
         }
-
-        //unlock
-        pVbuffer->Unlock();
     }
 
-    // replicate indeces
-    unsigned newIdxCount = ReplicateIndeces(pIbuffer, numVertices, qplist.Size());
-
-    // set draw range and bounding box
-    pGeometry->SetDrawRange(TRIANGLE_LIST, 0, newIdxCount);
-    SetBoundingBox( bbox );
-
-    return qplist.Size();
+    if ( task.begin < task.end && numVertices > 0 )
+    {
+        for ( unsigned k = 0; k < REPLICATE_BLOCK_SIZE; ++k )
+        {
+            task.bbox.Merge( BoundingBox( Vector3( minX[k], minY[k], minZ[k] ), Vector3( maxX[k], maxY[k], maxZ[k] ) ) );
+        }
+    }
 }
 
 unsigned GeomReplicator::ReplicateIndeces(IndexBuffer *idxbuffer, unsigned numVertices, unsigned expandSize)
@@ -249,6 +394,7 @@ bool GeomReplicator::ConfigWindVelocity(const PODVector<unsigned> &vertIndecesTo
     batchCount_        = batchCount;
     currentVertexIdx_  = 0;
     timeStepAccum_     = 0.0f;
+    windTime_          = 0.0f;
 
     // validate vert indeces
     assert(vertIndecesToMove.Size() <= numVertsPerGeom && "number of indeces to move is greater than the orig geom index size");
@@ -258,93 +404,132 @@ bool GeomReplicator::ConfigWindVelocity(const PODVector<unsigned> &vertIndecesTo
         assert(vertIndecesToMove[i] < numVertsPerGeom && "vert index must be contained within the original geom size" );
     }
 
-    timerUpdate_.Reset();
+    // animation state for the moving verts only
+    unsigned numToMove = vertIndecesToMove_.Size();
+
+    animPhases_.Resize( numGeoms_ );
+    animDirections_.Resize( numGeoms_ );
+    animDeltas_.Resize( numGeoms_ );
+    animOrigPositions_.Resize( numGeoms_ * numToMove );
+    batchElapsed_.Resize( batchCount_ ? (numGeoms_ + batchCount_ - 1) / batchCount_ : 0 );
+
+    for ( unsigned i = 0; i < numGeoms_; ++i )
+    {
+        animPhases_[i]     = Random() * WIND_PHASE_RANGE;
+        animDirections_[i] = 1.0f;
+        animDeltas_[i]     = Vector3::ZERO;
+    }
+
+    for ( unsigned i = 0; i < batchElapsed_.Size(); ++i )
+    {
+        batchElapsed_[i] = 0.0f;
+    }
+
+    // rest positions from the replicated verts
+    if ( numGeoms_ > 0 && numToMove > 0 )
+    {
+        VertexBuffer *pVbuffer = GetModel()->GetGeometry(0, 0)->GetVertexBuffer(0);
+        unsigned vertexSize = pVbuffer->GetVertexSize();
+        const unsigned char *pVertexData = (const unsigned char*)pVbuffer->Lock(0, pVbuffer->GetVertexCount());
+
+        if ( pVertexData )
+        {
+            for ( unsigned i = 0; i < numGeoms_; ++i )
+            {
+                for ( unsigned j = 0; j < numToMove; ++j )
+                {
+                    unsigned vertIdx = i * numVertsPerGeom + vertIndecesToMove_[j];
+                    animOrigPositions_[i * numToMove + j] = *reinterpret_cast<const Vector3*>( pVertexData + vertIdx * vertexSize );
+                }
+            }
+
+            pVbuffer->Unlock();
+        }
+    }
+
     return true;
 }
 
-void GeomReplicator::AnimateVerts()
+void GeomReplicator::AnimateVerts(float timeStep)
 {
+    if ( batchCount_ == 0 || numGeoms_ == 0 || animPhases_.Size() != numGeoms_ )
+        return;
+
     Geometry *pGeometry = GetModel()->GetGeometry(0, 0);
     VertexBuffer *pVbuffer = pGeometry->GetVertexBuffer(0);
     unsigned vertexSize = pVbuffer->GetVertexSize();
-    unsigned vertsToMove = 0;
+    unsigned numToMove = vertIndecesToMove_.Size();
+    unsigned geomBeg = currentVertexIdx_;
+    unsigned geomEnd = Min( currentVertexIdx_ + batchCount_, numGeoms_ );
 
-    // update animation
-    for ( unsigned i = 0; i < batchCount_; ++i )
+    // every batch has waited another step, this one takes its wait
+    for ( unsigned i = 0; i < batchElapsed_.Size(); ++i )
     {
-        unsigned idx = (currentVertexIdx_ + i)*numVertsPerGeom;
+        batchElapsed_[i] += timeStep;
+    }
 
-        if (idx >= animatedVertexList_.Size() )
-            break;
+    unsigned batchIdx = currentVertexIdx_ / batchCount_;
+    float elapsedTime = Min( batchElapsed_[batchIdx], (float)MaxTime_Elapsed / 1000.0f );
+    batchElapsed_[batchIdx] = 0.0f;
 
-        vertsToMove++;
+    // the analytic mode's clock, kept within a cycle
+    float windPeriod = GetWindPeriod();
+    windTime_ = windPeriod > 0.0f ? fmodf( windTime_ + timeStep, windPeriod ) : 0.0f;
 
-        for ( unsigned j = 0; j < vertIndecesToMove_.Size(); ++j )
-        {
-            unsigned vertIdx = idx + vertIndecesToMove_[j];
+    bool analytic = windMode_ == WindMode_Analytic;
 
-            int ielptime = animatedVertexList_[vertIdx].timer.GetMSec(true);
-            if ( ielptime > MaxTime_Elapsed ) ielptime = MaxTime_Elapsed;
+    // update animation, the analytic mode has none to update
+    if ( !analytic )
+    {
+        for ( unsigned i = geomBeg; i < geomEnd; ++i )
+        {
+            float step = elapsedTime * animDirections_[i];
+            animDeltas_[i] += windVelocity_ * step;
+            animPhases_[i] += step;
 
-            float elapsedTime = (float)ielptime / 1000.0f;
-            
-            if ( !animatedVertexList_[vertIdx].reversing )
+            if ( animDirections_[i] > 0.0f )
             {
-                Vector3 delta = windVelocity_ * elapsedTime;
-                animatedVertexList_[vertIdx].deltaMovement += delta;
-                animatedVertexList_[vertIdx].timeAccumlated += elapsedTime;
-
-                if ( animatedVertexList_[vertIdx].timeAccumlated > cycleTimer_ )
+                if ( animPhases_[i] > cycleTimer_ )
                 {
-                    animatedVertexList_[vertIdx].reversing = true;
+                    animDirections_[i] = WIND_REVERSE_DIRECTION;
                 }
             }
-            else
+            else if ( animPhases_[i] < 0.0f )
             {
-                // slowed on reverse
-                elapsedTime *= 0.5f;
-                Vector3 delta = windVelocity_ * elapsedTime;
-                animatedVertexList_[vertIdx].deltaMovement -= delta;
-                animatedVertexList_[vertIdx].timeAccumlated -= elapsedTime;
-
-                if ( animatedVertexList_[vertIdx].timeAccumlated < 0.0f )
-                {
-                    animatedVertexList_[vertIdx].deltaMovement = Vector3::ZERO;
-                    animatedVertexList_[vertIdx].timeAccumlated = 0.0f;
-                    animatedVertexList_[vertIdx].reversing = false;
-                }
+                animDeltas_[i] = Vector3::ZERO;
+                animPhases_[i] = 0.0f;
+                animDirections_[i] = 1.0f;
             }
+        }
+    }
 
-            // dbg text3d
-            #ifdef VERT_INDEX_VISUAL
-            if ( showGeomVertIndeces_ && currentVertexIdx_ == 0 && i == 0 )
-            {
-                Vector3 pos = animatedVertexList_[vertIdx].origPos + animatedVertexList_[vertIdx].deltaMovement;
-                nodeText3DVertList_[vertIdx]->SetPosition(pos);
-            }
-            #endif
+    // dbg text3d
+    #ifdef VERT_INDEX_VISUAL
+    if ( showGeomVertIndeces_ && geomBeg == 0 )
+    {
+        for ( unsigned j = 0; j < numToMove; ++j )
+        {
+            Vector3 delta = analytic ? GetWindDisplacement( 0, windTime_ ) : animDeltas_[0];
+            nodeText3DVertList_[vertIndecesToMove_[j]]->SetPosition( animOrigPositions_[j] + delta );
         }
     }
+    #endif
 
     // update vertex buffer
-    unsigned char *pVertexData = (unsigned char*)pVbuffer->Lock(currentVertexIdx_ * numVertsPerGeom, vertsToMove * numVertsPerGeom);
+    unsigned char *pVertexData = (unsigned char*)pVbuffer->Lock(geomBeg * numVertsPerGeom, (geomEnd - geomBeg) * numVertsPerGeom);
 
     if ( pVertexData )
     {
-        for ( unsigned i = 0; i < batchCount_; ++i )
+        for ( unsigned i = geomBeg; i < geomEnd; ++i )
         {
-            unsigned idx = (currentVertexIdx_ + i)*numVertsPerGeom;
+            const Vector3 *origPos = &animOrigPositions_[i * numToMove];
+            unsigned char *pGeomData = pVertexData + (i - geomBeg) * numVertsPerGeom * vertexSize;
+            Vector3 delta = analytic ? GetWindDisplacement( i, windTime_ ) : animDeltas_[i];
 
-            if (idx >= animatedVertexList_.Size() )
-                break;
-
-            for ( unsigned j = 0; j < vertIndecesToMove_.Size(); ++j )
+            for ( unsigned j = 0; j < numToMove; ++j )
             {
-                unsigned vertIdx = idx + vertIndecesToMove_[j];
-                unsigned char *pDataAlign = (unsigned char *)(pVertexData + (i*numVertsPerGeom + vertIndecesToMove_[j]) * vertexSize );
-
-                Vector3 &pos = *reinterpret_cast<Vector3*>( pDataAlign );
-                pos = animatedVertexList_[vertIdx].origPos + animatedVertexList_[vertIdx].deltaMovement;
+                Vector3 &pos = *reinterpret_cast<Vector3*>( pGeomData + vertIndecesToMove_[j] * vertexSize );
+                pos = origPos[j] + delta;
             }
         }
 
@@ -354,12 +539,40 @@ void GeomReplicator::AnimateVerts()
     // update batch idx
     currentVertexIdx_ += batchCount_;
 
-    if (currentVertexIdx_*numVertsPerGeom >= animatedVertexList_.Size()) 
+    if (currentVertexIdx_ >= numGeoms_) 
     {
         currentVertexIdx_ = 0;
     }
 }
 
+void GeomReplicator::SetWindMode(WindModeType mode)
+{
+    windMode_ = mode;
+}
+
+float GeomReplicator::GetWindPeriod() const
+{
+    // blown out over the cycle timer, then back at the reverse speed
+    return cycleTimer_ * ( 1.0f - 1.0f / WIND_REVERSE_DIRECTION );
+}
+
+Vector3 GeomReplicator::GetWindDisplacement(unsigned geomIndex, float time) const
+{
+    float windPeriod = GetWindPeriod();
+
+    if ( windPeriod <= 0.0f )
+        return Vector3::ZERO;
+
+    float t = fmodf( time + GeomWindPhase( geomIndex ), windPeriod );
+
+    if ( t < 0.0f )
+        t += windPeriod;
+
+    float amount = t < cycleTimer_ ? t : cycleTimer_ + ( t - cycleTimer_ ) * WIND_REVERSE_DIRECTION;
+
+    return windVelocity_ * amount;
+}
+
 void GeomReplicator::WindAnimationEnabled(bool enable)
 {
     if (enable)
@@ -406,11 +619,13 @@ void GeomReplicator::HandleUpdate(StringHash eventType, VariantMap& eventData)
 
     float timeStep = eventData[P_TIMESTEP].GetFloat();
 
-    if ( timerUpdate_.GetMSec(false) >= FrameRate_MSec )
+    timeStepAccum_ += timeStep;
+
+    if ( timeStepAccum_ * 1000.0f >= (float)FrameRate_MSec )
     {
-        AnimateVerts();
+        AnimateVerts( timeStepAccum_ );
 
-        timerUpdate_.Reset();
+        timeStepAccum_ = 0.0f;
     }
 
     RenderGeomVertIndeces();
@@ -529,6 +744,7 @@ void StaticScene::CreateScene()
         float cycleTimer = 0.4f;
 
         vegReplicator_->ConfigWindVelocity(topVerts, batchCount, windVel, cycleTimer);
+        vegReplicator_->SetWindMode(GeomReplicator::WindMode_Analytic);
         vegReplicator_->WindAnimationEnabled(true);
         vegReplicator_->ShowGeomVertIndeces(true);
     }
@@ -29,6 +29,7 @@ namespace Urho3D
 class Node;
 class Scene;
 class Text3D;
+struct WorkItem;
 }
 
 //=============================================================================
@@ -44,20 +45,10 @@ class GeomReplicator : public StaticModel
 {
     URHO3D_OBJECT(GeomReplicator, StaticModel);
 
-    struct MoveAccumulator
-    {
-        MoveAccumulator() 
-            : origPos(Vector3::ZERO), deltaMovement(Vector3::ZERO), reversing(false)
-        {
-            timeAccumlated = Random() * 0.2f;
-        }
-
-        Vector3 origPos;
-        Vector3 deltaMovement;
-        Timer   timer;
-        float   timeAccumlated;
-        bool    reversing;
-    };
+public:
+    // accumulate integrates each geom's movement from frame to frame, analytic evaluates it
+    // from the time and the geom's index, so batches can be skipped or updated in any order
+    enum WindModeType { WindMode_Accumulate, WindMode_Analytic };
 
 public:
     static void RegisterObject(Context* context)
@@ -66,7 +57,8 @@ public:
     }
 
     GeomReplicator(Context *context) 
-        : StaticModel(context), numVertsPerGeom(0), batchCount_(0), showGeomVertIndeces_(false)
+        : StaticModel(context), numVertsPerGeom(0), numGeoms_(0), batchCount_(0), currentVertexIdx_(0), 
+          timeStepAccum_(0.0f), windMode_(WindMode_Accumulate), windTime_(0.0f), showGeomVertIndeces_(false)
     {
     }
 
@@ -77,26 +69,59 @@ public:
     unsigned Replicate(const PODVector<PRotScale> &qplist, const Vector3 &normalOverride=Vector3::ZERO);
     bool ConfigWindVelocity(const PODVector<unsigned> &vertIndecesToMove, unsigned batchCount, 
                             const Vector3 &velocity, float cycleTimer);
+    void SetWindMode(WindModeType mode);
+    WindModeType GetWindMode() const { return windMode_; }
+    // the analytic mode's cycle and a geom's displacement at any time in it
+    float GetWindPeriod() const;
+    Vector3 GetWindDisplacement(unsigned geomIndex, float time) const;
     void WindAnimationEnabled(bool enable);
     void ShowGeomVertIndeces(bool show);
 
 protected:
+    // a slice of the instances to replicate, transformed on a work queue thread
+    struct ReplicateTask
+    {
+        const PRotScale         *instances;
+        const unsigned char     *origVerts;
+        unsigned char           *destVerts;
+        unsigned                begin;
+        unsigned                end;
+        unsigned                numVertices;
+        unsigned                vertexSize;
+        unsigned                elementMask;
+        Vector3                 normalOverride;
+        BoundingBox             bbox;
+    };
+
+    static void ReplicateWork(const WorkItem *item, unsigned threadIndex);
+    static void TransformInstances(ReplicateTask &task);
     unsigned ReplicateIndeces(IndexBuffer *idxbuffer, unsigned numVertices, unsigned expandSize);
-    void AnimateVerts();
+    void AnimateVerts(float timeStep);
     void RenderGeomVertIndeces();
     void HandleUpdate(StringHash eventType, VariantMap& eventData);
 
 protected:
-    PODVector<MoveAccumulator>  animatedVertexList_;
     PODVector<unsigned>         vertIndecesToMove_;
 
+    // wind animation state - the verts that move in a geom move together, so the phase, direction
+    // and delta are per geom, and only the moving verts keep their rest positions
+    PODVector<float>            animPhases_;
+    PODVector<float>            animDirections_;
+    PODVector<Vector3>          animDeltas_;
+    PODVector<Vector3>          animOrigPositions_;
+
+    // time each batch has waited since its last update
+    PODVector<float>            batchElapsed_;
+
     unsigned                    numVertsPerGeom;
+    unsigned                    numGeoms_;
     unsigned                    batchCount_;
     unsigned                    currentVertexIdx_;
-    Timer                       timerUpdate_;
     Vector3                     windVelocity_;
     float                       cycleTimer_;
     float                       timeStepAccum_;
+    WindModeType                windMode_;
+    float                       windTime_;
 
     // dbg
     Vector<Node*>               nodeText3DVertList_;
@@ -17,11 +17,40 @@ varying highp vec2 vWaterUV;
 varying highp vec4 vEyeVec;
 #endif
 varying vec3 vNormal;
+varying float vFoam;
 varying vec3 vReflectionVec;
+#ifdef DETAILMAP
+varying vec4 vDetailUV;
+varying float vDetailStrength;
+#endif
 
 #ifdef COMPILEVS
 uniform vec2 cNoiseSpeed;
 uniform float cNoiseTiling;
+uniform float cDetailOffset;
+
+// compact vertex, see Ocean::MakeMesh() - iPos is the undisplaced grid with the shore attenuation in y
+// and the dequantize range in w,
+// iTangent the horizontal displacement, iColor the height and octahedral normal and iTexCoord1 the
+// jacobian over 1 +-OCEAN_COMPACT_JACOBIAN. The 16-bit values are split over two normalized bytes
+#define OCEAN_COMPACT_JACOBIAN 4.0
+
+// whitecaps build as the jacobian drops under this, and cover where the waves fold over
+#define FOAM_JACOBIAN 0.5
+
+float Decode16(vec2 bytes)
+{
+    return dot(bytes, vec2(255.0, 65280.0) / 65535.0) * 2.0 - 1.0;
+}
+
+vec3 DecodeOctahedron(vec2 e)
+{
+    e = e * 2.0 - 1.0;
+    vec3 n = vec3(e.x, 1.0 - abs(e.x) - abs(e.y), e.y);
+    if (n.y < 0.0)
+        n.xz = (1.0 - abs(n.zx)) * (step(0.0, n.xz) * 2.0 - 1.0);
+    return normalize(n);
+}
 #endif
 #ifdef COMPILEPS
 uniform float cNoiseStrength;
@@ -32,7 +61,8 @@ uniform vec3 cWaterTint;
 void VS()
 {
     mat4 modelMatrix = iModelMatrix;
-    vec3 worldPos = GetWorldPos(modelMatrix);
+    vec3 localPos = vec3(iPos.x + Decode16(iTangent.xy) * iPos.w, Decode16(iColor.xy) * iPos.w, iPos.z + Decode16(iTangent.zw) * iPos.w);
+    vec3 worldPos = (vec4(localPos, 1.0) * modelMatrix).xyz;
     gl_Position = GetClipPos(worldPos);
     vScreenPos = GetScreenPos(gl_Position);
     // GetQuadTexCoord() returns a vec2 that is OK for quad rendering; multiply it with output W
@@ -43,10 +73,19 @@ void VS()
     //vReflectUV.y = 1.0 - vReflectUV.y;
     //vReflectUV *= gl_Position.w;
     //vWaterUV = iTexCoord * cNoiseTiling + cElapsedTime * cNoiseSpeed;
-    vNormal = GetWorldNormal(modelMatrix);
+    vNormal = normalize(DecodeOctahedron(iColor.zw) * GetNormalMatrix(modelMatrix));
+    vFoam = clamp(1.0 - (Decode16(iTexCoord1.xy) * OCEAN_COMPACT_JACOBIAN + 1.0) / FOAM_JACOBIAN, 0.0, 1.0);
     vEyeVec = vec4(cCameraPos - worldPos, GetDepth(gl_Position));
 
 	vReflectionVec = worldPos - cCameraPos;
+
+    #ifdef DETAILMAP
+        // the map covers the patch in uv, its normals are in the patch's space with y up. The ocean
+        // is level, so the world x axis is all that's needed to turn them
+        vDetailUV.xy = iTexCoord + cDetailOffset;
+        vDetailUV.zw = normalize((vec3(1.0, 0.0, 0.0) * GetNormalMatrix(modelMatrix)).xz);
+        vDetailStrength = iPos.y;
+    #endif
 }
 
 void PS()
@@ -61,14 +100,25 @@ void PS()
     //    noise.y = 0.0;
     //reflectUV += noise;
 
-    vec3 normal = normalize(vNormal);
+    #ifdef DETAILMAP
+        // the map only has the waves shorter than the mesh's, their slopes are added to the vertex
+        // normal's, which has the ripples, and damped with the waves in the shallows
+        vec3 detail = texture2D(sNormalMap, vDetailUV.xy).rbg * 2.0 - 1.0;
+        vec2 axisX = vDetailUV.zw;
+        vec3 detailNormal = vec3(detail.x * axisX.x - detail.z * axisX.y, detail.y, detail.x * axisX.y + detail.z * axisX.x);
+        vec3 meshNormal = normalize(vNormal);
+        vec2 slope = meshNormal.xz / max(meshNormal.y, 0.05) + vDetailStrength * detailNormal.xz / max(detailNormal.y, 0.05);
+        vec3 normal = normalize(vec3(slope.x, 1.0, slope.y));
+    #else
+        vec3 normal = normalize(vNormal);
+    #endif
 	vec3 skyColor = cMatEnvMapColor * textureCube(sEnvCubeMap, reflect(vReflectionVec, normal)).rgb;
 
-    float fresnel = pow(1.0 - clamp(dot(normalize(vEyeVec.xyz), vNormal), 0.0, 1.0), cFresnelPower);
+    float fresnel = pow(1.0 - clamp(dot(normalize(vEyeVec.xyz), normal), 0.0, 1.0), cFresnelPower);
     //vec3 refractColor = texture2D(sEnvMap, refractUV).rgb * cWaterTint;
     //vec3 reflectColor = texture2D(sDiffMap, reflectUV).rgb;
 
-    vec3 finalColor = mix(cWaterTint, skyColor, fresnel);
+    vec3 finalColor = mix(mix(cWaterTint, skyColor, fresnel), vec3(1.0), vFoam);
 
     gl_FragColor = vec4(GetFog(finalColor, GetFogFactor(vEyeVec.w)), 0.94);
 }
@@ -9,6 +9,7 @@
 // D3D9 uniforms
 uniform float2 cNoiseSpeed;
 uniform float cNoiseTiling;
+uniform float cDetailOffset;
 uniform float cNoiseStrength;
 uniform float cFresnelPower;
 uniform float3 cWaterTint;
@@ -21,6 +22,7 @@ cbuffer CustomVS : register(b6)
 {
     float2 cNoiseSpeed;
     float cNoiseTiling;
+    float cDetailOffset;
 }
 #else
 cbuffer CustomPS : register(b6)
@@ -33,25 +35,55 @@ cbuffer CustomPS : register(b6)
 
 #endif
 
+// compact vertex, see Ocean::MakeMesh() - iPos is the undisplaced grid with the shore attenuation in y
+// and the dequantize range in w,
+// iTangent the horizontal displacement, iColor the height and octahedral normal and iTexCoord1 the
+// jacobian over 1 +-OCEAN_COMPACT_JACOBIAN. The 16-bit values are split over two normalized bytes
+#define OCEAN_COMPACT_JACOBIAN 4.0
+
+// whitecaps build as the jacobian drops under this, and cover where the waves fold over
+#define FOAM_JACOBIAN 0.5
+
+float Decode16(float2 bytes)
+{
+    return dot(bytes, float2(255.0, 65280.0) / 65535.0) * 2.0 - 1.0;
+}
+
+float3 DecodeOctahedron(float2 e)
+{
+    e = e * 2.0 - 1.0;
+    float3 n = float3(e.x, 1.0 - abs(e.x) - abs(e.y), e.y);
+    if (n.y < 0.0)
+        n.xz = (1.0 - abs(n.zx)) * (step(0.0, n.xz) * 2.0 - 1.0);
+    return normalize(n);
+}
+
 void VS(float4 iPos : POSITION,
-    float3 iNormal: NORMAL,
+    float4 iTangent : TANGENT,
+    float4 iColor : COLOR0,
     float2 iTexCoord : TEXCOORD0,
+    float4 iTexCoord1 : TEXCOORD1,
     #ifdef INSTANCED
         float4x3 iModelInstance : TEXCOORD4,
     #endif
     out float4 oScreenPos : TEXCOORD0,
     out float2 oReflectUV : TEXCOORD1,
     out float2 oWaterUV : TEXCOORD2,
-    out float3 oNormal : TEXCOORD3,
+    out float4 oNormal : TEXCOORD3,
     out float4 oEyeVec : TEXCOORD4,
     out float3 oReflectionVec : TEXCOORD6,
+    #ifdef DETAILMAP
+        out float4 oDetailUV : TEXCOORD5,
+        out float oDetailStrength : TEXCOORD7,
+    #endif
     #if defined(D3D11) && defined(CLIPPLANE)
         out float oClip : SV_CLIPDISTANCE0,
     #endif
     out float4 oPos : OUTPOSITION)
 {
     float4x3 modelMatrix = iModelMatrix;
-    float3 worldPos = GetWorldPos(modelMatrix);
+    float3 localPos = float3(iPos.x + Decode16(iTangent.xy) * iPos.w, Decode16(iColor.xy) * iPos.w, iPos.z + Decode16(iTangent.zw) * iPos.w);
+    float3 worldPos = mul(float4(localPos, 1.0), modelMatrix);
     oPos = GetClipPos(worldPos);
 
     oScreenPos = GetScreenPos(oPos);
@@ -59,7 +91,9 @@ void VS(float4 iPos : POSITION,
     // coordinate to make it work with arbitrary meshes such as the water plane (perform divide in pixel shader)
     oReflectUV = GetQuadTexCoord(oPos) * oPos.w;
     oWaterUV = iTexCoord * cNoiseTiling + cElapsedTime * cNoiseSpeed;
-    oNormal = GetWorldNormal(modelMatrix);
+    // the foam rides in the normal's w, the interpolators are all taken
+    oNormal.xyz = normalize(mul(DecodeOctahedron(iColor.zw), (float3x3)modelMatrix));
+    oNormal.w = saturate(1.0 - (Decode16(iTexCoord1.xy) * OCEAN_COMPACT_JACOBIAN + 1.0) / FOAM_JACOBIAN);
     oEyeVec = float4(cCameraPos - worldPos, GetDepth(oPos));
 
     #if defined(D3D11) && defined(CLIPPLANE)
@@ -67,15 +101,27 @@ void VS(float4 iPos : POSITION,
     #endif
 
 	oReflectionVec = worldPos - cCameraPos;
+
+    #ifdef DETAILMAP
+        // the map covers the patch in uv, its normals are in the patch's space with y up. The ocean
+        // is level, so the world x axis is all that's needed to turn them
+        oDetailUV.xy = iTexCoord + cDetailOffset;
+        oDetailUV.zw = normalize(mul(float3(1.0, 0.0, 0.0), (float3x3)modelMatrix).xz);
+        oDetailStrength = iPos.y;
+    #endif
 }
 
 void PS(
     float4 iScreenPos : TEXCOORD0,
     float2 iReflectUV : TEXCOORD1,
     float2 iWaterUV : TEXCOORD2,
-    float3 iNormal : TEXCOORD3,
+    float4 iNormal : TEXCOORD3,
     float4 iEyeVec : TEXCOORD4,
 	float3 iReflectionVec : TEXCOORD6,
+    #ifdef DETAILMAP
+        float4 iDetailUV : TEXCOORD5,
+        float iDetailStrength : TEXCOORD7,
+    #endif
     #if defined(D3D11) && defined(CLIPPLANE)
         float iClip : SV_CLIPDISTANCE0,
     #endif
@@ -90,13 +136,24 @@ void PS(
     //if (noise.y < 0.0)
     //    noise.y = 0.0;
     //reflectUV += noise;
-	float3 normal = normalize(iNormal);
+    #ifdef DETAILMAP
+        // the map only has the waves shorter than the mesh's, their slopes are added to the vertex
+        // normal's, which has the ripples, and damped with the waves in the shallows
+        float3 detail = Sample2D(NormalMap, iDetailUV.xy).rbg * 2.0 - 1.0;
+        float2 axisX = iDetailUV.zw;
+        float3 detailNormal = float3(detail.x * axisX.x - detail.z * axisX.y, detail.y, detail.x * axisX.y + detail.z * axisX.x);
+        float3 meshNormal = normalize(iNormal.xyz);
+        float2 slope = meshNormal.xz / max(meshNormal.y, 0.05) + iDetailStrength * detailNormal.xz / max(detailNormal.y, 0.05);
+        float3 normal = normalize(float3(slope.x, 1.0, slope.y));
+    #else
+        float3 normal = normalize(iNormal.xyz);
+    #endif
 	float3 skyColor = cMatEnvMapColor * SampleCube(EnvCubeMap, reflect(iReflectionVec, normal)).rgb;
 
-    float fresnel = pow(1.0 - saturate(dot(normalize(iEyeVec.xyz), iNormal)), cFresnelPower);
+    float fresnel = pow(1.0 - saturate(dot(normalize(iEyeVec.xyz), normal)), cFresnelPower);
     //float3 refractColor = Sample2D(EnvMap, refractUV).rgb * cWaterTint;
     //float3 reflectColor = Sample2D(DiffMap, reflectUV).rgb;
-    float3 finalColor = lerp(cWaterTint, skyColor, fresnel);
+    float3 finalColor = lerp(lerp(cWaterTint, skyColor, fresnel), 1.0, iNormal.w);
 
     oColor = float4(GetFog(finalColor, GetFogFactor(iEyeVec.w)), 0.94);
 }
\ No newline at end of file